@@ -0,0 +1,34 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "jd_protocol.h"
+
+// monotonic wall clock
+uint64_t bench_nanos(void);
+// switch tim_get_micros() to virtual time, and set it
+void bench_set_micros(uint64_t t);
+
+// when set (default), frames looped back to the RX queue are dropped immediately
+extern bool bench_drain_rx;
+// number of frames that went on the (simulated) wire
+extern uint32_t bench_tx_frames;
+// if set, called for every frame that goes on the wire
+extern void (*bench_tx_hook)(jd_frame_t *frame);
+// calls to jd_alloc() (or jd_heap_alloc() with JD_SLAB_ALLOC) and bytes requested
+extern uint32_t bench_alloc_count, bench_alloc_bytes;
+
+void bench_platform_init(void);
+void bench_dump_dmesg(void);
+
+// Calls fn(ctx, iters) with increasing 'iters' until a run takes long enough to be measured,
+// and then reports the best of a few runs as ns/op.
+typedef void (*bench_fn_t)(void *ctx, uint32_t iters);
+void bench_run(const char *name, bench_fn_t fn, void *ctx);
+
+// results are accumulated here, so that the compiler can't drop the benchmarked code
+extern volatile uint32_t bench_sink;
+
+#endif
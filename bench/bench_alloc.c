@@ -0,0 +1,323 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+// Compares the size-class allocator (JD_SLAB_ALLOC; jd_alloc()/jd_free()) with the heap
+// below it (jd_heap_alloc()/jd_heap_free(), i.e., calloc()/free() here).
+//
+// Usage: jacdac_alloc [--ops N] [--live N] [--seed N]
+//
+// Both allocators replay the same randomized trace, modelled after a client build:
+// long-lived devices, roles and register queries, and short-lived command packets,
+// register buffers and formatted strings (jd_sprintf_a(), jd_to_hex_a()), with the
+// occasional large block (queues). At most --live blocks are allocated at any time.
+//
+// Reported are ns per operation (alloc or free) and, for the slab allocator, the memory
+// taken from the heap at the end of the trace and at its peak, relative to the bytes
+// requested by the live blocks. Results are printed as JSON.
+//
+// jacdac_alloc_profile is the same with JD_ALLOC_PROFILE, so the times include the profiler.
+// It also requests the profile from the control service (JD_CONTROL_CMD_ALLOC_PROFILE)
+// over a pipe, with blocks of the trace still live, and checks the records received.
+
+#include "bench.h"
+#include "jd_client.h"
+#if JD_ALLOC_PROFILE
+#include "jd_pipes.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    const char *name;
+    uint8_t weight;
+    uint8_t short_lived;
+    uint16_t min_size;
+    uint16_t max_size;
+} kind_t;
+
+#define DEV_SIZE(n) (sizeof(jd_device_t) + (n) * sizeof(jd_device_service_t))
+
+static const kind_t kinds[] = {
+    {"device", 4, 0, DEV_SIZE(2), DEV_SIZE(8)},
+    {"role", 4, 0, sizeof(jd_role_t), sizeof(jd_role_t)},
+    {"query", 12, 0, sizeof(jd_register_query_t), sizeof(jd_register_query_t)},
+    {"command", 30, 1, JD_SERIAL_FULL_HEADER_SIZE, JD_SERIAL_FULL_HEADER_SIZE + 32},
+    {"reg_buffer", 10, 1, 5, 64},
+    {"sprintf_a", 30, 1, 8, 120},
+    {"hex_a", 8, 1, 17, 65},
+    {"queue", 2, 0, 600, 2048},
+};
+#define NUM_KINDS (sizeof(kinds) / sizeof(kinds[0]))
+
+// size == 0 frees live block 'idx' (and moves the last live block there)
+typedef struct {
+    uint32_t size;
+    uint32_t idx;
+} op_t;
+
+typedef struct {
+    void *ptr;
+    uint32_t size;
+    uint8_t short_lived;
+} live_t;
+
+static op_t *trace;
+static live_t *live;
+static uint32_t num_ops, max_live, num_live, live_bytes;
+
+static void gen_trace(uint32_t n, uint32_t seed) {
+    unsigned total_weight = 0;
+    for (unsigned i = 0; i < NUM_KINDS; ++i)
+        total_weight += kinds[i].weight;
+
+    trace = malloc(n * sizeof(op_t));
+    num_live = 0;
+    jd_seed_random(seed);
+
+    for (num_ops = 0; num_ops < n; ++num_ops) {
+        op_t *op = &trace[num_ops];
+        // free short-lived blocks soon after allocation, and long-lived ones rarely
+        int victim = -1;
+        if (num_live == max_live) {
+            victim = jd_random() % num_live;
+        } else if (num_live && jd_random() % 100 < 45) {
+            unsigned back = jd_random() % (num_live < 4 ? num_live : 4);
+            victim = num_live - 1 - back;
+            if (!live[victim].short_lived && jd_random() % 8)
+                victim = -1;
+        }
+        if (victim >= 0) {
+            op->size = 0;
+            op->idx = victim;
+            live[victim] = live[--num_live];
+            continue;
+        }
+        unsigned w = jd_random() % total_weight;
+        unsigned k = 0;
+        while (w >= kinds[k].weight)
+            w -= kinds[k++].weight;
+        op->size = kinds[k].min_size + jd_random() % (kinds[k].max_size - kinds[k].min_size + 1);
+        op->idx = num_live;
+        live[num_live].size = op->size;
+        live[num_live].short_lived = kinds[k].short_lived;
+        num_live++;
+    }
+}
+
+typedef void *(*alloc_fn_t)(uint32_t size);
+typedef void (*free_fn_t)(void *ptr);
+
+static uint32_t peak_live_bytes;
+static jd_slab_stats_t peak_stats;
+
+static void replay(alloc_fn_t alloc_fn, free_fn_t free_fn, bool track_peak) {
+    num_live = 0;
+    live_bytes = 0;
+    for (uint32_t i = 0; i < num_ops; ++i) {
+        op_t *op = &trace[i];
+        if (op->size == 0) {
+            live_t *l = &live[op->idx];
+            free_fn(l->ptr);
+            live_bytes -= l->size;
+            *l = live[--num_live];
+        } else {
+            live_t *l = &live[num_live++];
+            l->ptr = alloc_fn(op->size);
+            l->size = op->size;
+            *(uint8_t *)l->ptr = i; // touch it
+            live_bytes += op->size;
+            if (track_peak && live_bytes > peak_live_bytes) {
+                peak_live_bytes = live_bytes;
+                jd_slab_get_stats(&peak_stats);
+            }
+        }
+    }
+}
+
+static void free_all(free_fn_t free_fn) {
+    while (num_live)
+        free_fn(live[--num_live].ptr);
+}
+
+static double time_replay(alloc_fn_t alloc_fn, free_fn_t free_fn) {
+    double best = 0;
+    for (int run = 0; run < 5; ++run) {
+        uint64_t t0 = bench_nanos();
+        replay(alloc_fn, free_fn, false);
+        uint64_t t1 = bench_nanos();
+        free_all(free_fn);
+        double ns = (double)(t1 - t0) / num_ops;
+        if (run == 0 || ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+#if JD_ALLOC_PROFILE
+#define RECEIVER_ID 0x4200000000000001ULL
+
+static jd_ipipe_desc_t profile_pipe;
+static int profile_records, profile_errors, profile_sites = -1;
+static bool profile_closed;
+static uint32_t profile_live_bytes;
+static uint16_t ack_crc[16];
+static unsigned num_acks;
+
+static void profile_data(jd_ipipe_desc_t *istr, jd_packet_t *pkt) {
+    if (profile_records == 0 && pkt->service_size == sizeof(jd_alloc_profile_t)) {
+        jd_alloc_profile_t *totals = (void *)pkt->data;
+        profile_sites = totals->num_sites;
+        profile_live_bytes = totals->live_bytes;
+    } else if (profile_records == 0 || pkt->service_size != sizeof(jd_alloc_site_stats_t)) {
+        profile_errors++;
+    }
+    profile_records++;
+}
+
+static void profile_meta(jd_ipipe_desc_t *istr, jd_packet_t *pkt) {
+    if (pkt == NULL)
+        profile_closed = true;
+}
+
+// the virtual host ACKs and reads back the frames sent to it
+static void profile_tx(jd_frame_t *frame) {
+    if (frame->device_identifier != RECEIVER_ID || !(frame->flags & JD_FRAME_FLAG_COMMAND))
+        return;
+    if ((frame->flags & JD_FRAME_FLAG_ACK_REQUESTED) && num_acks < 16)
+        ack_crc[num_acks++] = frame->crc;
+    jd_frame_t copy;
+    memcpy(&copy, frame, JD_FRAME_SIZE(frame));
+    copy.device_identifier = jd_device_id();
+    do {
+        jd_ipipe_handle_packet((jd_packet_t *)&copy);
+    } while (jd_shift_frame(&copy));
+}
+
+static void send_to_stack(uint64_t dev_id, unsigned flags, unsigned service_index,
+                          unsigned cmd, const void *data, unsigned size) {
+    jd_frame_t frame;
+    jd_reset_frame(&frame);
+    frame.flags = flags;
+    void *dst = jd_push_in_frame(&frame, service_index, cmd, size);
+    if (size)
+        memcpy(dst, data, size);
+    frame.device_identifier = dev_id;
+    jd_compute_crc(&frame);
+    jd_rx_frame_received(&frame);
+}
+
+static void request_profile(void) {
+    uint64_t vt = 1000000;
+    bench_set_micros(vt);
+    bench_drain_rx = false;
+    bench_tx_hook = profile_tx;
+    jd_services_init();
+
+    jd_pipe_cmd_t cmd = {.device_identifier = RECEIVER_ID};
+    cmd.port_num = jd_ipipe_open(&profile_pipe, profile_data, profile_meta);
+    send_to_stack(jd_device_id(), JD_FRAME_FLAG_COMMAND, JD_SERVICE_INDEX_CONTROL,
+                  JD_CONTROL_CMD_ALLOC_PROFILE, &cmd, sizeof(cmd));
+    for (int i = 0; i < 100000 && !profile_closed; ++i) {
+        vt += 100;
+        bench_set_micros(vt);
+        for (unsigned k = 0; k < num_acks; ++k)
+            send_to_stack(RECEIVER_ID, 0, JD_SERVICE_INDEX_CRC_ACK, ack_crc[k], NULL, 0);
+        num_acks = 0;
+        jd_process_everything();
+    }
+}
+
+static bool profile_ok(void) {
+    return profile_closed && profile_errors == 0 && profile_sites > 0 &&
+           profile_records == profile_sites + 1;
+}
+#endif
+
+static uint32_t footprint(jd_slab_stats_t *st) {
+    return st->curr_page_bytes + st->curr_large_bytes;
+}
+
+int main(int argc, char **argv) {
+    uint32_t ops = 1000000;
+    uint32_t seed = 42;
+    max_live = 200;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[++i] : "";
+        if (strcmp(arg, "--ops") == 0) {
+            ops = atoi(val);
+        } else if (strcmp(arg, "--live") == 0) {
+            max_live = atoi(val);
+        } else if (strcmp(arg, "--seed") == 0) {
+            seed = atoi(val);
+        } else {
+            fprintf(stderr, "unknown argument: %s\n", arg);
+            return 1;
+        }
+    }
+    if (ops < 1 || max_live < 1) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    bench_platform_init();
+    live = calloc(max_live, sizeof(live_t));
+    gen_trace(ops, seed);
+
+    // warm up both, and collect fragmentation stats in the first run
+    jd_slab_stats_t st0, st;
+    jd_slab_get_stats(&st0);
+    replay(jd_alloc, jd_free, true);
+    jd_slab_get_stats(&st);
+    uint32_t end_live_bytes = live_bytes;
+#if JD_ALLOC_PROFILE
+    request_profile();
+#endif
+    free_all(jd_free);
+    replay(jd_heap_alloc, jd_heap_free, false);
+    free_all(jd_heap_free);
+
+    double heap_ns = time_replay(jd_heap_alloc, jd_heap_free);
+    double slab_ns = time_replay(jd_alloc, jd_free);
+
+    uint32_t st_allocs = st.num_allocs - st0.num_allocs;
+    printf("{\n  \"ops\": %u,\n  \"max_live\": %u,\n  \"page_size\": %d,\n"
+           "  \"heap_ns_per_op\": %.1f,\n  \"slab_ns_per_op\": %.1f,\n"
+           "  \"allocs\": %u,\n  \"large_allocs\": %u,\n  \"page_allocs\": %u,\n"
+           "  \"page_frees\": %u,\n  \"internal_fragmentation_pct\": %.1f,\n"
+           "  \"end_live_bytes\": %u,\n  \"end_footprint_bytes\": %u,\n"
+           "  \"peak_live_bytes\": %u,\n  \"peak_footprint_bytes\": %u,\n"
+           "  \"max_page_bytes\": %u,\n  \"classes\": [",
+           (unsigned)num_ops, (unsigned)max_live, JD_SLAB_PAGE_SIZE, heap_ns, slab_ns,
+           (unsigned)st_allocs, (unsigned)st.num_large_allocs, (unsigned)st.num_page_allocs,
+           (unsigned)st.num_page_frees,
+           100.0 * (st.total_block_bytes - st.total_requested_bytes) /
+               (st.total_block_bytes ? st.total_block_bytes : 1),
+           (unsigned)end_live_bytes, (unsigned)footprint(&st), (unsigned)peak_live_bytes,
+           (unsigned)footprint(&peak_stats), (unsigned)st.max_page_bytes);
+    for (int i = 0; i < JD_SLAB_NUM_CLASSES; ++i) {
+        jd_slab_class_stats_t *c = &st.classes[i];
+        printf("%s\n    {\"block_size\": %u, \"allocs\": %u, \"pages\": %u, \"blocks\": %u, "
+               "\"used\": %u}",
+               i ? "," : "", c->block_size, (unsigned)c->num_allocs, c->num_pages,
+               (unsigned)c->num_blocks, (unsigned)c->num_used);
+    }
+    printf("\n  ]");
+#if JD_ALLOC_PROFILE
+    // live bytes also include the blocks of jd_services_init()
+    printf(",\n  \"profile_ok\": %s,\n  \"profile_sites\": %d,\n  \"profile_records\": %d,\n"
+           "  \"profile_live_bytes\": %u",
+           profile_ok() ? "true" : "false", profile_sites, profile_records,
+           (unsigned)profile_live_bytes);
+    if (!profile_ok()) {
+        printf("\n}\n");
+        return 1;
+    }
+#endif
+    printf("\n}\n");
+
+    return 0;
+}
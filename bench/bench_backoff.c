@@ -0,0 +1,271 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+// Simulates arbitration of many nodes on a single bus, comparing the fixed TX start delay
+// (jd_tx_backoff_delay() with no contention) with the adaptive backoff of jd_physical.c.
+//
+// Usage: jacdac_backoff [--nodes 2,8,...] [--rate FPS] [--size BYTES] [--seconds N]
+//                       [--window US] [--race-window US]
+//
+// Every node generates --rate frames per second (Poisson), of --size bytes (incl. header),
+// and keeps at most 8 frames queued. As in jd_physical.c, when the line becomes idle,
+// every node with pending frames schedules a TX attempt after jd_tx_backoff_delay().
+// An attempt on a line that went low less than --window us ago results in a collision
+// (all frames involved are lost). Less than --race-window us ago, the node hasn't yet
+// processed the line going low, and uart_start_tx() fails (a race). Otherwise, the node
+// is already receiving, and flush_tx_queue() defers. Both races and deferrals count as lost
+// arbitration for the backoff.
+//
+// Results are printed as JSON.
+
+#include "bench.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_NODES 256
+#define QUEUE_SIZE 8
+#define NEVER UINT64_MAX
+
+typedef struct {
+    uint64_t queue[QUEUE_SIZE]; // generation times
+    uint8_t qlen;
+    jd_tx_backoff_t backoff;
+    uint8_t transmitting;
+    uint64_t attempt_at;
+    uint64_t next_gen;
+} node_t;
+
+typedef struct {
+    uint32_t generated;
+    uint32_t delivered;
+    uint32_t collided;
+    uint32_t races;
+    uint32_t deferred;
+    uint32_t drops;
+    uint64_t busy_us;
+    uint32_t *latency;
+    unsigned num_latency;
+    unsigned latency_cap;
+} results_t;
+
+static node_t nodes[MAX_NODES];
+static int num_nodes;
+static double rate = 50;
+static unsigned frame_size = 32;
+static unsigned window_us = 5;
+static unsigned race_window_us = 25;
+static bool adaptive;
+
+static uint64_t line_start, line_end;
+static int num_tx;
+static results_t res;
+
+static uint32_t wire_us(void) {
+    return frame_size * 10 + 70;
+}
+
+static uint64_t next_arrival(uint64_t t) {
+    double u = (jd_random() + 1.0) / 4294967297.0;
+    return t + (uint64_t)(-log(u) / rate * 1e6) + 1;
+}
+
+static void schedule(node_t *n, uint64_t t) {
+    static jd_tx_backoff_t none;
+    n->attempt_at = t + jd_tx_backoff_delay(adaptive ? &n->backoff : &none);
+}
+
+static void attempt(node_t *n, uint64_t t) {
+    n->attempt_at = NEVER;
+    if (num_tx && t - line_start >= window_us) {
+        if (t - line_start < race_window_us)
+            res.races++;
+        else
+            res.deferred++;
+        jd_tx_backoff_lost(&n->backoff);
+        return; // will be re-scheduled when the line goes idle
+    }
+    if (!num_tx) {
+        line_start = t;
+        line_end = t + wire_us();
+    } else if (t + wire_us() > line_end) {
+        line_end = t + wire_us();
+    }
+    num_tx++;
+    n->transmitting = 1;
+    jd_tx_backoff_won(&n->backoff);
+    if (res.num_latency == res.latency_cap) {
+        res.latency_cap = res.latency_cap ? res.latency_cap * 2 : 4096;
+        res.latency = realloc(res.latency, res.latency_cap * sizeof(uint32_t));
+        JD_ASSERT(res.latency != NULL);
+    }
+    res.latency[res.num_latency++] = (uint32_t)(t - n->queue[0]);
+}
+
+static void line_idle(uint64_t t) {
+    res.busy_us += line_end - line_start;
+    for (int i = 0; i < num_nodes; ++i) {
+        node_t *n = &nodes[i];
+        if (n->transmitting) {
+            n->transmitting = 0;
+            n->qlen--;
+            memmove(n->queue, n->queue + 1, n->qlen * sizeof(uint64_t));
+            if (num_tx == 1)
+                res.delivered++;
+            else
+                res.collided++;
+        }
+    }
+    num_tx = 0;
+    for (int i = 0; i < num_nodes; ++i)
+        if (nodes[i].qlen)
+            schedule(&nodes[i], t);
+}
+
+static void generate(node_t *n, uint64_t t) {
+    n->next_gen = next_arrival(t);
+    res.generated++;
+    if (n->qlen == QUEUE_SIZE) {
+        res.drops++;
+        return;
+    }
+    n->queue[n->qlen++] = t;
+    // jd_packet_ready() only schedules when the line is idle
+    if (!num_tx && n->attempt_at == NEVER)
+        schedule(n, t);
+}
+
+static void simulate(int nn, bool adapt, uint32_t seconds) {
+    num_nodes = nn;
+    adaptive = adapt;
+    memset(nodes, 0, sizeof(nodes));
+    uint32_t *lat = res.latency;
+    unsigned cap = res.latency_cap;
+    memset(&res, 0, sizeof(res));
+    res.latency = lat;
+    res.latency_cap = cap;
+    num_tx = 0;
+    jd_seed_random(42);
+
+    for (int i = 0; i < num_nodes; ++i) {
+        nodes[i].attempt_at = NEVER;
+        nodes[i].next_gen = next_arrival(0);
+    }
+
+    uint64_t end = (uint64_t)seconds * 1000000;
+    uint64_t t = 0;
+    while (t < end) {
+        uint64_t next = num_tx ? line_end : NEVER;
+        for (int i = 0; i < num_nodes; ++i) {
+            if (nodes[i].attempt_at < next)
+                next = nodes[i].attempt_at;
+            if (nodes[i].next_gen < next)
+                next = nodes[i].next_gen;
+        }
+        t = next;
+
+        if (num_tx && t >= line_end)
+            line_idle(t);
+
+        // nodes firing at the same time are handled in random order
+        int first = jd_random() % num_nodes;
+        for (int k = 0; k < num_nodes; ++k) {
+            node_t *n = &nodes[(first + k) % num_nodes];
+            if (n->attempt_at <= t)
+                attempt(n, t);
+        }
+        for (int i = 0; i < num_nodes; ++i)
+            if (nodes[i].next_gen <= t)
+                generate(&nodes[i], t);
+    }
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static uint32_t percentile(unsigned p) {
+    return res.num_latency ? res.latency[(res.num_latency - 1) * p / 100] : 0;
+}
+
+static int num_results;
+
+static void print_results(const char *policy, uint32_t seconds) {
+    qsort(res.latency, res.num_latency, sizeof(uint32_t), cmp_u32);
+    printf("%s\n    {\"policy\": \"%s\", \"nodes\": %d, \"offered_fps\": %u, "
+           "\"delivered_fps\": %u, \"goodput_bps\": %u, \"utilization_pct\": %u, "
+           "\"collided\": %u, \"races\": %u, \"deferred\": %u, \"drops\": %u, "
+           "\"latency_p50_us\": %u, \"latency_p99_us\": %u}",
+           num_results++ ? "," : "", policy, num_nodes, (unsigned)(res.generated / seconds),
+           (unsigned)(res.delivered / seconds),
+           (unsigned)((uint64_t)res.delivered * frame_size / seconds),
+           (unsigned)(res.busy_us / (seconds * 10000)), (unsigned)res.collided,
+           (unsigned)res.races, (unsigned)res.deferred, (unsigned)res.drops,
+           (unsigned)percentile(50), (unsigned)percentile(99));
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    int node_counts[16] = {1, 2, 8, 16, 32, 50, 64, 100};
+    int num_counts = 8;
+    uint32_t seconds = 10;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[++i] : "";
+        if (strcmp(arg, "--rate") == 0) {
+            rate = atof(val);
+        } else if (strcmp(arg, "--size") == 0) {
+            frame_size = atoi(val);
+        } else if (strcmp(arg, "--seconds") == 0) {
+            seconds = atoi(val);
+        } else if (strcmp(arg, "--window") == 0) {
+            window_us = atoi(val);
+        } else if (strcmp(arg, "--race-window") == 0) {
+            race_window_us = atoi(val);
+        } else if (strcmp(arg, "--nodes") == 0) {
+            num_counts = 0;
+            for (const char *p = val; *p && num_counts < 16;) {
+                node_counts[num_counts++] = atoi(p);
+                p = strchr(p, ',');
+                if (!p)
+                    break;
+                p++;
+            }
+        } else {
+            fprintf(stderr, "unknown argument: %s\n", arg);
+            return 1;
+        }
+    }
+
+    if (rate <= 0 || seconds < 1 || frame_size < 16 || frame_size > 252) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+    for (int i = 0; i < num_counts; ++i)
+        if (node_counts[i] < 1 || node_counts[i] > MAX_NODES) {
+            fprintf(stderr, "invalid number of nodes\n");
+            return 1;
+        }
+
+    printf("{\n  \"rate\": %u,\n  \"size\": %u,\n  \"window_us\": %u,\n  \"race_window_us\": %u,\n"
+           "  \"backoff_base\": %d,\n  \"backoff_slot\": %d,\n  \"backoff_max\": %d,\n"
+           "  \"results\": [",
+           (unsigned)rate, frame_size, window_us, race_window_us, JD_TX_BACKOFF_BASE,
+           JD_TX_BACKOFF_SLOT, JD_TX_BACKOFF_MAX);
+
+    for (int i = 0; i < num_counts; ++i) {
+        simulate(node_counts[i], false, seconds);
+        print_results("fixed", seconds);
+        simulate(node_counts[i], true, seconds);
+        print_results("adaptive", seconds);
+    }
+
+    printf("\n  ]\n}\n");
+    free(res.latency);
+
+    return 0;
+}
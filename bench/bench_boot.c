@@ -0,0 +1,186 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+// Measures jd_services_init() and service dispatch, with services allocated at boot
+// (jacdac_boot), or reserved at link time with JD_STATIC_SERVICES (jacdac_boot_static).
+//
+// Usage: jacdac_boot [--services N]
+//
+// The app has the control service, the role manager, and N (default 16, at most 24)
+// small sensor-like services of various sizes; the first of them is instantiated twice,
+// as if configured twice in DCFG, and the second instance always comes from jd_alloc().
+//
+// Reported are heap allocations done by jd_services_init(), bytes reserved for service
+// state at link time, the time of jd_services_init() (with jd_services_deinit() between
+// runs), the time of jd_services_tick() (calling process() of every service),
+// and of routing a packet addressed by service class. Results are printed as JSON.
+
+#include "bench.h"
+#include "jd_client.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_TOYS 24
+
+struct srv_state {
+    SRV_COMMON;
+    uint32_t counter;
+    uint32_t data[0];
+};
+
+static void toy_process(srv_t *state) {
+    state->counter++;
+}
+
+static void toy_handle_packet(srv_t *state, jd_packet_t *pkt) {
+    state->counter += pkt->service_command;
+}
+
+// every toy service needs its own vtable (and static storage)
+#define TOY(n)                                                                                     \
+    static void toy##n##_process(srv_t *state) {                                                   \
+        toy_process(state);                                                                        \
+    }                                                                                              \
+    static void toy##n##_handle_packet(srv_t *state, jd_packet_t *pkt) {                           \
+        toy_handle_packet(state, pkt);                                                             \
+    }                                                                                              \
+    SRV_DEF_SZ(toy##n, 0x10000000 + n, sizeof(srv_t) + 4 * ((n * 7) % 16));                        \
+    static void toy##n##_init(void) {                                                              \
+        SRV_ALLOC(toy##n);                                                                         \
+    }
+
+TOY(0)
+TOY(1)
+TOY(2)
+TOY(3)
+TOY(4)
+TOY(5)
+TOY(6)
+TOY(7)
+TOY(8)
+TOY(9)
+TOY(10)
+TOY(11)
+TOY(12)
+TOY(13)
+TOY(14)
+TOY(15)
+TOY(16)
+TOY(17)
+TOY(18)
+TOY(19)
+TOY(20)
+TOY(21)
+TOY(22)
+TOY(23)
+
+static void (*const toy_inits[MAX_TOYS])(void) = {
+    toy0_init,  toy1_init,  toy2_init,  toy3_init,  toy4_init,  toy5_init,
+    toy6_init,  toy7_init,  toy8_init,  toy9_init,  toy10_init, toy11_init,
+    toy12_init, toy13_init, toy14_init, toy15_init, toy16_init, toy17_init,
+    toy18_init, toy19_init, toy20_init, toy21_init, toy22_init, toy23_init,
+};
+
+static unsigned num_toys = 16;
+
+void app_init_services(void) {
+    // the client routing code requires role manager
+    jd_role_manager_init();
+    for (unsigned i = 0; i < num_toys; ++i)
+        toy_inits[i]();
+    toy_inits[0]();
+}
+
+static jd_packet_t *broadcast_pkt;
+
+// only jd_services_init() is timed
+static uint64_t run_init(uint32_t iters) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < iters; ++i) {
+        jd_services_deinit();
+        uint64_t t0 = bench_nanos();
+        jd_services_init();
+        total += bench_nanos() - t0;
+    }
+    return total;
+}
+
+static uint64_t run_tick(uint32_t iters) {
+    uint64_t t0 = bench_nanos();
+    for (uint32_t i = 0; i < iters; ++i)
+        jd_services_tick();
+    return bench_nanos() - t0;
+}
+
+static uint64_t run_broadcast(uint32_t iters) {
+    uint64_t t0 = bench_nanos();
+    for (uint32_t i = 0; i < iters; ++i)
+        jd_services_handle_packet(broadcast_pkt);
+    return bench_nanos() - t0;
+}
+
+// best of 5 runs, in ns per iteration
+static double time_ns(uint64_t (*fn)(uint32_t), uint32_t iters) {
+    uint64_t best = UINT64_MAX;
+    for (int run = 0; run < 5; ++run) {
+        uint64_t t = fn(iters);
+        if (t < best)
+            best = t;
+    }
+    return (double)best / iters;
+}
+
+static uint32_t static_bytes(void) {
+    uint32_t r = 0;
+#if JD_STATIC_SERVICES
+    extern const jd_srv_static_t __start_jd_srv[], __stop_jd_srv[];
+    for (const jd_srv_static_t *e = __start_jd_srv; e < __stop_jd_srv; ++e)
+        r += e->vt->state_size;
+    r += JD_MAX_SERVICES * sizeof(void *); // the service table
+#endif
+    return r;
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[++i] : "";
+        if (strcmp(arg, "--services") == 0) {
+            num_toys = atoi(val);
+        } else {
+            fprintf(stderr, "unknown argument: %s\n", arg);
+            return 1;
+        }
+    }
+    if (num_toys < 1 || num_toys > MAX_TOYS) {
+        fprintf(stderr, "invalid number of services\n");
+        return 1;
+    }
+
+    bench_platform_init();
+
+    uint32_t count0 = bench_alloc_count, bytes0 = bench_alloc_bytes;
+    jd_services_init();
+    uint32_t init_allocs = bench_alloc_count - count0;
+    uint32_t init_bytes = bench_alloc_bytes - bytes0;
+
+    static jd_frame_t frame;
+    broadcast_pkt = (jd_packet_t *)&frame;
+    broadcast_pkt->flags = JD_FRAME_FLAG_COMMAND | JD_FRAME_FLAG_IDENTIFIER_IS_SERVICE_CLASS;
+    broadcast_pkt->device_identifier = 0x10000000 + num_toys - 1;
+    broadcast_pkt->service_command = 0x80;
+
+    double init_ns = time_ns(run_init, 10000);
+    double tick_ns = time_ns(run_tick, 100000);
+    double broadcast_ns = time_ns(run_broadcast, 100000);
+
+    printf("{\n  \"static_services\": %s,\n  \"services\": %u,\n  \"init_heap_allocs\": %u,\n"
+           "  \"init_heap_bytes\": %u,\n  \"static_bytes\": %u,\n  \"init_ns\": %.1f,\n"
+           "  \"tick_ns\": %.1f,\n  \"broadcast_ns\": %.1f\n}\n",
+           JD_STATIC_SERVICES ? "true" : "false", num_toys + 3, (unsigned)init_allocs,
+           (unsigned)init_bytes, (unsigned)static_bytes(), init_ns, tick_ns, broadcast_ns);
+
+    return 0;
+}
@@ -0,0 +1,108 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+// Measures jd_dmesg() called concurrently from several threads, with the buffer protected
+// by target_disable_irq() (jacdac_dmesg; a mutex here, as on threaded hosts), or with
+// JD_DMESG_LOCK_FREE (jacdac_dmesg_lf).
+//
+// Usage: jacdac_dmesg [--threads N] [--msgs N]
+//
+// Every thread logs --msgs (default 200000) messages. Afterwards, the buffer is read
+// with jd_dmesg_read_line(), and lines which are not complete messages, or are out of order
+// for their thread, are counted as bad (the first line is skipped, as it may be cut).
+// Reported are the wall time per message and the bad lines. Results are printed as JSON.
+
+#define _GNU_SOURCE // for PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
+
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_THREADS 32
+
+static pthread_mutex_t irq_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+void target_disable_irq(void) {
+    pthread_mutex_lock(&irq_mutex);
+}
+
+void target_enable_irq(void) {
+    pthread_mutex_unlock(&irq_mutex);
+}
+
+static unsigned num_threads = 4;
+static unsigned num_msgs = 200000;
+
+static void *writer(void *arg) {
+    int id = (int)(uintptr_t)arg;
+    for (unsigned i = 0; i < num_msgs; ++i)
+        jd_dmesg("thr %d msg %d", id, i);
+    return NULL;
+}
+
+static unsigned count_bad_lines(void) {
+    int last[MAX_THREADS];
+    for (unsigned i = 0; i < MAX_THREADS; ++i)
+        last[i] = -1;
+
+    char line[JD_DMESG_LINE_BUFFER];
+    uint32_t ptr = jd_dmesg_startptr();
+    unsigned bad = 0;
+    bool first = true;
+    // stop at the end, not at empty lines
+    while (ptr != jd_dmesg_currptr()) {
+        jd_dmesg_read_line(line, sizeof(line), &ptr);
+        if (first) {
+            first = false;
+            continue;
+        }
+        int id, msg;
+        char tail;
+        if (sscanf(line, "thr %d msg %d%c", &id, &msg, &tail) != 2 || id < 0 ||
+            id >= (int)num_threads || msg <= last[id]) {
+            bad++;
+            continue;
+        }
+        last[id] = msg;
+    }
+    return bad;
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[++i] : "";
+        if (strcmp(arg, "--threads") == 0) {
+            num_threads = atoi(val);
+        } else if (strcmp(arg, "--msgs") == 0) {
+            num_msgs = atoi(val);
+        } else {
+            fprintf(stderr, "unknown argument: %s\n", arg);
+            return 1;
+        }
+    }
+    if (num_threads < 1 || num_threads > MAX_THREADS) {
+        fprintf(stderr, "invalid number of threads\n");
+        return 1;
+    }
+
+    bench_platform_init();
+
+    pthread_t threads[MAX_THREADS];
+    uint64_t t0 = bench_nanos();
+    for (unsigned i = 0; i < num_threads; ++i)
+        pthread_create(&threads[i], NULL, writer, (void *)(uintptr_t)i);
+    for (unsigned i = 0; i < num_threads; ++i)
+        pthread_join(threads[i], NULL);
+    uint64_t total = bench_nanos() - t0;
+
+    printf("{\n  \"lock_free\": %s,\n  \"threads\": %u,\n  \"msgs\": %u,\n"
+           "  \"ns_per_msg\": %.1f,\n  \"bad_lines\": %u\n}\n",
+           JD_DMESG_LOCK_FREE ? "true" : "false", num_threads, num_msgs,
+           (double)total / ((uint64_t)num_threads * num_msgs), count_bad_lines());
+
+    return 0;
+}
@@ -0,0 +1,197 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+// Checks and measures jd_print_float() and jd_print_double().
+//
+// Usage: jacdac_float [--step N] [--doubles N]
+//
+// Every N-th positive float (default 997; 1 checks all of them, which takes a few minutes)
+// is printed with jd_print_float() and read back with strtof().
+// Then N random doubles (default 1000000) are printed with jd_print_double() and read back
+// with strtod(), and every 10th of them is also checked to have the fewest digits that still
+// read back, by trying printf("%.*e") with increasing precision.
+//
+// Reported are the number of failures, and the time of jd_print_float() for random floats
+// and jd_print_double() for random doubles, next to snprintf("%.9g") and snprintf("%.17g")
+// (which round-trip, but are not shortest). Results are printed as JSON.
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_VALUES 4096
+
+static uint64_t rnd_state = 88172645463325252ULL;
+
+static uint64_t rnd64(void) {
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return rnd_state;
+}
+
+// random finite double, with uniformly distributed bits
+static double rnd_double(void) {
+    for (;;) {
+        uint64_t b = rnd64();
+        if (((b >> 52) & 0x7ff) == 0x7ff)
+            continue;
+        double d;
+        memcpy(&d, &b, sizeof(d));
+        return d;
+    }
+}
+
+static float rnd_float(void) {
+    for (;;) {
+        uint32_t b = (uint32_t)rnd64();
+        if (((b >> 23) & 0xff) == 0xff)
+            continue;
+        float f;
+        memcpy(&f, &b, sizeof(f));
+        return f;
+    }
+}
+
+// number of significant digits, not counting trailing zeros
+static int num_digits(const char *s) {
+    int n = 0, last = 0;
+    bool started = false;
+    for (; *s && *s != 'e'; ++s) {
+        if (*s < '0' || *s > '9')
+            continue;
+        if (*s != '0')
+            started = true;
+        if (started) {
+            n++;
+            if (*s != '0')
+                last = n;
+        }
+    }
+    return last;
+}
+
+static int shortest_digits(double d) {
+    char buf[64];
+    for (int p = 1; p < 17; ++p) {
+        snprintf(buf, sizeof(buf), "%.*e", p - 1, d);
+        if (strtod(buf, NULL) == d)
+            return p;
+    }
+    return 17;
+}
+
+static uint32_t check_floats(unsigned step) {
+    char buf[64];
+    uint32_t failures = 0;
+    for (uint64_t i = 0; i < 0x7f800000; i += step) {
+        uint32_t fbits = (uint32_t)i;
+        float f;
+        memcpy(&f, &fbits, sizeof(f));
+        jd_print_float(buf, f, 0);
+        if (strtof(buf, NULL) != f) {
+            if (failures < 10)
+                fprintf(stderr, "failed: %x -> %s\n", (unsigned)fbits, buf);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+static uint32_t check_doubles(uint32_t num) {
+    char buf[64];
+    uint32_t failures = 0;
+    for (uint32_t i = 0; i < num; ++i) {
+        double d = rnd_double();
+        jd_print_double(buf, d, 0);
+        bool ok = strtod(buf, NULL) == d;
+        if (ok && i % 10 == 0 && d != 0)
+            ok = num_digits(buf) == shortest_digits(d);
+        if (!ok) {
+            if (failures < 10)
+                fprintf(stderr, "failed: %.17g -> %s\n", d, buf);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+static double values[NUM_VALUES];
+
+static uint64_t run_print(int mode) {
+    char buf[64];
+    uint32_t sink = 0;
+    uint64_t t0 = bench_nanos();
+    for (int i = 0; i < NUM_VALUES; ++i) {
+        if (mode == 0)
+            jd_print_float(buf, (float)values[i], 0);
+        else if (mode == 1)
+            jd_print_double(buf, values[i], 0);
+        else
+            snprintf(buf, sizeof(buf), mode == 2 ? "%.9g" : "%.17g", values[i]);
+        sink += buf[0];
+    }
+    uint64_t r = bench_nanos() - t0;
+    if (sink == 1)
+        printf("\n");
+    return r;
+}
+
+// best of 20 runs, in ns per value
+static double time_ns(int mode) {
+    uint64_t best = UINT64_MAX;
+    for (int run = 0; run < 20; ++run) {
+        uint64_t t = run_print(mode);
+        if (t < best)
+            best = t;
+    }
+    return (double)best / NUM_VALUES;
+}
+
+int main(int argc, char **argv) {
+    unsigned step = 997, num_doubles = 1000000;
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[++i] : "";
+        if (strcmp(arg, "--step") == 0) {
+            step = atoi(val);
+        } else if (strcmp(arg, "--doubles") == 0) {
+            num_doubles = atoi(val);
+        } else {
+            fprintf(stderr, "unknown argument: %s\n", arg);
+            return 1;
+        }
+    }
+    if (step < 1) {
+        fprintf(stderr, "invalid step\n");
+        return 1;
+    }
+
+    bench_platform_init();
+
+    uint64_t t0 = bench_nanos();
+    uint32_t float_failures = check_floats(step);
+    double float_check_s = (bench_nanos() - t0) / 1e9;
+
+    uint32_t double_failures = check_doubles(num_doubles);
+
+    for (int i = 0; i < NUM_VALUES; ++i)
+        values[i] = rnd_float();
+    double float_ns = time_ns(0);
+    double float_printf_ns = time_ns(2);
+    for (int i = 0; i < NUM_VALUES; ++i)
+        values[i] = rnd_double();
+    double double_ns = time_ns(1);
+    double double_printf_ns = time_ns(3);
+
+    printf("{\n  \"float_step\": %u,\n  \"float_failures\": %u,\n"
+           "  \"float_check_s\": %.1f,\n  \"doubles\": %u,\n  \"double_failures\": %u,\n"
+           "  \"float_ns\": %.1f,\n  \"float_printf_ns\": %.1f,\n  \"double_ns\": %.1f,\n"
+           "  \"double_printf_ns\": %.1f\n}\n",
+           step, (unsigned)float_failures, float_check_s, num_doubles,
+           (unsigned)double_failures, float_ns, float_printf_ns, double_ns, double_printf_ns);
+
+    return float_failures || double_failures ? 2 : 0;
+}
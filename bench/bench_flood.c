@@ -0,0 +1,280 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+// Runs the flood ping benchmark (jd_flood_*() in client/flood.c) against devices
+// on a simulated bus.
+//
+// Usage: jacdac_flood [--devices N] [--count N] [--sizes 0,32,...] [--loss PERCENT]
+//                     [--turnaround US]
+//
+// The simulated bus runs at 1Mbaud in virtual time; frames are sent one at a time, and
+// each device needs --turnaround microseconds after receiving a ping, or after sending
+// a response, before it can send the next response (similar to process_flood() in jd_control.c).
+// --loss drops the given percentage of response frames.
+//
+// For every device and payload size, first a ping flood and then a stream flood is run.
+// Finally, a stream flood is run on all devices at once. Results are printed as JSON.
+
+#include "bench.h"
+#include "jd_client.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_VDEVS 32
+#define MAX_PENDING 128
+#define STEP_US 50
+#define MAX_FLOOD_US (60 * 1000 * 1000)
+
+typedef struct {
+    uint64_t device_identifier;
+    uint32_t flood_counter;
+    uint32_t flood_remaining;
+    uint8_t flood_size;
+    uint64_t next_tx;
+    uint64_t next_announce;
+} vdev_t;
+
+typedef struct {
+    uint64_t at;
+    jd_frame_t frame;
+} pending_t;
+
+static vdev_t vdevs[MAX_VDEVS];
+static int num_vdevs = 4;
+static pending_t pending[MAX_PENDING];
+static unsigned pending_head, pending_len;
+static uint64_t vt, bus_free_at;
+static uint32_t loss_percent;
+static uint32_t turnaround_us = 100;
+static uint32_t bus_overflows;
+
+// 10 bits per byte at 1Mbaud, plus break and inter-frame gap
+static uint32_t wire_us(jd_frame_t *frame) {
+    return JD_FRAME_SIZE(frame) * 10 + 70;
+}
+
+static uint64_t bus_transmit(jd_frame_t *frame, uint64_t earliest) {
+    uint64_t start = earliest > bus_free_at ? earliest : bus_free_at;
+    bus_free_at = start + wire_us(frame);
+    return bus_free_at;
+}
+
+static void deliver_at(jd_frame_t *frame, uint64_t at) {
+    if (pending_len >= MAX_PENDING) {
+        bus_overflows++;
+        return;
+    }
+    pending_t *p = &pending[(pending_head + pending_len++) % MAX_PENDING];
+    p->at = at;
+    memcpy(&p->frame, frame, JD_FRAME_SIZE(frame));
+}
+
+static void vdev_send(vdev_t *d, unsigned service_cmd, const void *data, unsigned size,
+                      bool lossy) {
+    jd_frame_t frame;
+    jd_reset_frame(&frame);
+    frame.flags = 0;
+    void *trg = jd_push_in_frame(&frame, JD_SERVICE_INDEX_CONTROL, service_cmd, size);
+    memcpy(trg, data, size);
+    frame.device_identifier = d->device_identifier;
+    jd_compute_crc(&frame);
+    uint64_t end = bus_transmit(&frame, vt);
+    d->next_tx = end + turnaround_us;
+    if (lossy && loss_percent && jd_random() % 100 < loss_percent)
+        return;
+    deliver_at(&frame, end);
+}
+
+static void vdev_process(vdev_t *d) {
+    if (vt >= d->next_announce) {
+        d->next_announce = vt + 500 * 1000;
+        uint32_t ann[2] = {JD_CONTROL_ANNOUNCE_FLAGS_SUPPORTS_ACK | 1, 0x1f140409};
+        vdev_send(d, JD_CONTROL_CMD_SERVICES, ann, sizeof(ann), false);
+    }
+
+    if (d->flood_remaining && vt >= d->next_tx && bus_free_at <= vt) {
+        uint8_t tmp[4 + JD_FLOOD_MAX_PAYLOAD];
+        memcpy(tmp, &d->flood_counter, 4);
+        for (unsigned i = 0; i < d->flood_size; ++i)
+            tmp[4 + i] = i;
+        d->flood_counter++;
+        d->flood_remaining--;
+        vdev_send(d, JD_CONTROL_CMD_FLOOD_PING, tmp, 4 + d->flood_size, true);
+    }
+}
+
+// frames sent by the stack under test
+static void on_tx(jd_frame_t *frame) {
+    uint64_t end = bus_transmit(frame, vt);
+
+    jd_frame_t copy;
+    memcpy(&copy, frame, JD_FRAME_SIZE(frame));
+    do {
+        jd_packet_t *pkt = (jd_packet_t *)&copy;
+        if (!(pkt->flags & JD_FRAME_FLAG_COMMAND) || pkt->service_index != 0 ||
+            pkt->service_command != JD_CONTROL_CMD_FLOOD_PING ||
+            pkt->service_size < sizeof(jd_control_flood_ping_t))
+            continue;
+        for (int i = 0; i < num_vdevs; ++i) {
+            vdev_t *d = &vdevs[i];
+            if (d->device_identifier != pkt->device_identifier)
+                continue;
+            jd_control_flood_ping_t *arg = (jd_control_flood_ping_t *)pkt->data;
+            d->flood_counter = arg->start_counter;
+            d->flood_size = arg->size;
+            d->flood_remaining = arg->num_responses;
+            d->next_tx = end + turnaround_us;
+        }
+    } while (jd_shift_frame(&copy));
+}
+
+static void step(void) {
+    vt += STEP_US;
+    bench_set_micros(vt);
+
+    // bus arbitration is essentially random
+    int first = jd_random() % num_vdevs;
+    for (int i = 0; i < num_vdevs; ++i)
+        vdev_process(&vdevs[(first + i) % num_vdevs]);
+
+    while (pending_len && pending[pending_head].at <= vt) {
+        jd_rx_frame_received(&pending[pending_head].frame);
+        pending_head = (pending_head + 1) % MAX_PENDING;
+        pending_len--;
+    }
+
+    jd_process_everything();
+}
+
+static int num_results;
+
+static void print_result(jd_flood_t *f, const char *mode, int devidx, int size) {
+    jd_flood_stats_t st;
+    jd_flood_get_stats(f, &st);
+    printf("%s\n    {\"mode\": \"%s\", \"device\": %d, \"payload_size\": %d, \"requested\": %u, "
+           "\"received\": %u, \"lost\": %u, \"duplicates\": %u, \"elapsed_us\": %u, "
+           "\"goodput_bps\": %u, \"first_response_us\": %u, \"rtt_min_us\": %u, "
+           "\"rtt_p50_us\": %u, \"rtt_p90_us\": %u, \"rtt_p99_us\": %u, \"rtt_max_us\": %u}",
+           num_results++ ? "," : "", mode, devidx, size, (unsigned)st.num_requested,
+           (unsigned)st.num_received, (unsigned)st.num_lost, (unsigned)st.num_duplicates,
+           (unsigned)st.elapsed_us, (unsigned)st.goodput, (unsigned)st.first_response_us,
+           (unsigned)st.rtt_min, (unsigned)st.rtt_p50, (unsigned)st.rtt_p90,
+           (unsigned)st.rtt_p99, (unsigned)st.rtt_max);
+    fflush(stdout);
+}
+
+static void wait_all(jd_flood_t **fl, int n) {
+    uint64_t end = vt + MAX_FLOOD_US;
+    for (;;) {
+        int done = 0;
+        for (int i = 0; i < n; ++i)
+            if (jd_flood_done(fl[i]))
+                done++;
+        if (done == n || vt > end)
+            break;
+        step();
+    }
+}
+
+static void run_flood(int mode, int devidx, int size, int count) {
+    jd_flood_cfg_t cfg = {.mode = mode, .payload_size = size, .count = count};
+    jd_flood_t *f = jd_flood_start(vdevs[devidx].device_identifier, &cfg);
+    if (!f) {
+        fprintf(stderr, "device %d not found\n", devidx);
+        exit(1);
+    }
+    wait_all(&f, 1);
+    print_result(f, mode == JD_FLOOD_MODE_PING ? "ping" : "stream", devidx, size);
+    jd_flood_free(f);
+    // let the bus settle
+    for (int i = 0; i < 100; ++i)
+        step();
+}
+
+int main(int argc, char **argv) {
+    int count = 200;
+    int sizes[16] = {0, 32, 64, 128, JD_FLOOD_MAX_PAYLOAD};
+    int num_sizes = 5;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[++i] : "";
+        if (strcmp(arg, "--devices") == 0) {
+            num_vdevs = atoi(val);
+        } else if (strcmp(arg, "--count") == 0) {
+            count = atoi(val);
+        } else if (strcmp(arg, "--loss") == 0) {
+            loss_percent = atoi(val);
+        } else if (strcmp(arg, "--turnaround") == 0) {
+            turnaround_us = atoi(val);
+        } else if (strcmp(arg, "--sizes") == 0) {
+            num_sizes = 0;
+            for (const char *p = val; *p && num_sizes < 16;) {
+                int sz = atoi(p);
+                sizes[num_sizes++] = sz > JD_FLOOD_MAX_PAYLOAD ? JD_FLOOD_MAX_PAYLOAD : sz;
+                p = strchr(p, ',');
+                if (!p)
+                    break;
+                p++;
+            }
+        } else {
+            fprintf(stderr, "unknown argument: %s\n", arg);
+            return 1;
+        }
+    }
+
+    if (num_vdevs < 1 || num_vdevs > MAX_VDEVS || count < 1 || count > 0xffff) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    vt = 1000000;
+    bench_set_micros(vt);
+    bench_platform_init();
+    bench_drain_rx = false;
+    bench_tx_hook = on_tx;
+    jd_seed_random(42);
+    jd_services_init();
+
+    for (int i = 0; i < num_vdevs; ++i) {
+        vdevs[i].device_identifier = 0x4200000000000000ULL + i * 0x1111111111ULL;
+        vdevs[i].next_announce = vt + i * 1000;
+    }
+
+    // wait for everyone to announce
+    while (vt < 2000000)
+        step();
+
+    printf("{\n  \"devices\": %d,\n  \"count\": %d,\n  \"loss_percent\": %u,\n"
+           "  \"turnaround_us\": %u,\n  \"results\": [",
+           num_vdevs, count, (unsigned)loss_percent, (unsigned)turnaround_us);
+
+    for (int d = 0; d < num_vdevs; ++d) {
+        for (int s = 0; s < num_sizes; ++s) {
+            run_flood(JD_FLOOD_MODE_PING, d, sizes[s], count);
+            run_flood(JD_FLOOD_MODE_STREAM, d, sizes[s], count);
+        }
+    }
+
+    // all at once
+    for (int s = 0; s < num_sizes; ++s) {
+        jd_flood_t *fl[MAX_VDEVS];
+        jd_flood_cfg_t cfg = {
+            .mode = JD_FLOOD_MODE_STREAM, .payload_size = sizes[s], .count = count};
+        for (int d = 0; d < num_vdevs; ++d)
+            fl[d] = jd_flood_start(vdevs[d].device_identifier, &cfg);
+        wait_all(fl, num_vdevs);
+        for (int d = 0; d < num_vdevs; ++d) {
+            print_result(fl[d], "stream_all", d, sizes[s]);
+            jd_flood_free(fl[d]);
+        }
+        for (int i = 0; i < 100; ++i)
+            step();
+    }
+
+    printf("\n  ],\n  \"bus_overflows\": %u\n}\n", (unsigned)bus_overflows);
+
+    return 0;
+}
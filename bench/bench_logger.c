@@ -0,0 +1,339 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+// Checks and measures the logger service (services/logger.c).
+//
+// Usage: jacdac_logger
+//
+// Lines are logged with jdcon_log()/jdcon_warn(), the service runs in virtual time,
+// and the packets it sends are checked:
+// - coalescing: lines of the same priority go in one packet, separated by '\n',
+//   and a change of priority starts a new packet, keeping the order of lines
+// - budget: at most JD_LOGGER_BYTES_PER_SECOND bytes of text are sent per second,
+//   and the budget is used when lines are waiting
+// - suppression: lines that don't fit in the queue are counted, and "N lines suppressed"
+//   is sent in their place, before lines logged later; N saturates at 65535
+// - pipe (JD_LOGGER_PIPE): after JD_LOGGER_CMD_STREAM, lines go to the pipe, and when
+//   the client stops acknowledging, they are broadcast again
+// Also reported is the time of jdcon_log() when the line fits in the queue.
+// Results are printed as JSON. The exit code is 1 if any check failed.
+
+#include "bench.h"
+#include "jd_client.h"
+#include "jd_pipes.h"
+#include "jd_services.h"
+#include "jd_console.h"
+#include "jacdac/dist/c/logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STEP_US 10000
+#define MAX_LINES 4096
+#define LINE_MAX 128
+#define CLIENT_ID 0x4200000000000002ULL
+#define PORT_NUM 7
+
+typedef struct {
+    uint8_t pri;
+    bool pipe;
+    uint16_t packet;
+    char text[LINE_MAX];
+} line_t;
+
+static line_t lines[MAX_LINES];
+static unsigned num_lines, num_packets;
+static uint32_t text_bytes;
+static uint8_t logger_idx;
+
+static uint64_t vt;
+static bool client_acks;
+static uint16_t pipe_counter;
+static jd_frame_t ack_frame;
+static bool ack_pending;
+
+uint8_t _jd_services_curr_idx(void);
+
+void app_init_services(void) {
+    // the client routing code requires role manager
+    jd_role_manager_init();
+    logger_idx = _jd_services_curr_idx();
+    jdcon_init();
+}
+
+static void add_lines(const uint8_t *data, unsigned len, unsigned pri, bool pipe) {
+    num_packets++;
+    text_bytes += len;
+    const char *p = (const char *)data, *end = p + len;
+    for (;;) {
+        const char *nl = memchr(p, '\n', end - p);
+        unsigned n = (nl ? nl : end) - p;
+        if (num_lines < MAX_LINES) {
+            line_t *l = &lines[num_lines++];
+            l->pri = pri;
+            l->pipe = pipe;
+            l->packet = num_packets;
+            if (n >= LINE_MAX)
+                n = LINE_MAX - 1;
+            memcpy(l->text, p, n);
+            l->text[n] = 0;
+        }
+        if (!nl)
+            break;
+        p = nl + 1;
+    }
+}
+
+static void on_tx(jd_frame_t *frame) {
+    jd_frame_t copy;
+    memcpy(&copy, frame, JD_FRAME_SIZE(frame));
+    bool to_client = frame->device_identifier == CLIENT_ID &&
+                     (frame->flags & JD_FRAME_FLAG_COMMAND);
+    if (to_client && client_acks && (frame->flags & JD_FRAME_FLAG_ACK_REQUESTED)) {
+        jd_reset_frame(&ack_frame);
+        ack_frame.flags = 0;
+        jd_push_in_frame(&ack_frame, JD_SERVICE_INDEX_CRC_ACK, frame->crc, 0);
+        ack_frame.device_identifier = CLIENT_ID;
+        jd_compute_crc(&ack_frame);
+        ack_pending = true;
+    }
+    do {
+        jd_packet_t *pkt = (jd_packet_t *)&copy;
+        unsigned cmd = pkt->service_command;
+        if (to_client) {
+            if (!client_acks || pkt->service_index != JD_SERVICE_INDEX_STREAM ||
+                (cmd >> JD_PIPE_PORT_SHIFT) != PORT_NUM || pkt->service_size < 1)
+                continue;
+            // re-sent packets
+            if ((cmd & JD_PIPE_COUNTER_MASK) != pipe_counter)
+                continue;
+            pipe_counter = (pipe_counter + 1) & JD_PIPE_COUNTER_MASK;
+            if (!(cmd & JD_PIPE_METADATA_MASK))
+                add_lines(pkt->data + 1, pkt->service_size - 1, pkt->data[0], true);
+        } else if (frame->device_identifier == jd_device_id() &&
+                   !(frame->flags & JD_FRAME_FLAG_COMMAND) &&
+                   pkt->service_index == logger_idx && cmd >= JD_LOGGER_CMD_DEBUG &&
+                   cmd <= JD_LOGGER_CMD_ERROR) {
+            add_lines(pkt->data, pkt->service_size, cmd - JD_LOGGER_CMD_DEBUG, false);
+        }
+    } while (jd_shift_frame(&copy));
+}
+
+// sends a command to the logger service
+static void send_cmd(unsigned cmd, const void *data, unsigned size) {
+    jd_frame_t frame;
+    jd_reset_frame(&frame);
+    frame.flags = JD_FRAME_FLAG_COMMAND;
+    memcpy(jd_push_in_frame(&frame, logger_idx, cmd, size), data, size);
+    frame.device_identifier = jd_device_id();
+    jd_compute_crc(&frame);
+    jd_rx_frame_received(&frame);
+}
+
+static void step(uint32_t us) {
+    vt += us;
+    bench_set_micros(vt);
+    if (ack_pending) {
+        ack_pending = false;
+        jd_rx_frame_received(&ack_frame);
+    }
+    jd_process_everything();
+}
+
+static void run_for(uint32_t us) {
+    for (uint32_t t = 0; t < us; t += STEP_US)
+        step(STEP_US);
+}
+
+static void clear_lines(void) {
+    num_lines = 0;
+    num_packets = 0;
+    text_bytes = 0;
+}
+
+// waits until everything is sent, and the budget is full again
+static void settle(void) {
+    run_for(2000000);
+    clear_lines();
+}
+
+static int num_failed;
+
+static bool check(bool ok, const char *name, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "%s: %s\n", name, what);
+        for (unsigned i = 0; i < num_lines && i < 16; ++i)
+            fprintf(stderr, "  #%u pri=%u%s %s\n", lines[i].packet, lines[i].pri,
+                    lines[i].pipe ? " pipe" : "", lines[i].text);
+        num_failed++;
+    }
+    return ok;
+}
+
+static bool is_line(unsigned i, unsigned pri, const char *text) {
+    return i < num_lines && lines[i].pri == pri && strcmp(lines[i].text, text) == 0;
+}
+
+static bool check_coalescing(void) {
+    const char *name = "coalescing";
+    settle();
+    jdcon_log("a1");
+    jdcon_log("a2\n");
+    jdcon_log("a3");
+    jdcon_warn("w1");
+    jdcon_log("a4");
+    step(STEP_US);
+    return check(num_lines == 5, name, "expecting 5 lines") &&
+           check(is_line(0, JD_LOGGER_PRIORITY_LOG, "a1") &&
+                     is_line(1, JD_LOGGER_PRIORITY_LOG, "a2") &&
+                     is_line(2, JD_LOGGER_PRIORITY_LOG, "a3") &&
+                     is_line(3, JD_LOGGER_PRIORITY_WARNING, "w1") &&
+                     is_line(4, JD_LOGGER_PRIORITY_LOG, "a4"),
+                 name, "wrong lines") &&
+           check(num_packets == 3 && lines[2].packet == lines[0].packet, name,
+                 "expecting a1-a3, w1, a4 in 3 packets");
+}
+
+static bool check_budget(void) {
+    const char *name = "budget";
+    const unsigned secs = 5;
+    settle();
+    // 60 bytes every 10ms is 6kB/s, way over the budget
+    for (unsigned i = 0; i < secs * 100; ++i) {
+        jdcon_log("%d ..........................................................", 100 + i % 900);
+        step(STEP_US);
+    }
+    // up to a full budget at start, and then the rate
+    uint32_t max = JD_LOGGER_BYTES_PER_SECOND * (secs + 1);
+    uint32_t min = JD_LOGGER_BYTES_PER_SECOND * (secs - 1);
+    printf("  \"budget_bytes\": %u,\n  \"budget_secs\": %u,\n", (unsigned)text_bytes, secs);
+    return check(text_bytes <= max, name, "too many bytes sent") &&
+           check(text_bytes >= min, name, "budget not used");
+}
+
+// logs more lines than fit in the queue, without running the service
+static void fill_queue(unsigned num) {
+    for (unsigned i = 0; i < num; ++i)
+        jdcon_log("fill %d ............................", 10 + i);
+}
+
+static unsigned num_fill_lines(void) {
+    unsigned n = 0;
+    for (unsigned i = 0; i < num_lines; ++i)
+        if (strncmp(lines[i].text, "fill ", 5) == 0)
+            n++;
+    return n;
+}
+
+static bool check_suppression(void) {
+    const char *name = "suppression";
+    settle();
+    unsigned num = 20;
+    fill_queue(num);
+    step(STEP_US);
+    jdcon_log("after");
+    run_for(100000);
+    unsigned fit = num_fill_lines();
+    char marker[32];
+    snprintf(marker, sizeof(marker), "%u lines suppressed", num - fit);
+    return check(fit > 0 && fit < num, name, "queue should fill up") &&
+           check(num_lines == fit + 2, name, "expecting lines that fit, marker, 'after'") &&
+           check(is_line(fit, JD_LOGGER_PRIORITY_WARNING, marker), name, "wrong marker") &&
+           check(is_line(fit + 1, JD_LOGGER_PRIORITY_LOG, "after"), name,
+                 "'after' should follow the marker");
+}
+
+static bool check_saturation(void) {
+    const char *name = "saturation";
+    settle();
+    fill_queue(70000);
+    run_for(100000);
+    bool found = false;
+    for (unsigned i = 0; i < num_lines; ++i)
+        if (lines[i].pri == JD_LOGGER_PRIORITY_WARNING &&
+            strstr(lines[i].text, " lines suppressed"))
+            found = strcmp(lines[i].text, "65535 lines suppressed") == 0;
+    return check(found, name, "expecting '65535 lines suppressed'");
+}
+
+static bool check_pipe(void) {
+#if JD_LOGGER_PIPE
+    const char *name = "pipe";
+    settle();
+    jd_pipe_cmd_t cmd = {.device_identifier = CLIENT_ID, .port_num = PORT_NUM};
+    client_acks = true;
+    pipe_counter = 0;
+    send_cmd(JD_LOGGER_CMD_STREAM, &cmd, sizeof(cmd));
+    step(STEP_US);
+    jdcon_log("p1");
+    jdcon_warn("p2");
+    run_for(100000);
+    bool piped = check(num_lines == 2, name, "expecting 2 lines") &&
+                 check(is_line(0, JD_LOGGER_PRIORITY_LOG, "p1") && lines[0].pipe &&
+                           is_line(1, JD_LOGGER_PRIORITY_WARNING, "p2") && lines[1].pipe,
+                       name, "lines should go to the pipe");
+    // the client is gone; the line in flight is lost, and then it's back to broadcast
+    client_acks = false;
+    clear_lines();
+    jdcon_log("lost");
+    run_for(5000000);
+    jdcon_log("b1");
+    run_for(100000);
+    return piped && check(num_lines == 1 && is_line(0, JD_LOGGER_PRIORITY_LOG, "b1") &&
+                              !lines[0].pipe,
+                          name, "expecting 'b1' broadcast");
+#else
+    return true;
+#endif
+}
+
+static double log_ns(void) {
+    settle();
+    uint64_t total = 0;
+    unsigned num = 0;
+    for (unsigned round = 0; round < 1000; ++round) {
+        // these fit in the queue
+        uint64_t t0 = bench_nanos();
+        for (unsigned i = 0; i < 8; ++i)
+            jdcon_log("temp %d", (int)(round + i));
+        total += bench_nanos() - t0;
+        num += 8;
+        run_for(1000000);
+    }
+    return (double)total / num;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        fprintf(stderr, "unknown argument: %s\n", argv[1]);
+        return 1;
+    }
+
+    vt = 1000000;
+    bench_set_micros(vt);
+    bench_platform_init();
+    bench_drain_rx = false;
+    bench_tx_hook = on_tx;
+    jd_services_init();
+
+    uint8_t min_pri = JD_LOGGER_PRIORITY_DEBUG;
+    send_cmd(JD_SET(JD_LOGGER_REG_MIN_PRIORITY), &min_pri, 1);
+    step(STEP_US);
+
+    printf("{\n  \"buffer_size\": %d,\n  \"bytes_per_second\": %d,\n", JD_LOGGER_BUFFER_SIZE,
+           JD_LOGGER_BYTES_PER_SECOND);
+    bool coalescing = check_coalescing();
+    bool budget = check_budget();
+    bool suppression = check_suppression();
+    bool saturation = check_saturation();
+    bool pipe = check_pipe();
+    printf("  \"coalescing\": %s,\n  \"budget\": %s,\n  \"suppression\": %s,\n"
+           "  \"saturation\": %s,\n  \"pipe\": %s,\n",
+           coalescing ? "true" : "false", budget ? "true" : "false",
+           suppression ? "true" : "false", saturation ? "true" : "false",
+           pipe ? "true" : "false");
+    printf("  \"log_ns\": %.1f\n}\n", log_ns());
+
+    return num_failed ? 1 : 0;
+}
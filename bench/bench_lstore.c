@@ -0,0 +1,330 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+// Logs frames into lstore at a fixed rate, on top of a RAM disk with SD-card-like latency.
+//
+// Usage: jacdac_lstore [--seconds N] [--interval US] [--size BYTES]
+//                      [--spike-every N] [--spike-ms MS]
+//
+// Runs in virtual time. A main loop calls jd_lstore_process() every 100us, and frames of
+// 'size' bytes (default 32) are appended every 'interval' us (default 300, about a busy bus),
+// also while a disk write is in progress, as frames come from an IRQ.
+// A disk write takes 300us + 60us per sector, and every 'spike-every'-th write
+// (default 100) takes 'spike-ms' (default 40) more, like an SD card doing housekeeping.
+//
+// At the end, the log is read back from the disk, and every block is checked for CRC,
+// for consecutive frame numbers, and for gaps matching the drop counter in its header.
+// Then it's read again with jd_lstore_reader_*(): all frames, and the ones from the last
+// 5 seconds, found with jd_lstore_reader_seek().
+// Reported are appended and dropped frames, the longest jd_lstore_process() call (in virtual
+// time) and the CPU time spent in it, entries per block,
+// block reads needed by the reader, and the number of check failures.
+// Results are printed as JSON.
+//
+// jacdac_lstore uses the default JD_LSTORE_BUFFERS=2, jacdac_lstore_deep uses 8 buffers
+// and JD_LSTORE_FLUSH_SECTORS=2, and jacdac_lstore_lz uses JD_LSTORE_COMPRESS=4.
+
+#include "bench.h"
+#include "storage/jd_storage.h"
+#include "storage/ff/ff.h"
+#include "storage/ff/diskio.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SECTOR_SIZE 512
+#define LOOP_US 100
+
+static uint8_t *disk;
+static uint32_t disk_sectors;
+
+static uint64_t vnow;
+static uint64_t next_frame = UINT64_MAX;
+static uint32_t frame_interval = 300, frame_size = 32;
+static uint32_t frame_seq, frames_dropped;
+
+static uint32_t spike_every = 100, spike_us = 40000;
+static uint32_t num_writes, num_spikes;
+
+int jd_f_create(const char *name, uint32_t *size, uint32_t *sector_off) {
+    uint32_t n = (*size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    disk = realloc(disk, (size_t)(disk_sectors + n) * SECTOR_SIZE);
+    memset(disk + (size_t)disk_sectors * SECTOR_SIZE, 0, (size_t)n * SECTOR_SIZE);
+    *sector_off = disk_sectors;
+    *size = n * SECTOR_SIZE;
+    disk_sectors += n;
+    return 0;
+}
+
+DRESULT ff_disk_read(BYTE pdrv, BYTE *buff, LBA_t sector, UINT count) {
+    JD_ASSERT(sector + count <= disk_sectors);
+    memcpy(buff, disk + (size_t)sector * SECTOR_SIZE, (size_t)count * SECTOR_SIZE);
+    return RES_OK;
+}
+
+static uint32_t rnd_state = 0x12345678;
+
+static uint32_t rnd(void) {
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+// Looks like a frame with a sensor reading from one of 6 devices, except that the CRC and
+// sizes are replaced by the sequence number.
+static void make_frame(uint8_t *buf, uint32_t seq) {
+    static const char *names[] = {"temperature", "humidity", "acceleration"};
+    unsigned dev = rnd() % 6;
+    memset(buf, 0, frame_size);
+    memcpy(buf, &seq, 4);
+    uint64_t device_id = 0x3b8c6a5e00000000ULL + dev * 0x1f2f3f4fULL;
+    uint8_t pkt[] = {8, 1 + dev % 3, 0x01, 0x01};
+    uint32_t reading = 21000 + dev * 1000 + (seq >> 8) % 64 + rnd() % 4;
+    if (frame_size >= 24) {
+        memcpy(buf + 4, &device_id, 8);
+        memcpy(buf + 12, pkt, 4);
+        memcpy(buf + 16, &reading, 4);
+        const char *name = names[dev % 3];
+        unsigned n = strlen(name);
+        if (n > frame_size - 20)
+            n = frame_size - 20;
+        memcpy(buf + 20, name, n);
+    }
+}
+
+// appends the frames due by 'until', with the clock set to their arrival time
+static void deliver_frames(uint64_t until) {
+    uint8_t buf[255];
+    while (next_frame <= until) {
+        bench_set_micros(next_frame);
+        jd_refresh_now();
+        make_frame(buf, frame_seq);
+        if (jd_lstore_append(0, JD_LSTORE_TYPE_JD_FRAME, buf, frame_size) != 0)
+            frames_dropped++;
+        frame_seq++;
+        next_frame += frame_interval;
+    }
+    bench_set_micros(until);
+    jd_refresh_now();
+}
+
+DRESULT ff_disk_write(BYTE pdrv, const BYTE *buff, LBA_t sector, UINT count) {
+    JD_ASSERT(sector + count <= disk_sectors);
+    memcpy(disk + (size_t)sector * SECTOR_SIZE, buff, (size_t)count * SECTOR_SIZE);
+    uint32_t busy = 300 + 60 * count;
+    num_writes++;
+    if (spike_every && num_writes % spike_every == 0) {
+        busy += spike_us;
+        num_spikes++;
+    }
+    // the frames keep coming in while we wait for the card
+    vnow += busy;
+    deliver_frames(vnow);
+    return RES_OK;
+}
+
+typedef struct {
+    uint32_t first, last;
+    uint32_t num_dropped;
+} block_info_t;
+
+static int cmp_blocks(const void *a, const void *b) {
+    uint32_t x = ((const block_info_t *)a)->first, y = ((const block_info_t *)b)->first;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+// checks log 0 on the disk; returns the number of failures
+static uint32_t check_log(uint32_t *num_blocks, uint32_t *num_entries, uint32_t *num_rewrites) {
+    const jd_lstore_main_header_t *hd = (void *)disk;
+    uint32_t failures = 0;
+    if (hd->magic0 != JD_LSTORE_MAGIC0 || hd->version != JD_LSTORE_VERSION)
+        return 1;
+    *num_rewrites = hd->num_rewrites;
+    uint32_t bsize = hd->sectors_per_block * SECTOR_SIZE;
+    uint32_t dsize = bsize - JD_LSTORE_BLOCK_OVERHEAD;
+    block_info_t *blocks = calloc(hd->num_blocks, sizeof(block_info_t));
+    uint8_t *unpacked = malloc(hd->max_data_size);
+    uint32_t nblocks = 0, nentries = 0;
+
+    for (uint32_t i = hd->header_blocks; i < hd->num_blocks; ++i) {
+        const uint8_t *p = disk + (size_t)i * bsize;
+        const jd_lstore_block_header_t *bh = (const void *)p;
+        const jd_lstore_block_footer_t *bf = (const void *)(p + bsize - sizeof(*bf));
+        if (bh->block_magic0 != hd->block_magic0)
+            continue;
+        if (bf->block_magic1 != hd->block_magic1 || jd_crc32(p, bsize - 4) != bf->crc32) {
+            failures++;
+            continue;
+        }
+        const uint8_t *data = bh->data;
+        uint32_t size = dsize;
+        if (bh->flags & JD_LSTORE_BLOCK_COMPRESSED) {
+            if (bh->data_size > hd->max_data_size ||
+                jd_lz4_decompress(bh->data, dsize, unpacked, bh->data_size) != bh->data_size) {
+                failures++;
+                continue;
+            }
+            data = unpacked;
+            size = bh->data_size;
+        }
+        block_info_t *bi = &blocks[nblocks];
+        bool any = false;
+        for (uint32_t off = 0; off + JD_LSTORE_ENTRY_HEADER_SIZE <= size;) {
+            const jd_lstore_entry_t *ent = (const void *)(data + off);
+            if (ent->type == 0)
+                break;
+            off += JD_LSTORE_ENTRY_HEADER_SIZE + ent->size;
+            if (ent->type != JD_LSTORE_TYPE_JD_FRAME)
+                continue;
+            uint32_t seq;
+            memcpy(&seq, ent->data, 4);
+            if (ent->size != frame_size || (any && seq != bi->last + 1))
+                failures++;
+            if (!any)
+                bi->first = seq;
+            bi->last = seq;
+            any = true;
+            nentries++;
+        }
+        if (any) {
+            bi->num_dropped = bh->num_dropped;
+            nblocks++;
+        }
+    }
+
+    qsort(blocks, nblocks, sizeof(block_info_t), cmp_blocks);
+    for (uint32_t i = 1; i < nblocks; ++i)
+        if (blocks[i].first - blocks[i - 1].last - 1 != blocks[i].num_dropped)
+            failures++;
+    // unless the log wrapped around, all frames are there
+    if (*num_rewrites == 0 && nentries + frames_dropped != frame_seq)
+        failures++;
+
+    free(blocks);
+    free(unpacked);
+    *num_blocks = nblocks;
+    *num_entries = nentries;
+    return failures;
+}
+
+// reads the log back with jd_lstore_reader_*(); returns the number of failures
+static uint32_t check_reader(uint32_t num_entries, uint32_t *open_reads, uint32_t *seek_reads,
+                             uint32_t *num_recent) {
+    jd_lstore_reader_t r;
+    if (jd_lstore_open_reader(&r, 0) != 0)
+        return 1;
+    *open_reads = r.num_block_reads;
+
+    uint32_t failures = 0;
+    uint64_t target = r.newest_timestamp > 5000 ? r.newest_timestamp - 5000 : 0;
+    uint32_t n = 0, n_recent = 0, seq, prev_seq = 0;
+    uint64_t ts, prev_ts = 0;
+    jd_lstore_entry_t *ent;
+
+    // all frames, in order
+    while ((ent = jd_lstore_reader_next(&r, JD_LSTORE_TYPE_JD_FRAME, &ts)) != NULL) {
+        memcpy(&seq, ent->data, 4);
+        if (n && (seq <= prev_seq || ts < prev_ts))
+            failures++;
+        if (ts >= target)
+            n_recent++;
+        prev_seq = seq;
+        prev_ts = ts;
+        n++;
+    }
+    if (n != num_entries)
+        failures++;
+
+    // the last 5 seconds
+    r.num_block_reads = 0;
+    jd_lstore_reader_seek(&r, r.newest_generation, target);
+    *seek_reads = r.num_block_reads;
+    n = 0;
+    while ((ent = jd_lstore_reader_next(&r, JD_LSTORE_TYPE_JD_FRAME, &ts)) != NULL) {
+        if (ts < target)
+            failures++;
+        n++;
+    }
+    if (n != n_recent)
+        failures++;
+    *num_recent = n;
+
+    jd_lstore_reader_close(&r);
+    return failures;
+}
+
+int main(int argc, char **argv) {
+    unsigned seconds = 10, spike_ms = 40;
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[++i] : "";
+        if (strcmp(arg, "--seconds") == 0) {
+            seconds = atoi(val);
+        } else if (strcmp(arg, "--interval") == 0) {
+            frame_interval = atoi(val);
+        } else if (strcmp(arg, "--size") == 0) {
+            frame_size = atoi(val);
+        } else if (strcmp(arg, "--spike-every") == 0) {
+            spike_every = atoi(val);
+        } else if (strcmp(arg, "--spike-ms") == 0) {
+            spike_ms = atoi(val);
+        } else {
+            fprintf(stderr, "unknown argument: %s\n", arg);
+            return 1;
+        }
+    }
+    if (frame_interval < 1 || frame_size < 4 || frame_size > 255) {
+        fprintf(stderr, "invalid frame interval or size\n");
+        return 1;
+    }
+    spike_us = spike_ms * 1000;
+
+    bench_platform_init();
+    vnow = 1000000;
+    bench_set_micros(vnow);
+    jd_refresh_now();
+    jd_lstore_init();
+    // formatting the disk doesn't count, and no frames come in before
+    num_writes = num_spikes = 0;
+    next_frame = vnow;
+
+    uint64_t end = vnow + (uint64_t)seconds * 1000000;
+    uint32_t max_stall = 0;
+    uint64_t process_ns = 0;
+    while (vnow < end) {
+        vnow += LOOP_US;
+        deliver_frames(vnow);
+        uint64_t t0 = vnow;
+        uint64_t ns0 = bench_nanos();
+        jd_lstore_process();
+        process_ns += bench_nanos() - ns0;
+        if (vnow - t0 > max_stall)
+            max_stall = vnow - t0;
+    }
+    // new frames are not counted after this
+    next_frame = UINT64_MAX;
+    jd_lstore_force_flush();
+
+    uint32_t num_blocks = 0, num_entries = 0, num_rewrites = 0;
+    uint32_t failures = check_log(&num_blocks, &num_entries, &num_rewrites);
+    uint32_t open_reads = 0, seek_reads = 0, num_recent = 0;
+    failures += check_reader(num_entries, &open_reads, &seek_reads, &num_recent);
+
+    printf("{\n  \"buffers\": %u,\n  \"flush_sectors\": %u,\n  \"frames\": %u,\n"
+           "  \"dropped\": %u,\n  \"dropped_pct\": %.2f,\n  \"disk_writes\": %u,\n"
+           "  \"spikes\": %u,\n  \"max_process_us\": %u,\n  \"process_ns_per_frame\": %.0f,\n"
+           "  \"blocks\": %u,\n  \"entries\": %u,\n  \"entries_per_block\": %.1f,\n"
+           "  \"rewrites\": %u,\n  \"reader_open_reads\": %u,\n"
+           "  \"seek_5s_reads\": %u,\n  \"entries_5s\": %u,\n  \"check_failures\": %u\n}\n",
+           JD_LSTORE_BUFFERS, JD_LSTORE_FLUSH_SECTORS, (unsigned)frame_seq,
+           (unsigned)frames_dropped, frame_seq ? 100.0 * frames_dropped / frame_seq : 0.0,
+           (unsigned)num_writes, (unsigned)num_spikes, (unsigned)max_stall,
+           frame_seq ? (double)process_ns / frame_seq : 0.0, (unsigned)num_blocks,
+           (unsigned)num_entries, num_blocks ? (double)num_entries / num_blocks : 0.0,
+           (unsigned)num_rewrites, (unsigned)open_reads,
+           (unsigned)seek_reads, (unsigned)num_recent, (unsigned)failures);
+
+    return failures ? 2 : 0;
+}
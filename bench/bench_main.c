@@ -0,0 +1,469 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+// Micro-benchmarks for the hot paths of the stack: queues, CRCs, frame packing,
+// register handling, number formatting, printf, DCFG lookups, and client device lookups.
+//
+// Usage: jacdac_bench [--csv] [filter]
+// Results are printed as JSON (default) or CSV, one entry per benchmark, in ns/op.
+
+#include "bench.h"
+#include "jd_client.h"
+#include "jd_dcfg.h"
+#include "jd_numfmt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_RUN_NS (50 * 1000 * 1000)
+#define NUM_RUNS 5
+
+volatile uint32_t bench_sink;
+
+static bool csv_output;
+static const char *name_filter;
+static int num_results;
+
+void bench_run(const char *name, bench_fn_t fn, void *ctx) {
+    if (name_filter && !strstr(name, name_filter))
+        return;
+
+    uint32_t iters = 1;
+    uint64_t elapsed;
+    // calibrate
+    for (;;) {
+        uint64_t t0 = bench_nanos();
+        fn(ctx, iters);
+        elapsed = bench_nanos() - t0;
+        if (elapsed >= MIN_RUN_NS / 10 || iters >= 0x40000000)
+            break;
+        iters *= 2;
+    }
+    if (elapsed < MIN_RUN_NS)
+        iters = (uint32_t)((uint64_t)iters * MIN_RUN_NS / (elapsed ? elapsed : 1));
+    if (iters == 0)
+        iters = 1;
+
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < NUM_RUNS; ++i) {
+        uint64_t t0 = bench_nanos();
+        fn(ctx, iters);
+        elapsed = bench_nanos() - t0;
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    double ns_per_op = (double)best / iters;
+    if (csv_output) {
+        printf("%s,%u,%.3f\n", name, (unsigned)iters, ns_per_op);
+    } else {
+        printf("%s\n    {\"name\": \"%s\", \"iters\": %u, \"ns_per_op\": %.3f}",
+               num_results ? "," : "", name, (unsigned)iters, ns_per_op);
+    }
+    fflush(stdout);
+    num_results++;
+}
+
+/*
+ * Queues
+ */
+
+static void bench_queue(void *ctx, uint32_t iters) {
+    jd_queue_t q = ctx;
+    jd_frame_t frame = {0};
+    frame.size = 12; // single packet with 8 bytes of payload
+    for (uint32_t i = 0; i < iters; ++i) {
+        frame.crc = i;
+        jd_queue_push(q, &frame);
+        jd_queue_push(q, &frame);
+        bench_sink += jd_queue_front(q)->crc;
+        jd_queue_shift(q);
+        jd_queue_shift(q);
+    }
+}
+
+static void bench_bqueue(void *ctx, uint32_t iters) {
+    jd_bqueue_t q = ctx;
+    uint8_t buf[40] = {0};
+    for (uint32_t i = 0; i < iters; ++i) {
+        buf[0] = i;
+        jd_bqueue_push(q, buf, 37);
+        bench_sink += jd_bqueue_pop_atomic(q, buf, 37);
+    }
+}
+
+/*
+ * CRC
+ */
+
+static uint8_t crc_data[4096];
+
+static void bench_crc16(void *ctx, uint32_t iters) {
+    uint32_t size = (uintptr_t)ctx;
+    for (uint32_t i = 0; i < iters; ++i)
+        bench_sink += jd_crc16(crc_data, size);
+}
+
+static void bench_crc32(void *ctx, uint32_t iters) {
+    uint32_t size = (uintptr_t)ctx;
+    for (uint32_t i = 0; i < iters; ++i)
+        bench_sink += jd_crc32(crc_data, size);
+}
+
+/*
+ * Frame packing
+ */
+
+// 6 packets of 4 bytes, and then 4 packets of 12 bytes
+static void bench_frame_pack(void *ctx, uint32_t iters) {
+    jd_frame_t frame;
+    for (uint32_t i = 0; i < iters; ++i) {
+        jd_reset_frame(&frame);
+        for (int j = 0; j < 10; ++j) {
+            void *p = jd_push_in_frame(&frame, j, 0x1000 + j, j < 6 ? 4 : 12);
+            if (p)
+                memset(p, j, j < 6 ? 4 : 12);
+        }
+        bench_sink += frame.size;
+    }
+}
+
+static void bench_frame_unpack(void *ctx, uint32_t iters) {
+    jd_frame_t frame, tmp;
+    jd_reset_frame(&frame);
+    for (int j = 0; j < 10; ++j)
+        jd_push_in_frame(&frame, j, 0x1000 + j, j < 6 ? 4 : 12);
+    for (uint32_t i = 0; i < iters; ++i) {
+        memcpy(&tmp, &frame, JD_FRAME_SIZE(&frame));
+        do {
+            bench_sink += ((jd_packet_t *)&tmp)->service_command;
+        } while (jd_shift_frame(&tmp));
+    }
+}
+
+/*
+ * Register handling; the layout is similar to services/servo.c
+ */
+
+struct srv_state {
+    SRV_COMMON;
+    int32_t value;
+    uint8_t intensity;
+    uint8_t variant;
+    uint16_t padding;
+    int32_t min_value;
+    int32_t max_value;
+    uint16_t reading_error;
+    uint16_t error;
+    uint32_t streaming_interval;
+};
+
+REG_DEFINITION(                         //
+    bench_regs,                         //
+    REG_SRV_COMMON,                     //
+    REG_I32(JD_REG_VALUE),              //
+    REG_U8(JD_REG_INTENSITY),           //
+    REG_U8(JD_REG_VARIANT),             //
+    REG_U16(JD_REG_PADDING),            //
+    REG_I32(JD_REG_MIN_VALUE),          //
+    REG_I32(JD_REG_MAX_VALUE),          //
+    REG_U16(JD_REG_READING_ERROR),      //
+    REG_U16(JD_REG_PADDING),            //
+    REG_U32(JD_REG_STREAMING_INTERVAL), //
+)
+
+static void bench_reg_get(void *ctx, uint32_t iters) {
+    srv_t *state = ctx;
+    jd_frame_t frame = {0};
+    jd_packet_t *pkt = (jd_packet_t *)&frame;
+    pkt->flags = JD_FRAME_FLAG_COMMAND;
+    pkt->service_size = 0;
+    pkt->service_command = JD_GET(JD_REG_STREAMING_INTERVAL);
+    for (uint32_t i = 0; i < iters; ++i)
+        bench_sink += service_handle_register(state, pkt, bench_regs);
+}
+
+static void bench_reg_set(void *ctx, uint32_t iters) {
+    srv_t *state = ctx;
+    jd_frame_t frame = {0};
+    jd_packet_t *pkt = (jd_packet_t *)&frame;
+    pkt->flags = JD_FRAME_FLAG_COMMAND;
+    pkt->service_size = 4;
+    pkt->service_command = JD_SET(JD_REG_STREAMING_INTERVAL);
+    for (uint32_t i = 0; i < iters; ++i) {
+        *(uint32_t *)pkt->data = i;
+        bench_sink += service_handle_register(state, pkt, bench_regs);
+    }
+}
+
+// bursts of 16 events (like a multi-touch swipe), each repeated twice by the event queue
+static void bench_event_burst(void *ctx, uint32_t iters) {
+    srv_t *state = ctx;
+    for (uint32_t i = 0; i < iters; ++i) {
+        jd_send_event_ext(state, i & 0xff, &i, sizeof(i));
+        if ((i & 15) == 15) {
+            now += 21 * 1000;
+            jd_process_event_queue();
+            now += 51 * 1000;
+            jd_process_event_queue();
+            jd_tx_flush();
+        }
+    }
+}
+
+/*
+ * Number formats
+ */
+
+static void bench_numfmt_read(void *ctx, uint32_t iters) {
+    int16_t v = 1234;
+    for (uint32_t i = 0; i < iters; ++i) {
+        v += 3;
+        bench_sink += (int)jd_numfmt_read_float(&v, JD_NUMFMT_I16 | (8 << 4));
+        bench_sink += jd_numfmt_read_i32(&v, JD_NUMFMT_I16);
+    }
+}
+
+static void bench_numfmt_write(void *ctx, uint32_t iters) {
+    uint8_t buf[8];
+    for (uint32_t i = 0; i < iters; ++i) {
+        jd_numfmt_write_float(buf, JD_NUMFMT_U16 | (10 << 4), 0.5 + (i & 31));
+        jd_numfmt_write_i32(buf + 4, JD_NUMFMT_I32, i);
+        bench_sink += buf[0] + buf[4];
+    }
+}
+
+/*
+ * printf
+ */
+
+static void bench_sprintf_int(void *ctx, uint32_t iters) {
+    char buf[JD_DMESG_LINE_BUFFER];
+    for (uint32_t i = 0; i < iters; ++i)
+        bench_sink += jd_sprintf(buf, sizeof(buf), "serv %s/%d[0x%x] - pkt cmd=%x sz=%d", "ABCD",
+                                 i & 7, 0x1f6ab2a1, 0x8001, 12);
+}
+
+#if JD_ADVANCED_STRING
+static void bench_sprintf_float(void *ctx, uint32_t iters) {
+    char buf[JD_DMESG_LINE_BUFFER];
+    for (uint32_t i = 0; i < iters; ++i)
+        bench_sink += jd_sprintf(buf, sizeof(buf), "t=%f v=%f", 21.375 + (i & 7), -0.000123);
+}
+
+// float32 register values (as they come from jd_numfmt), and some full doubles
+static const double print_values[8] = {
+    23.5f, 0.1f, 1013.25f, -0.000123f, 3.14159265358979, 6.02214076e23, 1e-9, 12345.678,
+};
+
+static void bench_print_double(void *ctx, uint32_t iters) {
+    char buf[64];
+    for (uint32_t i = 0; i < iters; ++i) {
+        jd_print_double(buf, print_values[i & 7], 0);
+        bench_sink += buf[0];
+    }
+}
+#endif
+
+#if JD_FREE_SUPPORTED
+static void bench_sprintf_a(void *ctx, uint32_t iters) {
+    for (uint32_t i = 0; i < iters; ++i) {
+        char *s = jd_sprintf_a("%s:%d:%x", "some/file/name.c", i & 1023, 0xdeadbeef);
+        bench_sink += s[0];
+        jd_free(s);
+    }
+}
+
+static void bench_sprintf_a_dmesg(void *ctx, uint32_t iters) {
+    for (uint32_t i = 0; i < iters; ++i) {
+        char *s = jd_sprintf_a("serv %s/%d[0x%x] - pkt cmd=%x sz=%d", "ABCD", i & 7, 0x1f6ab2a1,
+                               0x8001, 12);
+        bench_sink += s[0];
+        jd_free(s);
+    }
+}
+
+// longer than what fits on stack
+static void bench_sprintf_a_long(void *ctx, uint32_t iters) {
+    static const uint8_t data[32] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    for (uint32_t i = 0; i < iters; ++i) {
+        char *s = jd_sprintf_a("dev %s: announce %*p (%d services)", "ABCD", (int)sizeof(data),
+                               data, i & 15);
+        bench_sink += s[0];
+        jd_free(s);
+    }
+}
+
+static void bench_urlencode(void *ctx, uint32_t iters) {
+    for (uint32_t i = 0; i < iters; ++i) {
+        char *s = jd_urlencode("devices/Some Device #3/temperature?unit=°C");
+        bench_sink += s[0];
+        jd_free(s);
+    }
+}
+
+static void bench_concat3(void *ctx, uint32_t iters) {
+    for (uint32_t i = 0; i < iters; ++i) {
+        char *s = jd_concat3("https://example.com/api/v1/", "devices/", "a1b2c3d4e5f60718");
+        bench_sink += s[0];
+        jd_free(s);
+    }
+}
+#endif
+
+#if JD_DMESG_BUFFER_SIZE > 0
+static void bench_dmesg_int(void *ctx, uint32_t iters) {
+    for (uint32_t i = 0; i < iters; ++i)
+        jd_dmesg("serv %s/%d[0x%x] - pkt cmd=%x sz=%d", "ABCD", i & 7, 0x1f6ab2a1, 0x8001, 12);
+}
+
+// log and read back one line
+static void bench_dmesg_read(void *ctx, uint32_t iters) {
+    char buf[JD_DMESG_LINE_BUFFER];
+    uint32_t ptr = jd_dmesg_currptr();
+    for (uint32_t i = 0; i < iters; ++i) {
+        jd_dmesg("serv %s/%d[0x%x] - pkt cmd=%x sz=%d", "ABCD", i & 7, 0x1f6ab2a1, 0x8001, 12);
+        bench_sink += jd_dmesg_read_line(buf, sizeof(buf), &ptr);
+    }
+}
+#endif
+
+static void bench_scratch_sprintf(void *ctx, uint32_t iters) {
+    for (uint32_t i = 0; i < iters; ++i) {
+        char *s = jd_scratch_sprintf("%s:%d:%x", "some/file/name.c", i & 1023, 0xdeadbeef);
+        bench_sink += s[0];
+        jd_scratch_reset();
+    }
+}
+
+/*
+ * DCFG
+ */
+
+#if JD_DCFG
+static void bench_dcfg_u32(void *ctx, uint32_t iters) {
+    for (uint32_t i = 0; i < iters; ++i)
+        bench_sink += dcfg_get_u32("i2c.kHz", 100);
+}
+
+static void bench_dcfg_string(void *ctx, uint32_t iters) {
+    for (uint32_t i = 0; i < iters; ++i)
+        bench_sink += dcfg_get_string("devName", NULL)[0];
+}
+
+static void bench_dcfg_miss(void *ctx, uint32_t iters) {
+    for (uint32_t i = 0; i < iters; ++i)
+        bench_sink += dcfg_get_u32("spi.pinMOSI", 7);
+}
+#endif
+
+/*
+ * Client device lookup
+ */
+
+#if JD_CLIENT
+#define NUM_DEVICES 32
+
+static uint64_t bench_device_id(int i) {
+    return 0x5a5a000000000000ULL + (uint64_t)i * 0x10203040506ULL;
+}
+
+static void bench_client_init(void) {
+    jd_frame_t frame;
+    jd_packet_t *pkt = (jd_packet_t *)&frame;
+    for (int i = 0; i < NUM_DEVICES; ++i) {
+        memset(&frame, 0, sizeof(frame));
+        pkt->device_identifier = bench_device_id(i);
+        pkt->service_size = 4 * 4;
+        uint32_t *data = (uint32_t *)pkt->data;
+        data[0] = 0x100 | i;
+        data[1] = 0x1f140409; // accelerometer
+        data[2] = 0x1473a263; // button
+        data[3] = 0x14ad1a5d; // temperature
+        jd_client_handle_packet(pkt);
+    }
+}
+
+static void bench_device_lookup(void *ctx, uint32_t iters) {
+    for (uint32_t i = 0; i < iters; ++i) {
+        jd_device_t *d = jd_device_lookup(bench_device_id(i % NUM_DEVICES));
+        bench_sink += d->num_services;
+    }
+}
+#endif
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--csv") == 0)
+            csv_output = true;
+        else
+            name_filter = argv[i];
+    }
+
+    bench_platform_init();
+#if JD_CLIENT
+    bench_client_init();
+#endif
+
+    for (unsigned i = 0; i < sizeof(crc_data); ++i)
+        crc_data[i] = i * 7 + (i >> 5);
+
+    if (csv_output)
+        printf("name,iters,ns_per_op\n");
+    else
+        printf("{\n  \"unit\": \"ns/op\",\n  \"results\": [");
+
+    bench_run("queue_push_shift", bench_queue, jd_queue_alloc(1024));
+    bench_run("bqueue_push_pop", bench_bqueue, jd_bqueue_alloc(1024));
+
+    bench_run("crc16_252", bench_crc16, (void *)252);
+    bench_run("crc32_512", bench_crc32, (void *)512);
+    bench_run("crc32_4096", bench_crc32, (void *)4096);
+
+    bench_run("frame_pack_10", bench_frame_pack, NULL);
+    bench_run("frame_unpack_10", bench_frame_unpack, NULL);
+
+    srv_t *state = jd_alloc(sizeof(srv_t));
+    state->streaming_interval = 100;
+    bench_run("reg_get_u32", bench_reg_get, state);
+    bench_run("reg_set_u32", bench_reg_set, state);
+    bench_run("event_burst_16", bench_event_burst, state);
+    jd_free(state);
+
+    bench_run("numfmt_read", bench_numfmt_read, NULL);
+    bench_run("numfmt_write", bench_numfmt_write, NULL);
+
+    bench_run("sprintf_int", bench_sprintf_int, NULL);
+#if JD_ADVANCED_STRING
+    bench_run("sprintf_float", bench_sprintf_float, NULL);
+    bench_run("print_double", bench_print_double, NULL);
+#endif
+#if JD_FREE_SUPPORTED
+    bench_run("sprintf_a", bench_sprintf_a, NULL);
+    bench_run("sprintf_a_dmesg", bench_sprintf_a_dmesg, NULL);
+    bench_run("sprintf_a_long", bench_sprintf_a_long, NULL);
+    bench_run("urlencode", bench_urlencode, NULL);
+    bench_run("concat3", bench_concat3, NULL);
+#endif
+    bench_run("scratch_sprintf", bench_scratch_sprintf, NULL);
+#if JD_DMESG_BUFFER_SIZE > 0
+    bench_run("dmesg_int", bench_dmesg_int, NULL);
+    bench_run("dmesg_read", bench_dmesg_read, NULL);
+#endif
+
+#if JD_DCFG
+    bench_run("dcfg_get_u32", bench_dcfg_u32, NULL);
+    bench_run("dcfg_get_string", bench_dcfg_string, NULL);
+    bench_run("dcfg_get_miss", bench_dcfg_miss, NULL);
+#endif
+
+#if JD_CLIENT
+    bench_run("device_lookup_32", bench_device_lookup, NULL);
+#endif
+
+    if (!csv_output)
+        printf("\n  ]\n}\n");
+
+    return 0;
+}
@@ -0,0 +1,405 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+// Measures output pipe (jd_opipe_*()) throughput to a device on a simulated bus.
+//
+// Usage: jacdac_pipe [--bytes N] [--chunks 16,64,...] [--loss 0,1,...] [--turnaround US]
+//                    [--pipes N] [--reorder PERCENT] [--zero-copy]
+//
+// The same source is built as jacdac_pipe (stop-and-wait, frame embedded in the descriptor),
+// jacdac_pipe_win (JD_OPIPE_WINDOW=4), jacdac_pipe_pool (stop-and-wait with
+// JD_OPIPE_FRAME_POOL=2), and jacdac_pipe_win_reorder (JD_OPIPE_WINDOW=4 JD_IPIPE_REORDER=1).
+//
+// The bus runs at 1Mbaud in virtual time. The virtual receiver ACKs every frame, and passes
+// the packets to input pipes (jd_ipipe_*()) of the stack under test, so packets with
+// unexpected pipe counter are dropped, or kept in the JD_IPIPE_REORDER buffer.
+// It needs --turnaround microseconds after receiving a frame before it can send the ACK.
+// --loss drops the given percentage of frames in both directions. --reorder delays
+// the given percentage of data frames until after the next one (or by 1ms if there is none).
+//
+// For every loss rate and chunk size, --bytes are written with jd_opipe_write() in chunks,
+// as fast as the pipe allows, and the pipe is closed. With --zero-copy, the data is written
+// with jd_opipe_begin_write(), using all space left in the frame, up to chunk size.
+// With --pipes, that many pipes (to consecutive ports) are written at the same time, so that
+// with JD_OPIPE_FRAME_POOL they compete for the pool; the results are summed over all pipes.
+// The receiver verifies the data. Results are printed as JSON. The exit code is 1 if any run
+// didn't deliver all the data (jd_opipe_close() also returns JD_PIPE_OK for a dropped pipe).
+
+#include "bench.h"
+#include "jd_pipes.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_PENDING 64
+#define STEP_US 20
+#define MAX_RUN_US (120 * 1000 * 1000)
+#define RECEIVER_ID 0x4200000000000001ULL
+#define MAX_PIPES 8
+
+typedef struct {
+    uint64_t at;
+    jd_frame_t frame;
+} pending_t;
+
+// frames going to the stack under test
+static pending_t pending[MAX_PENDING];
+static unsigned pending_head, pending_len;
+// ACKs waiting for turnaround and a free bus
+static uint64_t ack_at[MAX_PENDING];
+static uint16_t ack_crc[MAX_PENDING];
+static unsigned ack_head, ack_len;
+
+static uint64_t vt, bus_free_at;
+static uint32_t loss_percent;
+static uint32_t turnaround_us = 100;
+static uint32_t reorder_percent;
+static bool zero_copy;
+static unsigned num_pipes = 1;
+
+// per pipe
+static struct {
+    jd_ipipe_desc_t ipipe;
+    uint32_t bytes;
+    uint32_t corrupt_pkts;
+    bool closed;
+} rx[MAX_PIPES];
+static uint32_t rx_frames;
+
+// data frame held back by --reorder
+static jd_frame_t held;
+static uint64_t held_end;
+static bool have_held;
+
+static uint32_t wire_us(jd_frame_t *frame) {
+    return JD_FRAME_SIZE(frame) * 10 + 70;
+}
+
+static uint64_t bus_transmit(jd_frame_t *frame, uint64_t earliest) {
+    uint64_t start = earliest > bus_free_at ? earliest : bus_free_at;
+    bus_free_at = start + wire_us(frame);
+    return bus_free_at;
+}
+
+static void fill_pattern(uint8_t *dst, uint32_t offset, unsigned len) {
+    for (unsigned i = 0; i < len; ++i)
+        dst[i] = (uint8_t)(offset + i);
+}
+
+static bool lost(void) {
+    return loss_percent && jd_random() % 100 < loss_percent;
+}
+
+static unsigned rx_index(jd_ipipe_desc_t *istr) {
+    for (unsigned i = 0; i < MAX_PIPES; ++i)
+        if (&rx[i].ipipe == istr)
+            return i;
+    JD_PANIC();
+    return 0;
+}
+
+static void rx_data(jd_ipipe_desc_t *istr, jd_packet_t *pkt) {
+    unsigned idx = rx_index(istr);
+    uint8_t expected[JD_SERIAL_PAYLOAD_SIZE];
+    fill_pattern(expected, rx[idx].bytes, pkt->service_size);
+    if (memcmp(expected, pkt->data, pkt->service_size) != 0)
+        rx[idx].corrupt_pkts++;
+    rx[idx].bytes += pkt->service_size;
+}
+
+static void rx_meta(jd_ipipe_desc_t *istr, jd_packet_t *pkt) {
+    if (pkt == NULL)
+        rx[rx_index(istr)].closed = true;
+}
+
+static void receive(jd_frame_t *frame, uint64_t end) {
+    if ((frame->flags & JD_FRAME_FLAG_ACK_REQUESTED) && ack_len < MAX_PENDING) {
+        unsigned idx = (ack_head + ack_len++) % MAX_PENDING;
+        ack_at[idx] = end + turnaround_us;
+        ack_crc[idx] = frame->crc;
+    }
+
+    jd_frame_t copy;
+    memcpy(&copy, frame, JD_FRAME_SIZE(frame));
+    // input pipes only take packets addressed to this device
+    copy.device_identifier = jd_device_id();
+    rx_frames++;
+    do {
+        jd_ipipe_handle_packet((jd_packet_t *)&copy);
+    } while (jd_shift_frame(&copy));
+}
+
+static void receive_held(void) {
+    if (have_held) {
+        have_held = false;
+        receive(&held, held_end);
+    }
+}
+
+// frames sent by the stack under test
+static void on_tx(jd_frame_t *frame) {
+    uint64_t end = bus_transmit(frame, vt);
+    if (frame->device_identifier != RECEIVER_ID || !(frame->flags & JD_FRAME_FLAG_COMMAND) ||
+        lost())
+        return;
+    if (reorder_percent && !have_held && jd_random() % 100 < reorder_percent) {
+        memcpy(&held, frame, JD_FRAME_SIZE(frame));
+        held_end = end;
+        have_held = true;
+        return;
+    }
+    receive(frame, end);
+    receive_held();
+}
+
+static void send_ack(uint16_t crc) {
+    jd_frame_t frame;
+    jd_reset_frame(&frame);
+    frame.flags = 0;
+    jd_push_in_frame(&frame, JD_SERVICE_INDEX_CRC_ACK, crc, 0);
+    frame.device_identifier = RECEIVER_ID;
+    jd_compute_crc(&frame);
+    uint64_t end = bus_transmit(&frame, vt);
+    if (lost() || pending_len >= MAX_PENDING)
+        return;
+    pending_t *p = &pending[(pending_head + pending_len++) % MAX_PENDING];
+    p->at = end;
+    memcpy(&p->frame, &frame, JD_FRAME_SIZE(&frame));
+}
+
+static void step(void) {
+    vt += STEP_US;
+    bench_set_micros(vt);
+
+    if (have_held && held_end + 1000 <= vt)
+        receive_held();
+
+    if (ack_len && ack_at[ack_head] <= vt && bus_free_at <= vt) {
+        send_ack(ack_crc[ack_head]);
+        ack_head = (ack_head + 1) % MAX_PENDING;
+        ack_len--;
+    }
+
+    while (pending_len && pending[pending_head].at <= vt) {
+        jd_rx_frame_received(&pending[pending_head].frame);
+        pending_head = (pending_head + 1) % MAX_PENDING;
+        pending_len--;
+    }
+
+    jd_process_everything();
+}
+
+static int num_results, num_incomplete;
+
+// writes as much as the pipe takes; returns true when the pipe is done (closed or failed)
+static bool write_some(jd_opipe_desc_t *pipe, uint32_t *written, uint32_t num_bytes,
+                       unsigned chunk, bool *closing, int *err) {
+    uint8_t buf[JD_SERIAL_PAYLOAD_SIZE];
+    int r = 0;
+
+    while (*written < num_bytes) {
+        unsigned len = num_bytes - *written < chunk ? num_bytes - *written : chunk;
+        if (zero_copy) {
+            uint8_t *dst = jd_opipe_begin_write(pipe, 1, len, &len);
+            if (!dst) {
+                r = jd_opipe_check_space(pipe, 1);
+                break;
+            }
+            fill_pattern(dst, *written, len);
+            jd_opipe_end_write(pipe, len);
+        } else {
+            fill_pattern(buf, *written, len);
+            r = jd_opipe_write(pipe, buf, len);
+            if (r)
+                break;
+        }
+        *written += len;
+    }
+    if (r == JD_PIPE_TRY_AGAIN)
+        return false;
+    if (r) {
+        *err = r;
+        return true;
+    }
+    r = jd_opipe_close(pipe);
+    if (r == JD_PIPE_TRY_AGAIN)
+        return false;
+    if (r != JD_PIPE_OK) {
+        *err = r;
+        return true;
+    }
+    // the first JD_PIPE_OK only means the close packet was queued
+    if (*closing)
+        return true;
+    *closing = true;
+    return false;
+}
+
+static int num_results, num_incomplete;
+
+static void run(uint32_t num_bytes, unsigned chunk) {
+    static jd_opipe_desc_t pipes[MAX_PIPES];
+    uint32_t written[MAX_PIPES] = {0};
+    bool closing[MAX_PIPES] = {0}, done[MAX_PIPES] = {0};
+    int err = 0;
+    unsigned num_done = 0;
+
+    memset(rx, 0, sizeof(rx));
+    rx_frames = 0;
+    uint32_t frames0 = bench_tx_frames;
+    uint64_t start = vt, end = vt + MAX_RUN_US;
+    for (unsigned i = 0; i < num_pipes && !err; ++i) {
+        int port = jd_ipipe_open(&rx[i].ipipe, rx_data, rx_meta);
+        err = jd_opipe_open(&pipes[i], RECEIVER_ID, port);
+    }
+
+    while (!err && num_done < num_pipes && vt < end) {
+        for (unsigned i = 0; i < num_pipes; ++i)
+            if (!done[i] &&
+                write_some(&pipes[i], &written[i], num_bytes, chunk, &closing[i], &err)) {
+                done[i] = true;
+                num_done++;
+            }
+        step();
+    }
+    if (!err && num_done < num_pipes)
+        err = JD_PIPE_TIMEOUT;
+
+    uint32_t elapsed = (uint32_t)(vt - start);
+    uint32_t delivered = 0, dropped = 0, reordered = 0, corrupt = 0;
+    bool complete = true;
+    jd_opipe_stats_t st, sum;
+    memset(&sum, 0, sizeof(sum));
+    for (unsigned i = 0; i < num_pipes; ++i) {
+        jd_ipipe_stats_t ist;
+        jd_ipipe_get_stats(&rx[i].ipipe, &ist);
+        delivered += rx[i].bytes;
+        dropped += ist.num_dropped + ist.num_duplicates;
+        reordered += ist.num_reordered;
+        corrupt += rx[i].corrupt_pkts;
+        if (!rx[i].closed || rx[i].bytes != num_bytes || rx[i].corrupt_pkts)
+            complete = false;
+        jd_opipe_get_stats(&pipes[i], &st);
+        sum.num_retransmits += st.num_retransmits;
+        sum.num_timeouts += st.num_timeouts;
+        sum.num_tx_overflows += st.num_tx_overflows;
+        sum.num_pool_waits += st.num_pool_waits;
+    }
+    // RTT estimates are of the first pipe
+    jd_opipe_get_stats(&pipes[0], &st);
+    printf("%s\n    {\"chunk\": %u, \"loss_percent\": %u, \"error\": %d, \"delivered\": %u, "
+           "\"complete\": %s, \"elapsed_us\": %u, \"goodput_bps\": %u, \"frames_sent\": %u, "
+           "\"frames_received\": %u, \"dropped_packets\": %u, \"reordered_packets\": %u, "
+           "\"corrupt_packets\": %u, \"retransmits\": %u, "
+           "\"timeouts\": %u, \"tx_overflows\": %u, \"pool_waits\": %u, \"srtt_us\": %u, "
+           "\"rttvar_us\": %u, \"rto_us\": %u, \"rtt_min_us\": %u, \"rtt_max_us\": %u}",
+           num_results++ ? "," : "", chunk, (unsigned)loss_percent, err, (unsigned)delivered,
+           complete ? "true" : "false", (unsigned)elapsed,
+           (unsigned)((uint64_t)delivered * 1000000 / (elapsed ? elapsed : 1)),
+           (unsigned)(bench_tx_frames - frames0), (unsigned)rx_frames, (unsigned)dropped,
+           (unsigned)reordered, (unsigned)corrupt, (unsigned)sum.num_retransmits,
+           (unsigned)sum.num_timeouts, (unsigned)sum.num_tx_overflows,
+           (unsigned)sum.num_pool_waits, (unsigned)st.srtt, (unsigned)st.rttvar, (unsigned)st.rto,
+           (unsigned)st.rtt_min, (unsigned)st.rtt_max);
+    fflush(stdout);
+    if (!complete) {
+        fprintf(stderr, "chunk %u, loss %u%%: delivered %u of %u bytes (error %d)\n", chunk,
+                (unsigned)loss_percent, (unsigned)delivered, (unsigned)(num_bytes * num_pipes),
+                err);
+        num_incomplete++;
+    }
+
+    for (unsigned i = 0; i < num_pipes; ++i)
+        jd_opipe_close(&pipes[i]);
+    // let the bus settle
+    for (int i = 0; i < 1000; ++i)
+        step();
+    for (unsigned i = 0; i < num_pipes; ++i)
+        jd_ipipe_close(&rx[i].ipipe);
+}
+
+static int parse_list(const char *val, int *dst, int max) {
+    int n = 0;
+    for (const char *p = val; *p && n < max;) {
+        dst[n++] = atoi(p);
+        p = strchr(p, ',');
+        if (!p)
+            break;
+        p++;
+    }
+    return n;
+}
+
+int main(int argc, char **argv) {
+    uint32_t num_bytes = 16 * 1024;
+    int chunks[16] = {16, 64, JD_SERIAL_PAYLOAD_SIZE - 4};
+    int num_chunks = 3;
+    int losses[16] = {0, 1, 5};
+    int num_losses = 3;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--zero-copy") == 0) {
+            zero_copy = true;
+            continue;
+        }
+        const char *val = i + 1 < argc ? argv[++i] : "";
+        if (strcmp(arg, "--bytes") == 0) {
+            num_bytes = atoi(val);
+        } else if (strcmp(arg, "--chunks") == 0) {
+            num_chunks = parse_list(val, chunks, 16);
+        } else if (strcmp(arg, "--loss") == 0) {
+            num_losses = parse_list(val, losses, 16);
+        } else if (strcmp(arg, "--turnaround") == 0) {
+            turnaround_us = atoi(val);
+        } else if (strcmp(arg, "--pipes") == 0) {
+            num_pipes = atoi(val);
+        } else if (strcmp(arg, "--reorder") == 0) {
+            reorder_percent = atoi(val);
+        } else {
+            fprintf(stderr, "unknown argument: %s\n", arg);
+            return 1;
+        }
+    }
+
+    for (int i = 0; i < num_chunks; ++i)
+        if (chunks[i] < 1 || chunks[i] > JD_SERIAL_PAYLOAD_SIZE - 4) {
+            fprintf(stderr, "invalid chunk size\n");
+            return 1;
+        }
+    for (int i = 0; i < num_losses; ++i)
+        if (losses[i] < 0 || losses[i] > 50) {
+            fprintf(stderr, "invalid loss rate\n");
+            return 1;
+        }
+    if (num_bytes < 1 || num_pipes < 1 || num_pipes > MAX_PIPES || reorder_percent > 50) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    vt = 1000000;
+    bench_set_micros(vt);
+    bench_platform_init();
+    bench_drain_rx = false;
+    bench_tx_hook = on_tx;
+    jd_seed_random(42);
+    jd_services_init();
+
+    printf("{\n  \"window\": %d,\n  \"frame_pool\": %d,\n  \"ipipe_reorder\": %d,\n"
+           "  \"desc_size\": %u,\n  \"bytes\": %u,\n  \"pipes\": %u,\n  \"turnaround_us\": %u,\n"
+           "  \"reorder_percent\": %u,\n  \"zero_copy\": %s,\n  \"results\": [",
+           JD_OPIPE_WINDOW, JD_OPIPE_FRAME_POOL, JD_IPIPE_REORDER,
+           (unsigned)sizeof(jd_opipe_desc_t), (unsigned)num_bytes, num_pipes,
+           (unsigned)turnaround_us, (unsigned)reorder_percent, zero_copy ? "true" : "false");
+
+    for (int l = 0; l < num_losses; ++l) {
+        loss_percent = losses[l];
+        for (int c = 0; c < num_chunks; ++c)
+            run(num_bytes, chunks[c]);
+    }
+
+    printf("\n  ]\n}\n");
+
+    return num_incomplete ? 1 : 0;
+}
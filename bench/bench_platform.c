@@ -0,0 +1,229 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+// Minimal hosted implementation of the platform interfaces (inc/interfaces/*.h),
+// sufficient to run parts of the stack in a single-threaded benchmark.
+// Frames that would go on the wire are dropped immediately, as if sent on an idle bus.
+
+#include "bench.h"
+#include "jd_dcfg.h"
+#if JD_CLIENT
+#include "jd_client.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+uint32_t now;
+uint8_t cpu_mhz = 64;
+const char app_fw_version[] = "v0.0.0-bench";
+
+bool bench_drain_rx = true;
+uint32_t bench_tx_frames;
+void (*bench_tx_hook)(jd_frame_t *frame);
+uint32_t bench_alloc_count, bench_alloc_bytes;
+
+static uint8_t in_drain;
+static bool use_virtual_time;
+static uint64_t virtual_micros;
+
+uint64_t bench_nanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void bench_set_micros(uint64_t t) {
+    use_virtual_time = true;
+    virtual_micros = t;
+}
+
+uint64_t tim_get_micros(void) {
+    if (use_virtual_time)
+        return virtual_micros;
+    return bench_nanos() / 1000;
+}
+
+void tim_set_timer(int delta, cb_t cb) {}
+
+uint64_t hw_device_id(void) {
+    return 0x1234567890abcdefULL;
+}
+
+void hw_panic(void) {
+    fflush(stdout);
+    bench_dump_dmesg();
+    abort();
+}
+
+// jacdac_dmesg provides its own
+__attribute__((weak)) void target_enable_irq(void) {}
+__attribute__((weak)) void target_disable_irq(void) {}
+int target_in_irq(void) {
+    return 0;
+}
+void target_wait_us(uint32_t n) {}
+void target_reset(void) {
+    JD_PANIC();
+}
+
+void pwr_enter_no_sleep(void) {}
+void pwr_leave_no_sleep(void) {}
+
+uint8_t jd_connected_blink;
+void jd_blink(uint8_t encoded) {}
+void jd_glow(uint32_t glow) {}
+
+void jd_alloc_init(void) {}
+void jd_alloc_stack_check(void) {}
+
+// with JD_SLAB_ALLOC, this is the heap below slab_alloc.c
+#if JD_SLAB_ALLOC
+void *jd_heap_alloc(uint32_t size) {
+#else
+void *jd_alloc(uint32_t size) {
+#endif
+    void *r = calloc(1, size ? size : 1);
+    if (!r)
+        JD_PANIC();
+    bench_alloc_count++;
+    bench_alloc_bytes += size;
+#if !JD_SLAB_ALLOC
+    JD_ALLOC_PROFILE_ALLOC(r, size);
+#endif
+    return r;
+}
+
+#if JD_SLAB_ALLOC
+void jd_heap_free(void *ptr) {
+#else
+void jd_free(void *ptr) {
+#endif
+#if !JD_SLAB_ALLOC
+    JD_ALLOC_PROFILE_FREE(ptr);
+#endif
+    free(ptr);
+}
+
+uint32_t jd_available_memory(void) {
+    return 64 * 1024 * 1024;
+}
+
+// jacdac_boot provides its own
+__attribute__((weak)) void app_init_services(void) {
+#if JD_CLIENT
+    // the client routing code requires role manager
+    jd_role_manager_init();
+#endif
+}
+
+// we pretend the bus is idle and fast; everything we send is dropped,
+// and so is everything looped back, unless bench_drain_rx is cleared
+void jd_packet_ready(void) {
+    if (in_drain)
+        return;
+    in_drain = 1;
+    for (;;) {
+        jd_frame_t *f = jd_tx_get_frame();
+        if (f) {
+            bench_tx_frames++;
+            if (bench_tx_hook)
+                bench_tx_hook(f);
+            jd_tx_frame_sent(f);
+        }
+        jd_frame_t *r = bench_drain_rx ? jd_rx_get_frame() : NULL;
+        if (r)
+            jd_rx_release_frame(r);
+        if (!f && !r)
+            break;
+    }
+    in_drain = 0;
+}
+
+void bench_dump_dmesg(void) {
+#if JD_DMESG_BUFFER_SIZE > 0
+    char buf[128];
+    uint32_t ptr = jd_dmesg_startptr();
+    for (;;) {
+        unsigned len = jd_dmesg_read(buf, sizeof(buf), &ptr);
+        if (!len)
+            break;
+        fwrite(buf, 1, len, stderr);
+    }
+#endif
+}
+
+#if JD_DCFG
+uint32_t bench_dcfg_image[4096 / 4];
+
+static uint16_t bench_keyhash(const char *key) {
+    uint32_t h = jd_hash_fnv1a(key, strlen(key));
+    return h ^ (h >> 16);
+}
+
+static int cmp_entry(const void *a, const void *b) {
+    const dcfg_entry_t *ea = a, *eb = b;
+    return (int)ea->hash - (int)eb->hash;
+}
+
+// build image similar to what a typical board config looks like
+static void bench_dcfg_init(void) {
+    dcfg_header_t *hd = (dcfg_header_t *)bench_dcfg_image;
+    static const char *names[] = {"archId", "devName", "productId", "sd.pinCS", "sd.pinMISO",
+                                  "sd.pinMOSI", "sd.pinSCK", "led.pin", "led.type", "i2c.pinSDA",
+                                  "i2c.pinSCL", "i2c.kHz", "jacdac.pin", "log.baud", "log.pinTX",
+                                  "pins.P0", "pins.P1", "pins.P2", "pins.P3", "pins.P4"};
+    const unsigned num = sizeof(names) / sizeof(names[0]);
+
+    memset(hd, 0, sizeof(bench_dcfg_image));
+    hd->magic0 = DCFG_MAGIC0;
+    hd->magic1 = DCFG_MAGIC1;
+    hd->num_entries = num;
+
+    unsigned data_ptr = sizeof(dcfg_header_t) + sizeof(dcfg_entry_t) * (num + 1);
+    uint8_t *base = (uint8_t *)hd;
+
+    for (unsigned i = 0; i < num; ++i) {
+        dcfg_entry_t *e = &hd->entries[i];
+        strcpy(e->key, names[i]);
+        e->hash = bench_keyhash(names[i]);
+        if (i == 1 || i == 0) {
+            const char *s = i == 0 ? "rp2040" : "Bench Board";
+            unsigned len = strlen(s);
+            e->type_size = DCFG_TYPE_STRING | (len << DCFG_TYPE_BITS);
+            e->value = data_ptr;
+            memcpy(base + data_ptr, s, len + 1);
+            data_ptr += len + 1;
+        } else {
+            e->type_size = DCFG_TYPE_U32;
+            e->value = i * 3;
+        }
+    }
+    qsort(hd->entries, num, sizeof(dcfg_entry_t), cmp_entry);
+
+    hd->entries[num].hash = 0xffff;
+    hd->entries[num].type_size = 0xffff;
+
+    unsigned idx = 0;
+    for (unsigned i = 0; i < DCFG_HASH_JUMP_ENTRIES; ++i) {
+        while (idx < num && (hd->entries[idx].hash >> DCFG_HASH_SHIFT) < i)
+            idx++;
+        hd->hash_jump[i] = idx;
+    }
+
+    hd->total_bytes = (data_ptr + 3) & ~3;
+    JD_ASSERT(hd->total_bytes <= sizeof(bench_dcfg_image));
+    JD_ASSERT(dcfg_validate(hd) == 0);
+}
+#endif
+
+void bench_platform_init(void) {
+#if JD_DCFG
+    bench_dcfg_init();
+#endif
+    jd_refresh_now();
+    jd_tx_init();
+    jd_rx_init();
+}
@@ -0,0 +1,372 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+// Replays a bus trace (see inc/jd_trace.h) into a hosted build of the stack.
+//
+// Usage:
+//   jacdac_replay [--speed X] [--tick US] trace.bin
+//   jacdac_replay --generate trace.bin [--devices N] [--seconds S]
+//
+// Received frames from the trace are fed into jd_rx_frame_received() at their original
+// timestamps (in virtual time), and the main loop is run every --tick microseconds (default 1000).
+// With --speed 0 (default) the replay runs as fast as possible, with --speed 1 it runs
+// in real time, and with --speed 10 it runs 10x faster than the original.
+//
+// The report (JSON) includes number of frames, drops, RX queue depth when processing,
+// time spent in the queue (virtual us), and the time it took to process each frame (wall ns).
+//
+// --generate creates a synthetic trace with N devices announcing and streaming sensor readings,
+// going through the regular capture path.
+
+#include "bench.h"
+#include "jd_client.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if JD_TRACE
+
+#define VIRTUAL_START 1000000
+
+typedef struct {
+    uint32_t *data;
+    unsigned len;
+    unsigned cap;
+} samples_t;
+
+static void samples_add(samples_t *s, uint32_t v) {
+    if (s->len == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 1024;
+        s->data = realloc(s->data, s->cap * sizeof(uint32_t));
+        JD_ASSERT(s->data != NULL);
+    }
+    s->data[s->len++] = v;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t aa = *(const uint32_t *)a, bb = *(const uint32_t *)b;
+    return aa < bb ? -1 : aa > bb ? 1 : 0;
+}
+
+static uint32_t percentile(samples_t *s, unsigned p) {
+    if (!s->len)
+        return 0;
+    return s->data[(uint64_t)(s->len - 1) * p / 100];
+}
+
+static void print_samples(const char *name, samples_t *s, bool last) {
+    qsort(s->data, s->len, sizeof(uint32_t), cmp_u32);
+    printf("  \"%s\": {\"p50\": %u, \"p90\": %u, \"p99\": %u, \"max\": %u}%s\n", name,
+           (unsigned)percentile(s, 50), (unsigned)percentile(s, 90), (unsigned)percentile(s, 99),
+           (unsigned)percentile(s, 100), last ? "" : ",");
+}
+
+#if JD_QUEUE_STATS
+static void print_hist(const uint32_t *hist) {
+    int last = JD_QUEUE_HIST_BUCKETS - 1;
+    while (last > 0 && !hist[last])
+        last--;
+    printf("[");
+    for (int i = 0; i <= last; ++i)
+        printf("%s%u", i ? ", " : "", (unsigned)hist[i]);
+    printf("]");
+}
+
+static void print_queue_stats(const char *name, int (*get)(jd_queue_stats_t *, bool)) {
+    jd_queue_stats_t st;
+    if (get(&st, false) != 0)
+        return;
+    printf("  \"%s\": {\"size\": %u, \"max_bytes\": %u, \"max_frames\": %u, \"pushed\": %u, "
+           "\"dropped\": %u, \"dwell_avg_us\": %u, \"dwell_max_us\": %u,\n",
+           name, st.size, st.max_bytes, st.max_frames, (unsigned)st.num_pushed,
+           (unsigned)st.num_dropped,
+           (unsigned)(st.num_shifted ? st.dwell_total_us / st.num_shifted : 0),
+           (unsigned)st.dwell_max_us);
+    printf("    \"occupancy_hist\": ");
+    print_hist(st.occupancy_hist);
+    printf(", \"dwell_hist\": ");
+    print_hist(st.dwell_hist);
+    printf("},\n");
+}
+#endif
+
+static uint8_t *read_file(const char *fn, unsigned *size) {
+    FILE *f = fopen(fn, "rb");
+    if (!f) {
+        fprintf(stderr, "can't open %s\n", fn);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    long sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *r = malloc(sz + 1);
+    if (fread(r, 1, sz, f) != (size_t)sz) {
+        fprintf(stderr, "can't read %s\n", fn);
+        exit(1);
+    }
+    fclose(f);
+    *size = sz;
+    return r;
+}
+
+static void sleep_until(uint64_t wall_ns) {
+    uint64_t n = bench_nanos();
+    if (n >= wall_ns)
+        return;
+    uint64_t d = wall_ns - n;
+    struct timespec ts = {.tv_sec = d / 1000000000, .tv_nsec = d % 1000000000};
+    nanosleep(&ts, NULL);
+}
+
+static int replay(const char *fn, double speed, uint32_t tick) {
+    unsigned size;
+    uint8_t *trace = read_file(fn, &size);
+
+    bench_set_micros(VIRTUAL_START);
+    bench_platform_init();
+    bench_drain_rx = false;
+    jd_trace_enable(false);
+    jd_services_init();
+
+    samples_t proc_ns = {0}, wait_us = {0}, depth = {0};
+    uint32_t num_rx = 0, num_tx = 0, num_rx_drops = 0, orig_drops = 0, orig_overflows = 0;
+    uint32_t num_ticks = 0;
+    uint64_t tick_ns = 0;
+
+    // arrival time (virtual) of frames in RX queue
+    uint32_t queued_at[JD_RX_QUEUE_SIZE / 16];
+    unsigned queued_head = 0, queued_len = 0;
+
+    uint32_t t0 = 0;
+    uint64_t vt = VIRTUAL_START;
+    uint64_t wall_start = bench_nanos();
+    unsigned ptr = 0;
+
+    while (ptr < size) {
+        uint64_t tick_end = vt + tick;
+
+        while (ptr + JD_TRACE_RECORD_HEADER_SIZE + 12 <= size) {
+            jd_trace_record_t hd;
+            memcpy(&hd, trace + ptr, JD_TRACE_RECORD_HEADER_SIZE);
+            jd_frame_t frame;
+            memcpy(&frame, trace + ptr + JD_TRACE_RECORD_HEADER_SIZE, 12);
+            unsigned fsize = JD_FRAME_SIZE(&frame);
+            if (fsize > sizeof(frame) || ptr + JD_TRACE_RECORD_HEADER_SIZE + fsize > size) {
+                fprintf(stderr, "trace truncated at %u\n", ptr);
+                ptr = size;
+                break;
+            }
+
+            if (ptr == 0)
+                t0 = hd.timestamp;
+            uint64_t at = VIRTUAL_START + (uint32_t)(hd.timestamp - t0);
+            if (at >= tick_end)
+                break;
+
+            memcpy(&frame, trace + ptr + JD_TRACE_RECORD_HEADER_SIZE, fsize);
+            ptr += JD_TRACE_RECORD_HEADER_SIZE + fsize;
+
+            if (hd.flags & JD_TRACE_FLAG_DROPPED)
+                orig_drops++;
+            if (hd.flags & JD_TRACE_FLAG_OVERFLOW)
+                orig_overflows++;
+
+            // our own frames are re-generated by the replayed stack
+            if (hd.flags & JD_TRACE_FLAG_TX) {
+                num_tx++;
+                continue;
+            }
+
+            if (speed > 0)
+                sleep_until(wall_start + (uint64_t)((at - VIRTUAL_START) * 1000 / speed));
+
+            bench_set_micros(at);
+            num_rx++;
+            if (!jd_services_needs_frame(&frame))
+                continue;
+            if (jd_rx_frame_received(&frame)) {
+                num_rx_drops++;
+            } else if (queued_len < sizeof(queued_at) / sizeof(queued_at[0])) {
+                queued_at[(queued_head + queued_len++) % (sizeof(queued_at) / 4)] = at;
+            }
+        }
+
+        vt = tick_end;
+        if (speed > 0)
+            sleep_until(wall_start + (uint64_t)((vt - VIRTUAL_START) * 1000 / speed));
+        bench_set_micros(vt);
+        jd_refresh_now();
+
+        // this is jd_process_everything(), but with timing of individual frames
+        samples_add(&depth, queued_len);
+        for (;;) {
+            jd_frame_t *fr = jd_rx_get_frame();
+            if (!fr)
+                break;
+            bool is_loop = (fr->flags & JD_FRAME_FLAG_LOOPBACK) != 0;
+            uint64_t s = bench_nanos();
+            jd_services_process_frame(fr);
+            jd_rx_release_frame(fr);
+            if (is_loop)
+                continue;
+            samples_add(&proc_ns, bench_nanos() - s);
+            if (queued_len) {
+                samples_add(&wait_us, vt - queued_at[queued_head]);
+                queued_head = (queued_head + 1) % (sizeof(queued_at) / 4);
+                queued_len--;
+            }
+        }
+        uint64_t s = bench_nanos();
+        jd_services_tick();
+        app_process();
+        tick_ns += bench_nanos() - s;
+        num_ticks++;
+    }
+
+    printf("{\n");
+    printf("  \"trace\": \"%s\",\n", fn);
+    printf("  \"duration_us\": %u,\n", (unsigned)(vt - VIRTUAL_START));
+    printf("  \"wall_ms\": %u,\n", (unsigned)((bench_nanos() - wall_start) / 1000000));
+    printf("  \"rx_frames\": %u,\n", (unsigned)num_rx);
+    printf("  \"rx_drops\": %u,\n", (unsigned)num_rx_drops);
+    printf("  \"trace_drops\": %u,\n", (unsigned)orig_drops);
+    printf("  \"trace_overflows\": %u,\n", (unsigned)orig_overflows);
+    printf("  \"trace_tx_frames\": %u,\n", (unsigned)num_tx);
+    printf("  \"replay_tx_frames\": %u,\n", (unsigned)bench_tx_frames);
+    printf("  \"ticks\": %u,\n", (unsigned)num_ticks);
+    printf("  \"tick_ns_avg\": %u,\n", (unsigned)(num_ticks ? tick_ns / num_ticks : 0));
+#if JD_QUEUE_STATS
+    print_queue_stats("rx_queue", jd_rx_queue_stats);
+    print_queue_stats("send_queue", jd_tx_queue_stats);
+#endif
+    print_samples("rx_queue_depth", &depth, false);
+    print_samples("queue_wait_us", &wait_us, false);
+    print_samples("process_ns", &proc_ns, true);
+    printf("}\n");
+
+    free(depth.data);
+    free(wait_us.data);
+    free(proc_ns.data);
+    free(trace);
+
+    return 0;
+}
+
+static void gen_frame(uint64_t device_id, int service_index, int cmd, const void *data,
+                      unsigned size) {
+    jd_frame_t frame;
+    jd_reset_frame(&frame);
+    frame.flags = 0;
+    void *trg = jd_push_in_frame(&frame, service_index, cmd, size);
+    memcpy(trg, data, size);
+    frame.device_identifier = device_id;
+    jd_compute_crc(&frame);
+    jd_rx_frame_received(&frame);
+    // drop it right away
+    jd_frame_t *fr = jd_rx_get_frame();
+    if (fr)
+        jd_rx_release_frame(fr);
+}
+
+static int generate(const char *fn, int num_devices, int seconds) {
+    bench_set_micros(VIRTUAL_START);
+    bench_platform_init();
+
+    FILE *f = fopen(fn, "wb");
+    if (!f) {
+        fprintf(stderr, "can't write %s\n", fn);
+        return 1;
+    }
+
+    uint8_t buf[1024];
+    uint32_t readings[num_devices];
+    memset(readings, 0, sizeof(readings));
+
+    for (uint32_t ms = 0; ms < seconds * 1000U; ++ms) {
+        for (int d = 0; d < num_devices; ++d) {
+            uint64_t device_id = 0x1000000000000000ULL + d * 0x0123456789ULL;
+            // spread devices over time a bit
+            uint32_t t = ms + d * 7;
+            bench_set_micros(VIRTUAL_START + ms * 1000 + d * 37);
+            if (t % 500 == 0) {
+                uint32_t ann[4] = {0x100 | (t / 500 > 15 ? 15 : t / 500), 0x1f140409, 0x14ad1a5d,
+                                   0x1473a263};
+                gen_frame(device_id, 0, JD_CONTROL_CMD_SERVICES, ann, sizeof(ann));
+            }
+            if (t % 20 == 0) {
+                int16_t acc[3] = {(int16_t)(readings[d] * 3), -1024, 12};
+                readings[d]++;
+                gen_frame(device_id, 1, JD_GET(JD_REG_READING), acc, sizeof(acc));
+            }
+            if (t % 100 == 0) {
+                int32_t temp = 21 * 1024 + (readings[d] & 255);
+                gen_frame(device_id, 2, JD_GET(JD_REG_READING), &temp, sizeof(temp));
+            }
+        }
+        for (;;) {
+            unsigned n = jd_trace_read(buf, sizeof(buf));
+            if (!n)
+                break;
+            fwrite(buf, 1, n, f);
+        }
+    }
+
+    fclose(f);
+    if (jd_trace_num_lost())
+        fprintf(stderr, "%u records lost\n", (unsigned)jd_trace_num_lost());
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    double speed = 0;
+    uint32_t tick = 1000;
+    const char *gen_fn = NULL;
+    const char *fn = NULL;
+    int num_devices = 8;
+    int seconds = 10;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--speed") == 0 && val) {
+            speed = atof(val);
+            i++;
+        } else if (strcmp(arg, "--tick") == 0 && val) {
+            tick = atoi(val);
+            i++;
+        } else if (strcmp(arg, "--generate") == 0 && val) {
+            gen_fn = val;
+            i++;
+        } else if (strcmp(arg, "--devices") == 0 && val) {
+            num_devices = atoi(val);
+            i++;
+        } else if (strcmp(arg, "--seconds") == 0 && val) {
+            seconds = atoi(val);
+            i++;
+        } else {
+            fn = arg;
+        }
+    }
+
+    if (gen_fn)
+        return generate(gen_fn, num_devices, seconds);
+
+    if (!fn || tick == 0) {
+        fprintf(stderr, "usage: jacdac_replay [--speed X] [--tick US] trace.bin\n"
+                        "       jacdac_replay --generate trace.bin [--devices N] [--seconds S]\n");
+        return 1;
+    }
+
+    return replay(fn, speed, tick);
+}
+
+#else
+
+int main(int argc, char **argv) {
+    fprintf(stderr, "jacdac_replay requires JD_TRACE\n");
+    return 1;
+}
+
+#endif
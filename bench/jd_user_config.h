@@ -0,0 +1,48 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+// Configuration used by the host-side benchmarks in this folder.
+// It mimics a hosted client build (like the one in DeviceScript native), but without
+// any of the heavier subsystems (lstore, USB, DeviceScript).
+
+#ifndef JD_USER_CONFIG_H
+#define JD_USER_CONFIG_H
+
+#include <stdint.h>
+#include <stdarg.h>
+
+// jacdac_bench_lib_physical overrides it with 1
+#ifndef JD_PHYSICAL
+#define JD_PHYSICAL 0
+#endif
+#define JD_CLIENT 1
+#define JD_DEVICESCRIPT 0
+#define JD_USB_BRIDGE 0
+#define JD_CONFIG_STATUS 0
+#define JD_TRACE 1
+
+#define JD_DMESG_BUFFER_SIZE 4096
+
+// jacdac_lstore* override it with 1
+#ifndef JD_LSTORE
+#define JD_LSTORE 0
+#endif
+
+// the library has it off; jacdac_backoff compares it with the fixed delay
+#ifndef JD_TX_BACKOFF_MAX
+#define JD_TX_BACKOFF_MAX 512
+#endif
+
+// stop-and-wait, as in the library; jacdac_pipe_win overrides it with 4
+#ifndef JD_OPIPE_WINDOW
+#define JD_OPIPE_WINDOW 0
+#endif
+
+// jacdac_pipe reports the RTT estimates and retransmissions
+#define JD_OPIPE_STATS 1
+
+// the DCFG image is built at runtime by bench_dcfg_init()
+extern uint32_t bench_dcfg_image[];
+#define JD_DCFG_BASE_ADDR ((uintptr_t)bench_dcfg_image)
+
+#endif
@@ -0,0 +1,259 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+#include "client_internal.h"
+
+#define LOG(fmt, ...) DMESG("flood: " fmt, ##__VA_ARGS__)
+
+struct jd_flood {
+    jd_flood_t *next;
+    uint64_t device_identifier;
+    jd_flood_cfg_t cfg;
+    uint8_t done;
+    uint32_t start_counter;
+    uint32_t next_counter; // ping mode: counter of the outstanding ping
+    uint32_t num_sent;
+    uint32_t start_time;
+    uint32_t last_send;
+    uint32_t last_recv;
+    uint32_t num_received;
+    uint32_t num_duplicates;
+    uint32_t bytes_received;
+    uint32_t first_response;
+    uint32_t num_rtt;
+    uint32_t *rtt;     // cfg.count entries; round-trip times, or gaps between responses
+    uint8_t *received; // bitmap, cfg.count bits
+};
+
+static jd_flood_t *floods;
+static bool subscribed;
+
+static uint32_t flood_now(void) {
+    return (uint32_t)tim_get_micros();
+}
+
+static void flood_send(jd_flood_t *f, uint32_t num_responses, uint32_t counter) {
+    jd_device_t *dev = jd_device_lookup(f->device_identifier);
+    if (!dev)
+        return;
+    jd_control_flood_ping_t arg = {
+        .num_responses = num_responses, .start_counter = counter, .size = f->cfg.payload_size};
+    jd_service_send_cmd(&dev->services[0], JD_CONTROL_CMD_FLOOD_PING, &arg, sizeof(arg));
+    // don't wait for the end of the tick
+    jd_tx_flush();
+    f->last_send = flood_now();
+}
+
+static void flood_finish(jd_flood_t *f) {
+    if (f->done)
+        return;
+    f->done = 1;
+    // stop any outstanding responses
+    if (f->cfg.mode == JD_FLOOD_MODE_STREAM && f->num_received < f->cfg.count)
+        flood_send(f, 0, 0);
+}
+
+static void flood_ping_next(jd_flood_t *f) {
+    if (f->num_sent >= f->cfg.count) {
+        flood_finish(f);
+        return;
+    }
+    f->next_counter = f->start_counter + f->num_sent;
+    f->num_sent++;
+    flood_send(f, 1, f->next_counter);
+}
+
+static void flood_handle_response(jd_flood_t *f, jd_packet_t *pkt) {
+    uint32_t t = flood_now();
+    uint32_t counter;
+    memcpy(&counter, pkt->data, 4);
+    uint32_t idx = counter - f->start_counter;
+
+    if (pkt->service_size != 4 + f->cfg.payload_size || idx >= f->cfg.count ||
+        (f->received[idx >> 3] & (1 << (idx & 7)))) {
+        f->num_duplicates++;
+        return;
+    }
+
+    f->received[idx >> 3] |= 1 << (idx & 7);
+    uint32_t prev_recv = f->last_recv;
+    f->num_received++;
+    f->bytes_received += pkt->service_size;
+    f->last_recv = t;
+
+    if (f->cfg.mode == JD_FLOOD_MODE_PING) {
+        if (counter != f->next_counter) {
+            // late response to a ping that already timed out
+            return;
+        }
+        f->rtt[f->num_rtt++] = t - f->last_send;
+        flood_ping_next(f);
+    } else {
+        if (f->num_received == 1)
+            f->first_response = t - f->start_time;
+        else
+            f->rtt[f->num_rtt++] = t - prev_recv;
+        if (f->num_received == f->cfg.count)
+            flood_finish(f);
+    }
+}
+
+static void flood_process(jd_flood_t *f) {
+    uint32_t timeout = f->cfg.timeout_ms * 1000;
+    uint32_t t = flood_now();
+    if (f->cfg.mode == JD_FLOOD_MODE_PING) {
+        if (t - f->last_send > timeout)
+            flood_ping_next(f);
+    } else {
+        uint32_t last = f->num_received ? f->last_recv : f->last_send;
+        if (t - last > timeout)
+            flood_finish(f);
+    }
+}
+
+static void flood_event_handler(void *userdata, int event_id, void *arg0, void *arg1) {
+    jd_flood_t *f;
+
+    switch (event_id) {
+    case JD_CLIENT_EV_PROCESS:
+        for (f = floods; f; f = f->next)
+            if (!f->done)
+                flood_process(f);
+        break;
+
+    case JD_CLIENT_EV_SERVICE_PACKET: {
+        jd_device_service_t *serv = arg0;
+        jd_packet_t *pkt = arg1;
+        if (serv->service_index != 0 || pkt->service_command != JD_CONTROL_CMD_FLOOD_PING ||
+            (pkt->flags & JD_FRAME_FLAG_COMMAND) || pkt->service_size < 4)
+            break;
+        for (f = floods; f; f = f->next)
+            if (!f->done && f->device_identifier == pkt->device_identifier)
+                flood_handle_response(f, pkt);
+        break;
+    }
+
+    case JD_CLIENT_EV_DEVICE_DESTROYED: {
+        jd_device_t *dev = arg0;
+        for (f = floods; f; f = f->next)
+            if (f->device_identifier == dev->device_identifier)
+                f->done = 1;
+        break;
+    }
+    }
+}
+
+jd_flood_t *jd_flood_start(uint64_t device_identifier, const jd_flood_cfg_t *cfg) {
+    if (!jd_device_lookup(device_identifier))
+        return NULL;
+
+    JD_ASSERT(cfg->payload_size <= JD_FLOOD_MAX_PAYLOAD);
+    JD_ASSERT(cfg->count > 0);
+
+    if (!subscribed) {
+        subscribed = true;
+        jd_client_subscribe(flood_event_handler, NULL);
+    }
+
+    jd_flood_t *f = jd_alloc(sizeof(jd_flood_t));
+    f->device_identifier = device_identifier;
+    f->cfg = *cfg;
+    if (!f->cfg.timeout_ms)
+        f->cfg.timeout_ms = 100;
+    f->rtt = jd_alloc(sizeof(uint32_t) * cfg->count);
+    f->received = jd_alloc((cfg->count + 7) >> 3);
+    // use fresh counters, so that late responses from previous run are not counted
+    f->start_counter = jd_random() & 0x7fffffff;
+
+    f->next = floods;
+    floods = f;
+
+    f->start_time = flood_now();
+    if (cfg->mode == JD_FLOOD_MODE_PING) {
+        flood_ping_next(f);
+    } else {
+        f->num_sent = cfg->count;
+        flood_send(f, cfg->count, f->start_counter);
+    }
+
+    return f;
+}
+
+bool jd_flood_done(jd_flood_t *f) {
+    return f->done;
+}
+
+// shell sort; the arrays are small and we don't want to depend on qsort()
+static void sort_u32(uint32_t *arr, unsigned n) {
+    for (unsigned gap = n / 2; gap > 0; gap /= 2) {
+        for (unsigned i = gap; i < n; ++i) {
+            uint32_t v = arr[i];
+            unsigned j = i;
+            while (j >= gap && arr[j - gap] > v) {
+                arr[j] = arr[j - gap];
+                j -= gap;
+            }
+            arr[j] = v;
+        }
+    }
+}
+
+static uint32_t percentile(const uint32_t *arr, unsigned n, unsigned p) {
+    return n ? arr[(n - 1) * p / 100] : 0;
+}
+
+void jd_flood_get_stats(jd_flood_t *f, jd_flood_stats_t *st) {
+    memset(st, 0, sizeof(*st));
+    st->num_requested = f->num_sent;
+    st->num_received = f->num_received;
+    if (f->done)
+        st->num_lost = f->num_sent - f->num_received;
+    st->num_duplicates = f->num_duplicates;
+    st->bytes_received = f->bytes_received;
+    if (f->num_received) {
+        st->elapsed_us = f->last_recv - f->start_time;
+        if (st->elapsed_us)
+            st->goodput = (uint64_t)f->bytes_received * 1000000 / st->elapsed_us;
+    }
+    st->first_response_us = f->first_response;
+
+    unsigned n = f->num_rtt;
+    sort_u32(f->rtt, n);
+    if (n) {
+        st->rtt_min = f->rtt[0];
+        st->rtt_max = f->rtt[n - 1];
+    }
+    st->rtt_p50 = percentile(f->rtt, n, 50);
+    st->rtt_p90 = percentile(f->rtt, n, 90);
+    st->rtt_p99 = percentile(f->rtt, n, 99);
+}
+
+void jd_flood_log(jd_flood_t *f) {
+    jd_flood_stats_t st;
+    jd_flood_get_stats(f, &st);
+    char shortid[5];
+    jd_device_short_id(shortid, f->device_identifier);
+    bool ping = f->cfg.mode == JD_FLOOD_MODE_PING;
+    LOG("%s %s sz=%d: %u/%u recv, %u lost, %u dup, %u B/s; %s us min=%u p50=%u p90=%u p99=%u "
+        "max=%u",
+        shortid, ping ? "ping" : "stream", f->cfg.payload_size, (unsigned)st.num_received,
+        (unsigned)st.num_requested, (unsigned)st.num_lost, (unsigned)st.num_duplicates,
+        (unsigned)st.goodput, ping ? "rtt" : "gap", (unsigned)st.rtt_min, (unsigned)st.rtt_p50,
+        (unsigned)st.rtt_p90, (unsigned)st.rtt_p99, (unsigned)st.rtt_max);
+}
+
+void jd_flood_free(jd_flood_t *f) {
+    flood_finish(f);
+    if (floods == f) {
+        floods = f->next;
+    } else {
+        for (jd_flood_t *p = floods; p; p = p->next)
+            if (p->next == f) {
+                p->next = f->next;
+                break;
+            }
+    }
+    jd_free(f->rtt);
+    jd_free(f->received);
+    jd_free(f);
+}
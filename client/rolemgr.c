@@ -144,14 +144,21 @@ unsigned rolemgr_serialized_role_size(jd_role_t *r) {
     return offsetof(jd_role_manager_roles_t, role) + strlen(r->name);
 }
 
-jd_role_manager_roles_t *rolemgr_serialize_role(jd_role_t *r) {
-    jd_role_manager_roles_t *tmp = jd_alloc(rolemgr_serialized_role_size(r));
+void rolemgr_serialize_role_to(jd_role_t *r, jd_role_manager_roles_t *dst) {
     if (r->service) {
-        tmp->device_id = jd_service_parent(r->service)->device_identifier;
-        tmp->service_idx = r->service->service_index;
+        dst->device_id = jd_service_parent(r->service)->device_identifier;
+        dst->service_idx = r->service->service_index;
+    } else {
+        dst->device_id = 0;
+        dst->service_idx = 0;
     }
-    tmp->service_class = r->service_class;
-    memcpy(tmp->role, r->name, strlen(r->name));
+    dst->service_class = r->service_class;
+    memcpy(dst->role, r->name, strlen(r->name));
+}
+
+jd_role_manager_roles_t *rolemgr_serialize_role(jd_role_t *r) {
+    jd_role_manager_roles_t *tmp = jd_alloc(rolemgr_serialized_role_size(r));
+    rolemgr_serialize_role_to(r, tmp);
     return tmp;
 }
 
@@ -177,10 +184,10 @@ void rolemgr_process(srv_t *state) {
             jd_opipe_close(&state->list_pipe);
             break;
         }
-        jd_role_manager_roles_t *tmp = rolemgr_serialize_role(r);
-        err = jd_opipe_write(&state->list_pipe, tmp, sz);
-        JD_ASSERT(err == 0);
-        jd_free(tmp);
+        jd_role_manager_roles_t *dst = jd_opipe_begin_write(&state->list_pipe, sz, sz, NULL);
+        JD_ASSERT(dst != NULL);
+        rolemgr_serialize_role_to(r, dst);
+        jd_opipe_end_write(&state->list_pipe, sz);
 
         state->list_ptr = next_visible(r->_next);
 
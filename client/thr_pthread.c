@@ -2,6 +2,8 @@
 
 #if JD_THR_PTHREAD
 
+#include <time.h>
+
 #define CHK JD_CHK
 
 #pragma region mutexes
@@ -27,6 +29,39 @@ void jd_thr_unlock(jd_mutex_t *mutex) {
 }
 #pragma endregion
 
+#pragma region events
+int jd_thr_init_event(jd_event_t *ev) {
+    jd_thr_init_mutex(&ev->lock);
+    CHK(pthread_cond_init(&ev->cond, NULL));
+    ev->signaled = false;
+    return 0;
+}
+
+void jd_thr_signal_event(jd_event_t *ev) {
+    jd_thr_lock(&ev->lock);
+    ev->signaled = true;
+    pthread_cond_signal(&ev->cond);
+    jd_thr_unlock(&ev->lock);
+}
+
+void jd_thr_wait_event(jd_event_t *ev, unsigned timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    jd_thr_lock(&ev->lock);
+    while (!ev->signaled)
+        if (pthread_cond_timedwait(&ev->cond, &ev->lock, &deadline) != 0)
+            break;
+    ev->signaled = false;
+    jd_thr_unlock(&ev->lock);
+}
+#pragma endregion
+
 jd_thread_t jd_thr_self(void) {
     return pthread_self();
 }
@@ -42,4 +42,90 @@ void jd_free(void *ptr);
 void jd_alloc_stack_check(void);
 void *jd_alloc_emergency_area(uint32_t size);
 
-#endif
\ No newline at end of file
+#if JD_SLAB_ALLOC
+// With JD_SLAB_ALLOC, jd_alloc() and jd_free() are implemented in slab_alloc.c.
+// Blocks up to 512 bytes come from per-size-class free lists (16, 32, ..., 512 bytes),
+// carved out of pages of about JD_SLAB_PAGE_SIZE bytes. Pages and larger blocks
+// are allocated with these functions, which have to be provided instead.
+// jd_heap_alloc() has the same contract as jd_alloc().
+void *jd_heap_alloc(uint32_t size);
+// may be a no-op (with JD_SIMPLE_ALLOC); empty pages are then kept for reuse
+void jd_heap_free(void *ptr);
+
+#define JD_SLAB_NUM_CLASSES 6
+
+typedef struct {
+    uint16_t block_size; // usable bytes
+    uint16_t num_pages;
+    uint32_t num_blocks; // in all pages
+    uint32_t num_used;
+    uint32_t num_allocs;
+} jd_slab_class_stats_t;
+
+typedef struct {
+    jd_slab_class_stats_t classes[JD_SLAB_NUM_CLASSES];
+    uint32_t num_allocs;
+    uint32_t num_frees;
+    uint32_t num_large_allocs; // bigger than the largest class; from jd_heap_alloc()
+    uint32_t num_page_allocs;
+    uint32_t num_page_frees;
+    uint32_t curr_large_bytes; // including headers
+    uint32_t curr_page_bytes;
+    uint32_t max_page_bytes;
+    // totals over all small allocations, to compute internal fragmentation
+    uint32_t total_requested_bytes;
+    uint32_t total_block_bytes;
+} jd_slab_stats_t;
+
+void jd_slab_get_stats(jd_slab_stats_t *dst);
+#endif
+
+#if JD_ALLOC_PROFILE
+// Allocation profiler (alloc_profile.c). jd_alloc() and jd_free() implementations report
+// blocks with JD_ALLOC_PROFILE_ALLOC()/JD_ALLOC_PROFILE_FREE() (the ones in this library do).
+// Blocks are attributed to the call site, i.e., the return address of jd_alloc();
+// use addr2line to map it to source. Note that helpers like jd_sprintf_a() and jd_strdup()
+// show up as call sites themselves.
+// Up to JD_ALLOC_PROFILE_SITES sites and JD_ALLOC_PROFILE_BLOCKS live blocks are tracked;
+// allocations beyond that are only counted in num_untracked.
+typedef struct {
+    uint32_t site; // return address of jd_alloc() (lower 32 bits)
+    uint32_t num_allocs;
+    uint32_t num_frees;
+    uint32_t live_bytes;
+    uint32_t max_live_bytes;
+    uint32_t total_bytes;
+} jd_alloc_site_stats_t;
+
+typedef struct {
+    uint32_t num_allocs;
+    uint32_t num_frees;
+    uint32_t live_bytes;
+    uint32_t max_live_bytes;
+    uint32_t alloc_rate; // allocations per second, over the last second or more
+    uint32_t num_untracked;
+    uint16_t num_sites;
+    uint16_t num_blocks; // currently tracked
+} jd_alloc_profile_t;
+
+void jd_alloc_profile_alloc(void *ptr, uint32_t size, void *site);
+void jd_alloc_profile_free(void *ptr);
+void jd_alloc_profile_get(jd_alloc_profile_t *dst);
+// returns -1 if idx >= num_sites
+int jd_alloc_profile_get_site(unsigned idx, jd_alloc_site_stats_t *dst);
+// prints totals and up to max_sites sites with most live bytes to DMESG
+void jd_alloc_profile_dump(unsigned max_sites);
+
+#define JD_ALLOC_PROFILE_ALLOC(ptr, size)                                                          \
+    jd_alloc_profile_alloc(ptr, size, __builtin_return_address(0))
+#define JD_ALLOC_PROFILE_FREE(ptr) jd_alloc_profile_free(ptr)
+
+// not in the spec; payload: empty to dump to DMESG, or the pipe to write the profile to:
+// jd_alloc_profile_t followed by jd_alloc_site_stats_t for every site, one per packet
+#define JD_CONTROL_CMD_ALLOC_PROFILE 0xf9
+#else
+#define JD_ALLOC_PROFILE_ALLOC(ptr, size) ((void)0)
+#define JD_ALLOC_PROFILE_FREE(ptr) ((void)0)
+#endif
+
+#endif
@@ -15,6 +15,10 @@ int jd_rx_frame_received(jd_frame_t *frame);
 jd_frame_t *jd_rx_get_frame(void);
 void jd_rx_release_frame(jd_frame_t *frame);
 bool jd_rx_has_frame(void);
+#if JD_QUEUE_STATS
+// returns -1 (and zeroes dst) when there is no RX queue
+int jd_rx_queue_stats(jd_queue_stats_t *dst, bool reset);
+#endif
 
 #if JD_CLIENT || JD_BRIDGE
 // this will not forward the frame to the USB bridge
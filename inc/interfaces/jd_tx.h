@@ -14,6 +14,10 @@ void jd_tx_flush(void);
 int jd_tx_is_idle(void);
 jd_frame_t *jd_tx_get_frame(void);
 void jd_tx_frame_sent(jd_frame_t *frame);
+#if JD_BUS_STATS
+// when the frame returned by jd_tx_get_frame() was queued
+uint32_t jd_tx_frame_queued_at(void);
+#endif
 
 int jd_send(unsigned service_num, unsigned service_cmd, const void *data, unsigned service_size);
 
@@ -37,6 +41,18 @@ static inline void jd_send_event(srv_t *srv, uint32_t eventid) {
 }
 void jd_process_event_queue(void);
 
+// events are sent immediately, and then repeated twice from the event queue
+typedef struct {
+    uint32_t num_events;         // jd_send_event*() calls
+    uint32_t num_repeats;        // repetitions sent from the queue
+    uint32_t num_dropped_first;  // queue full; both repetitions were dropped
+    uint32_t num_dropped_second; // queue full; second repetition was dropped
+    uint32_t num_too_long;       // payload too large for JD_EVENT_QUEUE_SIZE; not repeated
+    uint16_t curr_events;        // waiting for repetition
+    uint16_t max_events;
+} jd_event_queue_stats_t;
+void jd_event_queue_get_stats(jd_event_queue_stats_t *dst);
+
 // this is needed for pipes and clients, not regular servers
 // this will send the frame on the wire and on the USB bridge
 int jd_send_frame(jd_frame_t *f);
@@ -45,6 +61,10 @@ int jd_send_frame_raw(jd_frame_t *f);
 
 bool jd_need_to_send(jd_frame_t *f);
 bool jd_tx_will_fit(unsigned size);
+#if JD_QUEUE_STATS
+// returns -1 (and zeroes dst) when there is no send queue
+int jd_tx_queue_stats(jd_queue_stats_t *dst, bool reset);
+#endif
 
 // wrapper around jd_send_frame()
 int jd_send_pkt(jd_packet_t *pkt);
@@ -35,6 +35,11 @@ int jd_usb_pull(uint8_t dst[64]);
 // called by USB stack to process incoming USB data
 void jd_usb_push(const uint8_t *buf, unsigned len);
 
+#if JD_QUEUE_STATS
+// returns -1 (and zeroes dst) when the USB queue is not allocated yet
+int jd_usb_queue_stats(jd_queue_stats_t *dst, bool reset);
+#endif
+
 
 
 #endif
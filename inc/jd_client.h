@@ -152,7 +152,49 @@ void jd_role_force_autobind(void);
 jd_role_t *jd_role_by_service(jd_device_service_t *serv);
 
 unsigned rolemgr_serialized_role_size(jd_role_t *r);
+// dst has to have rolemgr_serialized_role_size(r) bytes
+void rolemgr_serialize_role_to(jd_role_t *r, jd_role_manager_roles_t *dst);
 jd_role_manager_roles_t *rolemgr_serialize_role(jd_role_t *r);
 
 // call from app_init_services()
 void jd_role_manager_init(void);
+
+// flood ping benchmark; uses JD_CONTROL_CMD_FLOOD_PING of the control service
+
+// send a flood ping with num_responses=1, wait for the response, repeat; measures round-trip time
+#define JD_FLOOD_MODE_PING 0
+// ask for all responses at once; measures goodput
+#define JD_FLOOD_MODE_STREAM 1
+
+typedef struct {
+    uint8_t mode;          // JD_FLOOD_MODE_*
+    uint8_t payload_size;  // in addition to 4 byte counter; at most JD_FLOOD_MAX_PAYLOAD
+    uint16_t count;        // number of pings or responses
+    uint16_t timeout_ms;   // per-ping timeout, or maximum delay between responses
+} jd_flood_cfg_t;
+
+#define JD_FLOOD_MAX_PAYLOAD (JD_SERIAL_PAYLOAD_SIZE - 8)
+
+typedef struct {
+    uint32_t num_requested;
+    uint32_t num_received;   // unique responses
+    uint32_t num_lost;       // num_requested - num_received, when done
+    uint32_t num_duplicates; // responses with already seen (or unexpected) counter
+    uint32_t bytes_received; // payload bytes, including counters
+    uint32_t elapsed_us;     // first request to last response
+    uint32_t goodput;        // bytes_received per second
+    uint32_t first_response_us; // first request to first response
+    // round-trip times in us (ping mode), or gaps between consecutive responses (stream mode)
+    uint32_t rtt_min, rtt_p50, rtt_p90, rtt_p99, rtt_max;
+} jd_flood_stats_t;
+
+typedef struct jd_flood jd_flood_t;
+
+// returns NULL if the device is not known (hasn't announced yet)
+jd_flood_t *jd_flood_start(uint64_t device_identifier, const jd_flood_cfg_t *cfg);
+bool jd_flood_done(jd_flood_t *f);
+void jd_flood_get_stats(jd_flood_t *f, jd_flood_stats_t *stats);
+// prints stats to DMESG
+void jd_flood_log(jd_flood_t *f);
+// stops the flood if still running
+void jd_flood_free(jd_flood_t *f);
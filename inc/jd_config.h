@@ -88,6 +88,23 @@
 #define JD_WR_OVERHEAD 8
 #endif
 
+// TX start delay is jd_random_around(JD_TX_BACKOFF_BASE) plus a random spread of up to
+// JD_TX_BACKOFF_SLOT us times the square root of the estimated number of competing nodes
+// (but at most JD_TX_BACKOFF_MAX us). See jd_tx_backoff_delay().
+// JD_TX_BACKOFF_MAX of 0 (the default) disables the spread: in jacdac_backoff the adaptive
+// delay gives more latency and queue drops than the fixed one (see bench/README.md).
+#ifndef JD_TX_BACKOFF_BASE
+#define JD_TX_BACKOFF_BASE 150
+#endif
+
+#ifndef JD_TX_BACKOFF_SLOT
+#define JD_TX_BACKOFF_SLOT 32
+#endif
+
+#ifndef JD_TX_BACKOFF_MAX
+#define JD_TX_BACKOFF_MAX 0
+#endif
+
 #ifndef JD_PHYSICAL
 #define JD_PHYSICAL 1
 #endif
@@ -193,6 +210,8 @@ int jd_net_send_frame(void *frame);
 #define JD_VERBOSE_ASSERT (JD_CLIENT || JD_LORA || JD_64)
 #endif
 
+// %f and jd_print_double()/jd_print_float() use Ryu-based formatting (source/jd_dtoa.c); this
+// costs every such build (clients, LORA, 64-bit) about 5 KB of text (-Os, x86-64).
 #ifndef JD_ADVANCED_STRING
 #define JD_ADVANCED_STRING (JD_CLIENT || JD_LORA || JD_64)
 #endif
@@ -274,6 +293,36 @@ int jd_net_send_frame(void *frame);
 #define JD_GC_KB 64
 #endif
 
+// Implement jd_alloc()/jd_free() with size-class free lists on top of jd_heap_alloc();
+// see jd_alloc.h
+#ifndef JD_SLAB_ALLOC
+#define JD_SLAB_ALLOC 0
+#endif
+
+// approximate size of pages the size classes are carved from
+#ifndef JD_SLAB_PAGE_SIZE
+#define JD_SLAB_PAGE_SIZE 1024
+#endif
+
+// size of the per-tick scratch arena (jd_scratch_alloc()), allocated on first use
+#ifndef JD_SCRATCH_SIZE
+#define JD_SCRATCH_SIZE 256
+#endif
+
+// Record allocations per call site; see jd_alloc.h
+#ifndef JD_ALLOC_PROFILE
+#define JD_ALLOC_PROFILE 0
+#endif
+
+// number of call sites and live blocks tracked by JD_ALLOC_PROFILE (the latter a power of 2)
+#ifndef JD_ALLOC_PROFILE_SITES
+#define JD_ALLOC_PROFILE_SITES 64
+#endif
+
+#ifndef JD_ALLOC_PROFILE_BLOCKS
+#define JD_ALLOC_PROFILE_BLOCKS 512
+#endif
+
 #ifndef JD_AES_SOFT
 #define JD_AES_SOFT 1
 #endif
@@ -334,6 +383,53 @@ int jd_net_send_frame(void *frame);
 #define JD_DMESG_LINE_BUFFER (JD_ADVANCED_STRING ? 160 : 80)
 #endif
 
+// Store format string pointer and raw arguments in the DMESG buffer, and only format
+// them when reading; see jd_dmesg.h
+// This makes logging cheaper, but every record has a 12 byte header (16 on 64-bit), and
+// string arguments are copied unless JD_DMESG_STATIC_PTR() is defined, so the buffer often
+// keeps less history. Formatted text kept in a 4K buffer on the host: 5K for the jacdac_bench
+// message (long format, integer arguments), 1.2K for "x=%d", 2.9K for "%s: %s" with 20-30 byte
+// strings (3.7K when one is in JD_DMESG_STATIC_PTR()). Only enable it where most messages
+// are of the first kind, or logging time matters more than history.
+#ifndef JD_DMESG_BINARY
+#define JD_DMESG_BINARY 0
+#endif
+
+// With JD_DMESG_BINARY, whether string argument 'p' never changes (eg., it's in flash),
+// so that it can be referenced instead of copied; for example ((uintptr_t)(p) < 0x20000000)
+// on Cortex-M parts where there is no RAM below 0x20000000 (it's not the case with the CCM RAM
+// of STM32F4 at 0x10000000, where stack buffers can be).
+#ifndef JD_DMESG_STATIC_PTR
+#define JD_DMESG_STATIC_PTR(p) 0
+#endif
+
+// Let threads write text DMESG concurrently, reserving space with atomics instead of
+// target_disable_irq(); JD_DMESG_BUFFER_SIZE has to be a power of 2, the text isn't followed
+// by '\0', and jd_dmesg_read*() may return garbage if writers overtake the reader
+#ifndef JD_DMESG_LOCK_FREE
+#define JD_DMESG_LOCK_FREE 0
+#endif
+
+// With JD_DMESG_LOCK_FREE, how many messages can be written at once; further ones are dropped
+#ifndef JD_DMESG_SLOTS
+#define JD_DMESG_SLOTS 16
+#endif
+
+// Log lines of the logger service (jdcon_log() etc.) wait in a ring of this size, and are sent
+// several per packet, at most JD_LOGGER_BYTES_PER_SECOND bytes of text per second
+#ifndef JD_LOGGER_BUFFER_SIZE
+#define JD_LOGGER_BUFFER_SIZE 256
+#endif
+
+#ifndef JD_LOGGER_BYTES_PER_SECOND
+#define JD_LOGGER_BYTES_PER_SECOND 1024
+#endif
+
+// Whether a client can have the logger service stream lines to it through a pipe
+#ifndef JD_LOGGER_PIPE
+#define JD_LOGGER_PIPE JD_PIPES
+#endif
+
 #ifndef JD_FAST
 #define JD_FAST /* */
 #endif
@@ -350,6 +446,12 @@ int jd_net_send_frame(void *frame);
 #define JD_MAX_SERVICES 32
 #endif
 
+// Reserve service state and the service table at link time, instead of allocating them
+// in jd_services_init(); see jd_service_framework.h
+#ifndef JD_STATIC_SERVICES
+#define JD_STATIC_SERVICES 0
+#endif
+
 // hosted means running on a desktop-like machine (either native or with WASM)
 #ifndef JD_HOSTED
 #define JD_HOSTED (!JD_PHYSICAL)
@@ -375,5 +477,69 @@ int jd_net_send_frame(void *frame);
 #define JD_SPI 0
 #endif
 
+// record all frames received and sent; see jd_trace.h
+#ifndef JD_TRACE
+#define JD_TRACE 0
+#endif
+
+#ifndef JD_TRACE_BUFFER_SIZE
+#define JD_TRACE_BUFFER_SIZE 4096
+#endif
+
+#ifndef JD_TRACE_LSTORE
+#define JD_TRACE_LSTORE (JD_TRACE && JD_LSTORE)
+#endif
+
+// per-service main loop CPU time accounting; see jd_profile.h
+#ifndef JD_PROFILE
+#define JD_PROFILE 0
+#endif
+
+// high-water marks, occupancy and dwell time histograms for jd_queue_t and jd_bqueue_t
+#ifndef JD_QUEUE_STATS
+#define JD_QUEUE_STATS 0
+#endif
+
+// bus utilization and timing telemetry in jd_physical.c; see jd_get_bus_stats()
+// (this also keeps push timestamps in jd_queue_t, like JD_QUEUE_STATS)
+#ifndef JD_BUS_STATS
+#define JD_BUS_STATS 0
+#endif
+
+// max. frames in flight per output pipe; 0 is stop-and-wait; requires JD_OPIPE_FRAME_POOL
+// (it is go-back-N, and slower than stop-and-wait above 1-5% frame loss; see jd_pipes.h)
+#ifndef JD_OPIPE_WINDOW
+#define JD_OPIPE_WINDOW 0
+#endif
+
+// number of frames shared by all output pipes; 0 embeds a frame in every jd_opipe_desc_t
+#ifndef JD_OPIPE_FRAME_POOL
+#define JD_OPIPE_FRAME_POOL (JD_OPIPE_WINDOW ? JD_OPIPE_WINDOW + 1 : 0)
+#endif
+
+// RTT-adaptive retransmission timeouts and counters in output pipes; see jd_opipe_get_stats()
+// This adds around 50 bytes to every jd_opipe_desc_t; without it, the timeout is 8ms,
+// doubled with every retry.
+#ifndef JD_OPIPE_STATS
+#define JD_OPIPE_STATS 0
+#endif
+
+// with JD_OPIPE_STATS, retransmission timeout before the first RTT sample, and its bounds (in us)
+#ifndef JD_OPIPE_RTO_INIT
+#define JD_OPIPE_RTO_INIT 8192
+#endif
 
-#endif
\ No newline at end of file
+#ifndef JD_OPIPE_RTO_MIN
+#define JD_OPIPE_RTO_MIN 2048
+#endif
+
+#ifndef JD_OPIPE_RTO_MAX
+#define JD_OPIPE_RTO_MAX (256 * 1024)
+#endif
+
+// number of out-of-order packets buffered, shared by all input pipes; 0 drops them
+#ifndef JD_IPIPE_REORDER
+#define JD_IPIPE_REORDER 0
+#endif
+
+#endif
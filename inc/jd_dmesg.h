@@ -8,11 +8,13 @@
 
 #if JD_DMESG_BUFFER_SIZE > 0
 
+#if !JD_DMESG_BINARY
 struct CodalLogStore {
     volatile uint32_t ptr;
     char buffer[JD_DMESG_BUFFER_SIZE];
 };
 extern struct CodalLogStore codalLogStore;
+#endif
 
 __attribute__((format(printf, 1, 2))) void jd_dmesg(const char *format, ...);
 void jd_vdmesg(const char *format, va_list ap);
@@ -24,9 +26,34 @@ unsigned jd_dmesg_read(void *dst, unsigned space, uint32_t *state);
 unsigned jd_dmesg_read_line(void *dst, unsigned space, uint32_t *state);
 // get the oldest possible starting point (for *state above)
 uint32_t jd_dmesg_startptr(void);
+
+#if JD_DMESG_BINARY
+// With JD_DMESG_BINARY, jd_dmesg() stores a record with the format string pointer, a timestamp
+// and the arguments (strings are copied, unless JD_DMESG_STATIC_PTR()), and the text
+// is only formatted by jd_dmesg_read*(). Format strings have to be string literals.
+// *state is the sequence number of the next record (lower 24 bits), and the offset
+// in its text (upper 8 bits).
+// Arguments follow the header, each padded to 4 bytes: integers (and %c) as int,
+// %p as pointer, %f as double, %s as uint32_t length followed by the characters
+// (or 0xffffffff and a pointer), and %*p as uint32_t length followed by the bytes.
+typedef struct {
+    uint16_t size;     // of the record, including header; 0 marks padding at the end of buffer
+    uint8_t num_args;  // arguments stored; formatting stops at the next one
+    uint8_t flags;     // JD_DMESG_RECORD_TEXT: the arguments are text from jd_dmesg_write()
+    uint32_t timestamp; // value of now
+    const char *format;
+    uint8_t args[0];
+} jd_dmesg_record_t;
+#define JD_DMESG_RECORD_TEXT 0x01
+
+uint32_t jd_dmesg_currptr(void);
+// copies whole records, starting at *state (the offset in text is ignored)
+unsigned jd_dmesg_read_raw(void *dst, unsigned space, uint32_t *state);
+#else
 static inline uint32_t jd_dmesg_currptr(void) {
     return codalLogStore.ptr;
 }
+#endif
 
 #ifndef DMESG
 #define DMESG jd_dmesg
@@ -101,6 +101,30 @@ void jd_line_falling(void);
 int jd_is_running(void);
 int jd_is_busy(void);
 
+// queue instrumentation, with JD_QUEUE_STATS
+#define JD_QUEUE_HIST_BUCKETS 16
+typedef struct {
+    uint16_t size;           // capacity in bytes
+    uint16_t curr_bytes;     // currently occupied bytes
+    uint16_t curr_frames;    // always 0 for jd_bqueue_t
+    uint16_t max_bytes;      // high-water mark
+    uint16_t max_frames;
+    uint16_t reserved;
+    uint32_t num_pushed;
+    uint32_t num_dropped;    // push failed due to queue being full
+    uint32_t num_shifted;    // jd_queue_t only
+    uint32_t dwell_total_us; // push->shift time; jd_queue_t only
+    uint32_t dwell_max_us;
+    // bucket 0 is value 0; bucket N (N>0) is 2^(N-1) <= value < 2^N; the last bucket is open
+    uint32_t occupancy_hist[JD_QUEUE_HIST_BUCKETS]; // curr_bytes after each push
+    uint32_t dwell_hist[JD_QUEUE_HIST_BUCKETS];     // us
+} jd_queue_stats_t;
+
+static inline unsigned jd_queue_hist_bucket(uint32_t v) {
+    unsigned r = v ? 32 - __builtin_clz(v) : 0;
+    return r >= JD_QUEUE_HIST_BUCKETS ? JD_QUEUE_HIST_BUCKETS - 1 : r;
+}
+
 typedef struct {
     uint32_t bus_state;
     uint32_t bus_lo_error;
@@ -109,9 +133,43 @@ typedef struct {
     uint32_t packets_sent;
     uint32_t packets_received;
     uint32_t packets_dropped;
+#if JD_QUEUE_STATS
+    // snapshots taken by jd_get_diagnostics()
+    jd_queue_stats_t send_queue;
+    jd_queue_stats_t rx_queue;
+    jd_queue_stats_t usb_queue;
+#endif
 } jd_diagnostics_t;
 jd_diagnostics_t *jd_get_diagnostics(void);
 
+// bus telemetry, with JD_BUS_STATS
+typedef struct {
+    uint32_t duration_us;         // length of the window
+    uint32_t busy_us;             // line busy with RX or TX; utilization is busy_us / duration_us
+    uint32_t rx_frames;           // frames received, including broken ones
+    uint32_t rx_queued;           // correctly received frames pushed to the RX queue
+    uint32_t rx_bytes;            // bytes in these
+    uint32_t rx_errors;           // timeouts, UART and CRC errors
+    uint32_t tx_frames;           // frames successfully started
+    uint32_t tx_bytes;            // bytes in these
+    uint32_t tx_races;            // uart_start_tx() lost the line to another device
+    // from frame queued for TX to successful uart_start_tx(); per tx_frames
+    uint32_t tx_wait_total_us;
+    uint32_t tx_wait_max_us;      // max of the above
+    // time spent in jd_rx_completed() on CRC check and push to the RX queue; per rx_queued;
+    // this doesn't include the time the frame then waits in the queue
+    uint32_t rx_handling_total_us;
+    uint32_t rx_handling_max_us; // max of the above
+} jd_bus_stats_t;
+
+#if JD_BUS_STATS
+// not in the spec; read-only: last second and last minute jd_bus_stats_t
+#define JD_CONTROL_REG_BUS_STATS 0x1f9
+// Stats are collected in consecutive one-second windows; these are also summed up
+// into one-minute windows. Either argument can be NULL.
+void jd_get_bus_stats(jd_bus_stats_t *last_second, jd_bus_stats_t *last_minute);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
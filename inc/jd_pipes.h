@@ -11,7 +11,38 @@
 
 #define JD_OPIPE_MAX_RETRIES 4
 
-// note that this is around 260 bytes
+#if JD_OPIPE_STATS
+// Retransmission timeout (RTO) is computed from smoothed round-trip time (send to CRC-ACK)
+// and its variation, as in TCP; see JD_OPIPE_RTO_* in jd_config.h.
+// It's doubled on every timeout and TX queue overflow, until a new RTT sample comes in.
+typedef struct {
+    uint32_t srtt;   // smoothed RTT in us; 0 until first sample
+    uint32_t rttvar; // RTT variation in us
+    uint32_t rto;    // in us, before backoff
+    uint32_t rtt_min;
+    uint32_t rtt_max;
+    uint32_t num_samples;
+    uint32_t num_frames; // not counting retransmissions
+    uint32_t num_retransmits;
+    uint32_t num_timeouts;
+    uint32_t num_tx_overflows;
+    uint32_t num_pool_waits; // JD_PIPE_TRY_AGAIN due to empty JD_OPIPE_FRAME_POOL
+    uint8_t backoff; // RTO is currently multiplied by 1 << backoff
+    uint8_t reserved[3];
+} jd_opipe_stats_t;
+#endif
+
+// note that this is around 270 bytes, unless JD_OPIPE_FRAME_POOL is set;
+// then it's around 32 bytes, and frames are borrowed from the pool while data is pending
+// or waiting for ACK; writes return JD_PIPE_TRY_AGAIN when the pool is empty
+// with JD_OPIPE_WINDOW, up to that many frames per pipe are in flight; this is go-back-N:
+// only the ACK of the oldest frame is taken, and on its timeout the whole window is re-sent.
+// Per-frame ACKs can't be used, since the receiver sends the CRC-ACK also for frames its
+// input pipe then drops (out of order, or with a full JD_IPIPE_REORDER buffer).
+// In bench/jacdac_pipe_win, the window is faster than stop-and-wait only below about 1% frame
+// loss when the receiver ACKs within 100us (by ~5%), and below about 5% loss when it needs 2ms
+// (by up to 75%); at 5% loss and a fast receiver, it's up to 2x slower.
+// JD_OPIPE_STATS adds around 50 bytes
 typedef struct jd_opipe_desc {
     // don't access members directly
     struct jd_opipe_desc *next;
@@ -19,7 +50,19 @@ typedef struct jd_opipe_desc {
     uint8_t status;
     uint8_t curr_retry;
     uint32_t retry_time;
+#if JD_OPIPE_FRAME_POOL
+    uint8_t head_seq; // oldest frame in flight
+    uint8_t next_seq; // frame being filled
+    uint64_t device_identifier;
+#elif JD_OPIPE_STATS
+    uint32_t sent_time; // first transmission of frame
+#endif
+#if JD_OPIPE_STATS
+    jd_opipe_stats_t stats;
+#endif
+#if !JD_OPIPE_FRAME_POOL
     jd_frame_t frame;
+#endif
 } jd_opipe_desc_t;
 
 int jd_opipe_open(jd_opipe_desc_t *str, uint64_t device_id, uint16_t port_num);
@@ -32,10 +75,21 @@ int jd_opipe_open_report(jd_opipe_desc_t *str, jd_packet_t *report_pkt);
 int jd_opipe_check_space(jd_opipe_desc_t *str, unsigned len);
 int jd_opipe_write(jd_opipe_desc_t *str, const void *data, unsigned len);
 int jd_opipe_write_meta(jd_opipe_desc_t *str, const void *data, unsigned len);
+// Zero-copy write: returns pointer to space for the data of the next packet, directly in the
+// pending frame, or NULL if jd_opipe_check_space(str, min) isn't JD_PIPE_OK.
+// The space is at least min and at most max bytes; the actual size is stored in *size (if given).
+// Serialize the data there, and call jd_opipe_end_write() with the number of bytes used,
+// before any other call on the pipe and before returning to the main loop.
+void *jd_opipe_begin_write(jd_opipe_desc_t *str, unsigned min, unsigned max, unsigned *size);
+int jd_opipe_end_write(jd_opipe_desc_t *str, unsigned used);
 // flush is automatic when buffer full, or on close
 int jd_opipe_flush(jd_opipe_desc_t *str);
 // it's OK to closed a closed stream
 int jd_opipe_close(jd_opipe_desc_t *str);
+#if JD_OPIPE_STATS
+// stats are reset on open, and kept after close
+void jd_opipe_get_stats(jd_opipe_desc_t *str, jd_opipe_stats_t *dst);
+#endif
 
 // the be called from top-level
 void jd_opipe_handle_packet(jd_packet_t *pkt);
@@ -45,6 +99,16 @@ void jd_opipe_process(void);
 // Input pipes (data flowing to this device)
 //
 
+typedef struct {
+    uint32_t num_packets;    // delivered to handlers
+    uint32_t num_duplicates; // already delivered or buffered
+    uint32_t num_gaps;       // packet arrived while an earlier one was missing
+    uint32_t num_reordered;  // delivered from the reorder buffer
+    uint32_t num_dropped;    // out-of-order, and no free slot in the reorder buffer
+} jd_ipipe_stats_t;
+
+// With JD_IPIPE_REORDER, packets arriving ahead of a missing one are kept in a buffer shared
+// by all input pipes, and delivered in order once the missing packet arrives.
 typedef struct jd_ipipe_desc jd_ipipe_desc_t;
 typedef void (*jd_ipipe_handler_t)(jd_ipipe_desc_t *istr, jd_packet_t *pkt);
 struct jd_ipipe_desc {
@@ -52,8 +116,11 @@ struct jd_ipipe_desc {
     jd_ipipe_handler_t meta_handler;
     struct jd_ipipe_desc *next;
     uint16_t counter;
+    jd_ipipe_stats_t stats;
 };
 int jd_ipipe_open(jd_ipipe_desc_t *str, jd_ipipe_handler_t handler,
                   jd_ipipe_handler_t meta_handler);
 void jd_ipipe_close(jd_ipipe_desc_t *str);
+// stats are reset on open, and kept after close
+void jd_ipipe_get_stats(jd_ipipe_desc_t *str, jd_ipipe_stats_t *dst);
 void jd_ipipe_handle_packet(jd_packet_t *pkt);
@@ -0,0 +1,93 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+#ifndef JD_PROFILE_H
+#define JD_PROFILE_H
+
+#include "jd_physical.h"
+
+/*
+ * Main loop CPU time accounting.
+ *
+ * When JD_PROFILE is enabled, jd_services_tick() and jd_services_handle_packet() measure
+ * time spent in each service's process() and handle_pkt(), and in the other phases of
+ * the main loop (event queue, pipes, lstore, USB, ...).
+ * For every entry, the total time, maximal time of a single call, and number of calls is kept.
+ *
+ * Time is measured with JD_PROFILE_TICKS(), which defaults to tim_get_micros().
+ * Ports can define it to use a cycle counter (eg. DWT->CYCCNT on Cortex-M3+)
+ * and set JD_PROFILE_TICKS_PER_US accordingly.
+ * Time spent in jd_services_sleep_us() is included in the sleeping service's process().
+ *
+ * The stats can be dumped to DMESG with jd_profile_dump(), or read over the bus
+ * from the control service (JD_CONTROL_REG_PROFILE, JD_CONTROL_CMD_PROFILE).
+ */
+
+#ifndef JD_PROFILE_TICKS
+#define JD_PROFILE_TICKS() ((uint32_t)tim_get_micros())
+#endif
+
+#ifndef JD_PROFILE_TICKS_PER_US
+#define JD_PROFILE_TICKS_PER_US 1
+#endif
+
+// not in the spec; read-only: jd_profile_report_t followed by as many entries as fit
+#define JD_CONTROL_REG_PROFILE 0x1f8
+// payload: optional uint8_t JD_PROFILE_CMD_FLAG_*
+#define JD_CONTROL_CMD_PROFILE 0xf8
+#define JD_PROFILE_CMD_FLAG_DUMP 0x01
+#define JD_PROFILE_CMD_FLAG_RESET 0x02
+
+#define JD_PROFILE_EVENT_QUEUE 0
+#define JD_PROFILE_STATUS 1
+#define JD_PROFILE_OPIPE 2
+#define JD_PROFILE_CLIENT 3
+#define JD_PROFILE_TRACE 4
+#define JD_PROFILE_LSTORE 5
+#define JD_PROFILE_USB 6
+#define JD_PROFILE_WIFI 7
+#define JD_PROFILE_APP 8    // app_process()
+#define JD_PROFILE_ROUTING 9 // pipes, client and jd_app_handle_packet() in handle_packet()
+#define JD_PROFILE_NUM_PHASES 10
+
+// entries for services follow the phases
+#define JD_PROFILE_SERVICE_PROCESS(idx) (JD_PROFILE_NUM_PHASES + 2 * (idx))
+#define JD_PROFILE_SERVICE_PACKET(idx) (JD_PROFILE_NUM_PHASES + 2 * (idx) + 1)
+
+typedef struct {
+    uint32_t total; // in JD_PROFILE_TICKS() units
+    uint32_t max;
+    uint32_t calls;
+} jd_profile_entry_t;
+
+typedef struct {
+    uint8_t num_phases;
+    uint8_t num_services;
+    uint16_t ticks_per_us;
+    uint32_t elapsed; // ticks since last reset
+    jd_profile_entry_t entries[0];
+} jd_profile_report_t;
+
+#if JD_PROFILE
+// called by jd_services_init()
+void jd_profile_init(unsigned num_services);
+void jd_profile_add(unsigned entry, uint32_t start);
+void jd_profile_reset(void);
+void jd_profile_dump(void);
+unsigned jd_profile_num_entries(void);
+// NULL if out of range
+jd_profile_entry_t *jd_profile_get(unsigned entry);
+// fills dst with report header and entries; returns number of bytes written
+unsigned jd_profile_report(jd_profile_report_t *dst, unsigned size);
+
+#define JD_PROFILE_RUN(entry, call)                                                                \
+    do {                                                                                           \
+        uint32_t _jd_prof_t0 = JD_PROFILE_TICKS();                                                 \
+        call;                                                                                      \
+        jd_profile_add(entry, _jd_prof_t0);                                                        \
+    } while (0)
+#else
+#define JD_PROFILE_RUN(entry, call) call
+#endif
+
+#endif
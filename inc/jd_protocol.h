@@ -11,6 +11,8 @@
 #include "jd_util.h"
 #include "jd_io.h"
 #include "jd_dmesg.h"
+#include "jd_trace.h"
+#include "jd_profile.h"
 #include "interfaces/jd_tx.h"
 #include "interfaces/jd_rx.h"
 #include "interfaces/jd_hw.h"
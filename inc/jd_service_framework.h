@@ -183,7 +183,7 @@ uint32_t app_get_device_class(void);
 const char *app_get_fw_version(void);
 const char *app_get_dev_class_name(void);
 
-#define SRV_DEF_SZ(id, service_cls, sz)                                                            \
+#define _SRV_DEF_VT(id, service_cls, sz)                                                           \
     static const srv_vt_t id##_vt = {                                                              \
         .service_class = service_cls,                                                              \
         .state_size = sz,                                                                          \
@@ -191,13 +191,27 @@ const char *app_get_dev_class_name(void);
         .handle_pkt = id##_handle_packet,                                                          \
     }
 
-#define SRV_DEF(id, service_cls)                                                                   \
-    static const srv_vt_t id##_vt = {                                                              \
-        .service_class = service_cls,                                                              \
-        .state_size = sizeof(srv_t),                                                               \
-        .process = id##_process,                                                                   \
-        .handle_pkt = id##_handle_packet,                                                          \
-    }
+#if JD_STATIC_SERVICES
+// With JD_STATIC_SERVICES, SRV_DEF*() also reserve state for one instance of the service
+// at link time, and register it in the 'jd_srv' linker section. jd_allocate_service() uses
+// it for the first instance; further instances, and services with vtables built at runtime
+// (from DCFG), are allocated with jd_alloc().
+// GNU ld provides __start_jd_srv/__stop_jd_srv; custom linker scripts need KEEP(*(jd_srv)).
+typedef struct {
+    const srv_vt_t *vt;
+    void *storage;
+} jd_srv_static_t;
+
+#define SRV_DEF_SZ(id, service_cls, sz)                                                            \
+    _SRV_DEF_VT(id, service_cls, sz);                                                              \
+    static uint8_t id##_storage[sz] __attribute__((aligned(8)));                                   \
+    static const jd_srv_static_t id##_static __attribute__((section("jd_srv"), used)) = {         \
+        &id##_vt, id##_storage}
+#else
+#define SRV_DEF_SZ(id, service_cls, sz) _SRV_DEF_VT(id, service_cls, sz)
+#endif
+
+#define SRV_DEF(id, service_cls) SRV_DEF_SZ(id, service_cls, sizeof(srv_t))
 
 #define SRV_ALLOC(id)                                                                              \
     srv_t *state = jd_allocate_service(&id##_vt);                                                  \
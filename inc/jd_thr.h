@@ -11,6 +11,11 @@
 #include <pthread.h>
 typedef pthread_mutex_t jd_mutex_t;
 typedef pthread_t jd_thread_t;
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool signaled;
+} jd_event_t;
 
 #elif JD_THR_AZURE_RTOS
 #error "TODO"
@@ -39,6 +44,12 @@ void jd_thr_destroy_mutex(jd_mutex_t *mutex);
 void jd_thr_lock(jd_mutex_t *mutex);
 void jd_thr_unlock(jd_mutex_t *mutex);
 
+// auto-reset event: jd_thr_wait_event() returns when jd_thr_signal_event() was called since
+// it last returned, or after timeout_ms
+int jd_thr_init_event(jd_event_t *ev);
+void jd_thr_signal_event(jd_event_t *ev);
+void jd_thr_wait_event(jd_event_t *ev, unsigned timeout_ms);
+
 jd_thread_t jd_thr_self(void);
 void jd_thr_suspend_self(void);
 void jd_thr_resume(jd_thread_t t);
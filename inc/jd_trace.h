@@ -0,0 +1,52 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+#ifndef JD_TRACE_H
+#define JD_TRACE_H
+
+#include "jd_physical.h"
+
+/*
+ * Bus trace capture.
+ *
+ * When JD_TRACE is enabled, every frame passing through jd_rx_frame_received() and
+ * jd_send_frame_raw() is recorded in a binary trace, which can be later replayed
+ * (see bench/bench_replay.c).
+ *
+ * The trace is a sequence of records, each being jd_trace_record_t followed by
+ * JD_FRAME_SIZE(frame) bytes of the frame. There is no padding.
+ *
+ * Records are first placed in a RAM buffer (JD_TRACE_BUFFER_SIZE), which is safe to do from IRQ.
+ * With JD_TRACE_LSTORE, they are then moved to lstore file 0, as JD_LSTORE_TYPE_JD_FRAME_TRACE
+ * entries (split with jd_lstore_append_frag()). Otherwise, they can be pulled with
+ * jd_trace_read(), eg. to be sent over USB serial or written to a file on hosted builds.
+ */
+
+#define JD_TRACE_FLAG_TX 0x01       // frame was sent by us (otherwise received)
+#define JD_TRACE_FLAG_DROPPED 0x02  // queue was full, and the frame was dropped
+#define JD_TRACE_FLAG_OVERFLOW 0x04 // some records before this one were lost
+
+typedef struct {
+    uint32_t timestamp; // lower 32 bits of tim_get_micros()
+    uint8_t flags;      // JD_TRACE_FLAG_*
+} __attribute__((packed)) jd_trace_record_t;
+
+#define JD_TRACE_RECORD_HEADER_SIZE 5
+
+#if JD_TRACE
+void jd_trace_init(void);
+// start/stop recording; the trace is not cleared by stopping
+void jd_trace_enable(bool en);
+void jd_trace_frame(jd_frame_t *frame, unsigned flags);
+// drains the RAM buffer to lstore (when enabled); called from jd_services_tick()
+void jd_trace_process(void);
+// pull raw trace data; returns number of bytes read
+unsigned jd_trace_read(void *dst, unsigned size);
+// number of records lost due to RAM buffer being full
+uint32_t jd_trace_num_lost(void);
+#define JD_TRACE_FRAME(frame, flags) jd_trace_frame(frame, flags)
+#else
+#define JD_TRACE_FRAME(frame, flags) ((void)0)
+#endif
+
+#endif
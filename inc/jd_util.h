@@ -10,6 +10,17 @@
 uint64_t jd_device_id(void);
 
 uint32_t jd_random_around(uint32_t v);
+
+// TX backoff state; the number of competing nodes is estimated from the number of
+// TX attempts lost (uart_start_tx() races, or line already busy) between transmissions
+typedef struct {
+    uint16_t contention; // moving average of attempts lost per transmission, 4 fractional bits
+    uint8_t lost;        // attempts lost since last successful transmission
+} jd_tx_backoff_t;
+void jd_tx_backoff_lost(jd_tx_backoff_t *b);
+void jd_tx_backoff_won(jd_tx_backoff_t *b);
+// delay (in us) before next TX attempt; see JD_TX_BACKOFF_*
+uint32_t jd_tx_backoff_delay(jd_tx_backoff_t *b);
 uint32_t jd_random(void);
 void jd_seed_random(uint32_t s);
 uint32_t jd_hash_fnv1a(const void *data, unsigned len);
@@ -69,8 +80,12 @@ void jd_to_hex(char *dst, const void *src, size_t len);
 int jd_from_hex(void *dst, const char *src);
 
 #if JD_ADVANCED_STRING
-// buf is 64 bytes long
+// jd_dtoa.c; buf is 64 bytes long
+// Prints the shortest string that reads back as d, in e-notation outside of 1e-6 -- 1e21;
+// numdigits > 0 limits the number of significant digits.
 void jd_print_double(char *buf, double d, int numdigits);
+// Same, but the string reads back as f when parsed as a float (so 0.1f prints as "0.1").
+void jd_print_float(char *buf, float f, int numdigits);
 int jd_vsprintf_ext(char *dst, unsigned dstsize, const char *format, unsigned *ulen, va_list ap);
 #endif
 
@@ -133,6 +148,16 @@ void jd_queue_shift(jd_queue_t q);
 void jd_queue_test(void);
 int jd_queue_will_fit(jd_queue_t q, unsigned size);
 void jd_queue_clear(jd_queue_t q);
+#if JD_QUEUE_STATS || JD_BUS_STATS
+// when jd_queue_front() was pushed; the queue must not be empty
+uint32_t jd_queue_front_time(jd_queue_t q);
+#endif
+#if JD_QUEUE_STATS
+// snapshot; can be called with IRQs enabled
+void jd_queue_get_stats(jd_queue_t q, jd_queue_stats_t *dst);
+// resets counters, histograms and high-water marks (but not current occupancy)
+void jd_queue_reset_stats(jd_queue_t q);
+#endif
 
 // jd_bqueue.c
 typedef struct jd_bqueue *jd_bqueue_t;
@@ -153,6 +178,28 @@ uint8_t *jd_bqueue_cont_data_ptr(jd_bqueue_t q);
 void jd_bqueue_cont_data_advance(jd_bqueue_t q, unsigned sz);
 void jd_bqueue_print(jd_bqueue_t q, void (*print_fn)(char ch));
 void jd_bqueue_clear(jd_bqueue_t q);
+#if JD_QUEUE_STATS
+void jd_bqueue_get_stats(jd_bqueue_t q, jd_queue_stats_t *dst);
+void jd_bqueue_reset_stats(jd_bqueue_t q);
+#endif
+
+// jd_scratch.c
+// Memory returned by these is valid until the end of the current jd_process_everything();
+// it doesn't need to be freed, and must not be passed to jd_free() (or used with %-s).
+// When the JD_SCRATCH_SIZE arena is full, blocks come from jd_alloc() and are freed on reset
+// (without JD_FREE_SUPPORTED, this panics). Not to be used from IRQ handlers.
+typedef struct {
+    uint32_t num_allocs;
+    uint32_t num_overflows; // allocations that didn't fit in the arena
+    uint32_t max_used;      // bytes requested in one tick, including overflows
+} jd_scratch_stats_t;
+void *jd_scratch_alloc(unsigned size);
+char *jd_scratch_vsprintf(const char *format, va_list ap);
+__attribute__((format(printf, 1, 2))) char *jd_scratch_sprintf(const char *format, ...);
+char *jd_scratch_to_hex(const void *src, size_t len);
+// called at the end of jd_process_everything()
+void jd_scratch_reset(void);
+void jd_scratch_get_stats(jd_scratch_stats_t *dst);
 
 void jd_utoa(unsigned k, char *s);
 void jd_itoa(int n, char *s);
@@ -10,4 +10,8 @@ void jdcon_logv(int level, const char *format, va_list ap);
 void jdcon_log(const char *format, ...);
 void jdcon_warn(const char *format, ...);
 
+// not in the spec; payload: the pipe to send log lines to, instead of broadcasting them;
+// every pipe packet is the priority byte followed by one or more lines separated by '\n'
+#define JD_LOGGER_CMD_STREAM 0xf8
+
 #endif
\ No newline at end of file
@@ -5,9 +5,36 @@
 #include "jd_console.h"
 #include "jacdac/dist/c/logger.h"
 
+#if JD_LOGGER_PIPE
+#include "jd_pipes.h"
+#endif
+
+// longer lines are truncated
+#define LOG_LINE_MAX 100
+// lines of the same priority are sent together, separated by '\n'
+#define PACKET_MAX (JD_SERIAL_PAYLOAD_SIZE - 4)
+#define NO_LINE 0xff
+
+STATIC_ASSERT(JD_LOGGER_BYTES_PER_SECOND >= LOG_LINE_MAX);
+STATIC_ASSERT(JD_LOGGER_BUFFER_SIZE >= LOG_LINE_MAX + 2);
+
+// Lines are kept in the queue as: priority byte, length byte, text (without '\0').
 struct srv_state {
     SRV_COMMON;
     uint8_t minPri;
+    // header of the next line, when already taken from the queue
+    uint8_t next_pri;
+    uint8_t next_len;
+    // lines that didn't fit in the queue since the last one that did; stops at 0xffff
+    uint16_t num_dropped;
+    // bytes of text that can be sent now
+    uint32_t budget;
+    uint32_t budget_time;
+    jd_bqueue_t lines;
+#if JD_LOGGER_PIPE
+    bool streaming;
+    jd_opipe_desc_t pipe;
+#endif
 };
 
 REG_DEFINITION(                         //
@@ -18,15 +45,42 @@ REG_DEFINITION(                         //
 
 static srv_t *state_;
 
+static int push_line(srv_t *ctx, int level, const char *text, unsigned len) {
+    uint8_t buf[LOG_LINE_MAX + 2];
+    buf[0] = level;
+    buf[1] = len;
+    memcpy(buf + 2, text, len);
+    return jd_bqueue_push(ctx->lines, buf, len + 2);
+}
+
+// if lines were dropped, pushes the marker in their place, so that it's sent in order
+static void push_dropped(srv_t *ctx, unsigned extra) {
+    char buf[32];
+    jd_sprintf(buf, sizeof(buf), "%d lines suppressed", ctx->num_dropped);
+    unsigned len = strlen(buf);
+    if (jd_bqueue_free_bytes(ctx->lines) >= len + 2 + extra &&
+        push_line(ctx, JD_LOGGER_PRIORITY_WARNING, buf, len) == 0)
+        ctx->num_dropped = 0;
+}
+
 void jdcon_logv(int level, const char *format, va_list ap) {
     srv_t *ctx = state_;
     if (!ctx)
         return;
     if (level < ctx->minPri)
         return;
-    char buf[100];
+    char buf[LOG_LINE_MAX + 1];
     jd_vsprintf(buf, sizeof(buf), format, ap);
-    jd_send(ctx->service_index, JD_LOGGER_CMD_DEBUG + level, buf, strlen(buf));
+    unsigned len = strlen(buf);
+    if (len && buf[len - 1] == '\n')
+        len--;
+
+    target_disable_irq();
+    if (ctx->num_dropped)
+        push_dropped(ctx, len + 2);
+    if ((ctx->num_dropped || push_line(ctx, level, buf, len) != 0) && ctx->num_dropped < 0xffff)
+        ctx->num_dropped++;
+    target_enable_irq();
 }
 
 void jdcon_log(const char *format, ...) {
@@ -43,16 +97,128 @@ void jdcon_warn(const char *format, ...) {
     va_end(arg);
 }
 
-void jdcon_process(srv_t *state) {}
+static bool peek_line(srv_t *state) {
+    if (state->next_pri == NO_LINE) {
+        uint8_t hdr[2];
+        if (jd_bqueue_pop_atomic(state->lines, hdr, 2) != 0)
+            return false;
+        state->next_pri = hdr[0];
+        state->next_len = hdr[1];
+    }
+    return true;
+}
+
+// Copies lines with the same priority as the first one to dst, as long as they fit in size.
+// Returns the number of bytes used (0 if the first line doesn't fit), and the priority in *pri.
+static unsigned take_lines(srv_t *state, uint8_t *dst, unsigned size, unsigned *pri) {
+    unsigned used = 0;
+    *pri = state->next_pri;
+    while (peek_line(state) && state->next_pri == *pri) {
+        unsigned sep = used ? 1 : 0;
+        if (used + sep + state->next_len > size)
+            break;
+        if (sep)
+            dst[used] = '\n';
+        used += sep;
+        jd_bqueue_pop_atomic(state->lines, dst + used, state->next_len);
+        used += state->next_len;
+        state->next_pri = NO_LINE;
+    }
+    return used;
+}
+
+static void refill_budget(srv_t *state) {
+    uint32_t elapsed = now - state->budget_time;
+    if (elapsed >= 1000000) {
+        state->budget = JD_LOGGER_BYTES_PER_SECOND;
+        state->budget_time = now;
+    } else if (elapsed >= 10000) {
+        unsigned n = elapsed / 10000;
+        unsigned b = state->budget + n * JD_LOGGER_BYTES_PER_SECOND / 100;
+        state->budget = b > JD_LOGGER_BYTES_PER_SECOND ? JD_LOGGER_BYTES_PER_SECOND : b;
+        state->budget_time += n * 10000;
+    }
+}
+
+static void send_lines(srv_t *state) {
+    refill_budget(state);
+    while (peek_line(state)) {
+        uint8_t buf[PACKET_MAX];
+        unsigned size = state->budget < PACKET_MAX ? state->budget : PACKET_MAX;
+        unsigned pri;
+        unsigned len = take_lines(state, buf, size, &pri);
+        if (len == 0)
+            break;
+        state->budget -= len;
+        jd_send(state->service_index, JD_LOGGER_CMD_DEBUG + pri, buf, len);
+    }
+}
+
+#if JD_LOGGER_PIPE
+// Pipe packets have the priority byte followed by the lines. They are not limited by the
+// budget, as the pipe only sends as fast as the client acknowledges.
+static void stream_lines(srv_t *state) {
+    bool written = false;
+    while (peek_line(state)) {
+        unsigned size;
+        uint8_t *dst =
+            jd_opipe_begin_write(&state->pipe, state->next_len + 1, PACKET_MAX, &size);
+        if (!dst) {
+            if (jd_opipe_check_space(&state->pipe, state->next_len + 1) != JD_PIPE_TRY_AGAIN) {
+                // the client is gone; back to broadcasting
+                jd_opipe_close(&state->pipe);
+                state->streaming = false;
+            }
+            break;
+        }
+        unsigned pri;
+        unsigned len = take_lines(state, dst + 1, size - 1, &pri);
+        dst[0] = pri;
+        jd_opipe_end_write(&state->pipe, len + 1);
+        written = true;
+    }
+    // don't wait for the frame to fill up
+    if (written && state->streaming)
+        jd_opipe_flush(&state->pipe);
+}
+#endif
+
+void jdcon_process(srv_t *state) {
+    if (state->num_dropped && jd_bqueue_occupied_bytes(state->lines) == 0) {
+        target_disable_irq();
+        push_dropped(state, 0);
+        target_enable_irq();
+    }
+#if JD_LOGGER_PIPE
+    if (state->streaming) {
+        stream_lines(state);
+        return;
+    }
+#endif
+    send_lines(state);
+}
 
 void jdcon_handle_packet(srv_t *state, jd_packet_t *pkt) {
-    service_handle_register_final(state, pkt, jdcon_regs);
+    switch (pkt->service_command) {
+#if JD_LOGGER_PIPE
+    case JD_LOGGER_CMD_STREAM:
+        if (state->streaming)
+            jd_opipe_close(&state->pipe);
+        state->streaming = jd_opipe_open_cmd(&state->pipe, pkt) == 0;
+        break;
+#endif
+    default:
+        service_handle_register_final(state, pkt, jdcon_regs);
+        break;
+    }
 }
 
 SRV_DEF(jdcon, JD_SERVICE_CLASS_LOGGER);
 void jdcon_init(void) {
     SRV_ALLOC(jdcon);
     state_ = state;
+    state->next_pri = NO_LINE;
+    state->lines = jd_bqueue_alloc(JD_LOGGER_BUFFER_SIZE);
 #ifdef JD_CONSOLE
     state->minPri = JD_LOGGER_PRIORITY_LOG;
 #else
@@ -0,0 +1,174 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+#include "jd_protocol.h"
+
+#if JD_ALLOC_PROFILE
+
+#define LOG(fmt, ...) DMESG("alloc: " fmt, ##__VA_ARGS__)
+
+#define BLOCK_MASK (JD_ALLOC_PROFILE_BLOCKS - 1)
+// keep probe sequences short
+#define MAX_BLOCKS (JD_ALLOC_PROFILE_BLOCKS * 3 / 4)
+
+STATIC_ASSERT((JD_ALLOC_PROFILE_BLOCKS & BLOCK_MASK) == 0);
+STATIC_ASSERT(JD_ALLOC_PROFILE_SITES <= 0xff);
+
+// Live blocks are kept in an open-addressing hash table with linear probing,
+// so that jd_free() can find the size and call site of a block.
+static void *block_ptr[JD_ALLOC_PROFILE_BLOCKS];
+static uint32_t block_size[JD_ALLOC_PROFILE_BLOCKS];
+static uint8_t block_site[JD_ALLOC_PROFILE_BLOCKS];
+static jd_alloc_site_stats_t sites[JD_ALLOC_PROFILE_SITES];
+static jd_alloc_profile_t totals;
+static uint32_t rate_start, rate_count;
+
+static unsigned block_hash(void *ptr) {
+    return (((uintptr_t)ptr >> 3) * 2654435761U) & BLOCK_MASK;
+}
+
+static int find_site(uint32_t site) {
+    for (unsigned i = 0; i < totals.num_sites; ++i)
+        if (sites[i].site == site)
+            return i;
+    if (totals.num_sites == JD_ALLOC_PROFILE_SITES)
+        return -1;
+    sites[totals.num_sites].site = site;
+    return totals.num_sites++;
+}
+
+static void update_rate(void) {
+    uint32_t d = now - rate_start;
+    if (d >= 1000000) {
+        totals.alloc_rate = (uint64_t)rate_count * 1000000 / d;
+        rate_count = 0;
+        rate_start = now;
+    }
+}
+
+void jd_alloc_profile_alloc(void *ptr, uint32_t size, void *site) {
+    target_disable_irq();
+    totals.num_allocs++;
+    rate_count++;
+    update_rate();
+
+    int s = totals.num_blocks < MAX_BLOCKS ? find_site((uintptr_t)site) : -1;
+    if (s < 0) {
+        totals.num_untracked++;
+        target_enable_irq();
+        return;
+    }
+
+    unsigned h = block_hash(ptr);
+    while (block_ptr[h])
+        h = (h + 1) & BLOCK_MASK;
+    block_ptr[h] = ptr;
+    block_size[h] = size;
+    block_site[h] = s;
+    totals.num_blocks++;
+
+    jd_alloc_site_stats_t *st = &sites[s];
+    st->num_allocs++;
+    st->total_bytes += size;
+    st->live_bytes += size;
+    if (st->live_bytes > st->max_live_bytes)
+        st->max_live_bytes = st->live_bytes;
+    totals.live_bytes += size;
+    if (totals.live_bytes > totals.max_live_bytes)
+        totals.max_live_bytes = totals.live_bytes;
+    target_enable_irq();
+}
+
+void jd_alloc_profile_free(void *ptr) {
+    if (!ptr)
+        return;
+
+    target_disable_irq();
+    unsigned h = block_hash(ptr);
+    while (block_ptr[h] != ptr) {
+        if (!block_ptr[h]) {
+            // untracked
+            target_enable_irq();
+            return;
+        }
+        h = (h + 1) & BLOCK_MASK;
+    }
+
+    jd_alloc_site_stats_t *st = &sites[block_site[h]];
+    st->num_frees++;
+    st->live_bytes -= block_size[h];
+    totals.num_frees++;
+    totals.live_bytes -= block_size[h];
+    totals.num_blocks--;
+
+    // backward-shift deletion, so that no tombstones are needed
+    unsigned hole = h;
+    for (;;) {
+        h = (h + 1) & BLOCK_MASK;
+        if (!block_ptr[h])
+            break;
+        unsigned home = block_hash(block_ptr[h]);
+        // move the entry to the hole, unless its home is cyclically in (hole, h]
+        if (((h - home) & BLOCK_MASK) >= ((h - hole) & BLOCK_MASK)) {
+            block_ptr[hole] = block_ptr[h];
+            block_size[hole] = block_size[h];
+            block_site[hole] = block_site[h];
+            hole = h;
+        }
+    }
+    block_ptr[hole] = NULL;
+    target_enable_irq();
+}
+
+void jd_alloc_profile_get(jd_alloc_profile_t *dst) {
+    target_disable_irq();
+    update_rate();
+    *dst = totals;
+    target_enable_irq();
+}
+
+int jd_alloc_profile_get_site(unsigned idx, jd_alloc_site_stats_t *dst) {
+    int r = -1;
+    target_disable_irq();
+    if (idx < totals.num_sites) {
+        *dst = sites[idx];
+        r = 0;
+    }
+    target_enable_irq();
+    return r;
+}
+
+void jd_alloc_profile_dump(unsigned max_sites) {
+    jd_alloc_profile_t t;
+    jd_alloc_profile_get(&t);
+    LOG("%u allocs, %u frees, %u/s; live %u bytes, max %u; %u untracked", (unsigned)t.num_allocs,
+        (unsigned)t.num_frees, (unsigned)t.alloc_rate, (unsigned)t.live_bytes,
+        (unsigned)t.max_live_bytes, (unsigned)t.num_untracked);
+
+    // selection of sites with most live bytes, largest first
+    uint32_t prev_live = 0xffffffff;
+    int prev_idx = -1;
+    while (max_sites--) {
+        int best = -1;
+        jd_alloc_site_stats_t st, best_st;
+        for (unsigned i = 0; jd_alloc_profile_get_site(i, &st) == 0; ++i) {
+            // (live, -idx) ordering, so that sites with equal live bytes are all listed
+            if (st.live_bytes > prev_live || (st.live_bytes == prev_live && (int)i <= prev_idx))
+                continue;
+            if (best < 0 || st.live_bytes > best_st.live_bytes) {
+                best = i;
+                best_st = st;
+            }
+        }
+        if (best < 0)
+            break;
+        LOG("%x: %u allocs, %u frees, live %u bytes, max %u, total %u", (unsigned)best_st.site,
+            (unsigned)best_st.num_allocs, (unsigned)best_st.num_frees,
+            (unsigned)best_st.live_bytes, (unsigned)best_st.max_live_bytes,
+            (unsigned)best_st.total_bytes);
+        prev_live = best_st.live_bytes;
+        prev_idx = best;
+    }
+}
+
+#endif
@@ -14,20 +14,42 @@ typedef struct {
     uint8_t data[0];
 } ev_t;
 
+// Events are kept in a ring buffer, in the order they were sent. This forms a two-slot timing
+// wheel: [head, first) wait for the second repetition, and [first, tail) for the first one.
+// All events get the same delays, so both ranges are sorted by their timestamps, and only
+// the oldest event of each range has to be checked.
+// When the buffer is full, the oldest events are dropped (they were already sent at least once).
 struct event_info {
-    ev_t *buffer;
+    uint8_t *buffer;
     cb_t process;
-    uint16_t qptr;
+    uint16_t head;
+    uint16_t first;
+    uint16_t tail;
+    uint16_t end; // events wrap around at this offset; JD_EVENT_QUEUE_SIZE when not wrapped
+    uint16_t num_events;
+    uint16_t num_second; // in [head, first)
     uint8_t counter;
+    jd_event_queue_stats_t stats;
 };
 static struct event_info info;
 
+static inline uint32_t ev_size_for(uint32_t data_bytes) {
+    return sizeof(ev_t) + ((data_bytes + 3) & ~3);
+}
+
 static inline uint32_t ev_size(ev_t *ev) {
-    return sizeof(ev_t) + ((ev->service_size + 3) & ~3);
+    return ev_size_for(ev->service_size);
+}
+
+static inline ev_t *ev_at(unsigned off) {
+    return (ev_t *)(info.buffer + off);
 }
 
-static inline ev_t *next_ev(ev_t *ev) {
-    return (ev_t *)((uint8_t *)ev + ev_size(ev));
+static unsigned ev_advance(unsigned off) {
+    off += ev_size(ev_at(off));
+    if (off >= info.end)
+        off = 0;
+    return off;
 }
 
 static uint16_t next_event_cmd(uint32_t eventid) {
@@ -38,38 +60,73 @@ static uint16_t next_event_cmd(uint32_t eventid) {
 }
 
 static void ev_shift(void) {
-    int offset = ev_size(info.buffer);
-    info.qptr -= offset;
-    jd_word_move(info.buffer, (uint8_t *)info.buffer + offset, info.qptr);
+    JD_ASSERT(info.num_events > 0);
+    unsigned next = ev_advance(info.head);
+    if (next < info.head)
+        info.end = JD_EVENT_QUEUE_SIZE;
+    if (info.num_second)
+        info.num_second--;
+    else
+        info.first = next;
+    info.head = next;
+    info.num_events--;
 }
 
-static void do_process_event_queue(void) {
-    // if info.process != NULL, then info.buffer has been initialized already
-    ev_t *ev = info.buffer;
-    while ((uint8_t *)ev - (uint8_t *)info.buffer < info.qptr) {
-        if (ev->service_index == 0xff) {
-            if (ev == info.buffer) {
-                ev_shift();
-                continue;
-            }
-        } else if (in_past(ev->timestamp)) {
-            if (jd_send(ev->service_index & 0x7f, ev->service_command, ev->data,
-                        ev->service_size) != 0)
-                break;
-            if (ev->service_index & 0x80) {
-                if (ev == info.buffer) {
-                    ev_shift();
-                    continue;
-                } else {
-                    ev->service_index = 0xff; // not sure this can happen
-                }
-            } else {
-                ev->timestamp += SECOND_DELAY * 1000;
-                ev->service_index |= 0x80;
+// make space for 'size' bytes at info.tail, dropping oldest events if needed
+static void ev_make_space(unsigned size) {
+    for (;;) {
+        if (info.num_events == 0) {
+            info.head = info.first = info.tail = 0;
+            info.end = JD_EVENT_QUEUE_SIZE;
+            info.num_second = 0;
+            return;
+        }
+        if (info.tail > info.head) {
+            if (info.tail + size <= JD_EVENT_QUEUE_SIZE)
+                return;
+            if (size <= info.head) {
+                if (info.first == info.tail)
+                    info.first = 0; // no events waiting for first repetition
+                info.end = info.tail;
+                info.tail = 0;
+                return;
             }
+        } else if (info.tail + size <= info.head) {
+            return;
         }
+        if (info.num_second)
+            info.stats.num_dropped_second++;
+        else
+            info.stats.num_dropped_first++;
+        ev_shift();
+    }
+}
+
+static int ev_send(ev_t *ev) {
+    if (jd_send(ev->service_index, ev->service_command, ev->data, ev->service_size) != 0)
+        return -1;
+    info.stats.num_repeats++;
+    return 0;
+}
+
+static void do_process_event_queue(void) {
+    // if info.process != NULL, then info.buffer has been initialized already
+    while (info.num_second) {
+        ev_t *ev = ev_at(info.head);
+        if (!in_past(ev->timestamp))
+            break;
+        if (ev_send(ev) != 0)
+            return;
+        ev_shift();
+    }
 
-        ev = next_ev(ev);
+    while (info.num_events > info.num_second) {
+        ev_t *ev = ev_at(info.first);
+        if (!in_past(ev->timestamp) || ev_send(ev) != 0)
+            return;
+        ev->timestamp += SECOND_DELAY * 1000;
+        info.first = ev_advance(info.first);
+        info.num_second++;
     }
 }
 
@@ -77,6 +134,7 @@ static void ev_init(void) {
     if (info.buffer)
         return;
     info.buffer = jd_alloc(JD_EVENT_QUEUE_SIZE);
+    info.end = JD_EVENT_QUEUE_SIZE;
     // this is only linked in, when the code uses event sending functions
     info.process = do_process_event_queue;
 }
@@ -86,6 +144,11 @@ void jd_process_event_queue(void) {
         info.process();
 }
 
+void jd_event_queue_get_stats(jd_event_queue_stats_t *dst) {
+    *dst = info.stats;
+    dst->curr_events = info.num_events;
+}
+
 void jd_send_event_ext(srv_t *srv, uint32_t eventid, const void *data, uint32_t data_bytes) {
     srv_common_t *state = (srv_common_t *)srv;
 
@@ -96,21 +159,29 @@ void jd_send_event_ext(srv_t *srv, uint32_t eventid, const void *data, uint32_t
     jd_send(state->service_index, cmd, data, data_bytes);
 
     ev_init();
+    info.stats.num_events++;
 
-    int reqlen = data_bytes + sizeof(ev_t);
-    if (reqlen > JD_EVENT_QUEUE_SIZE)
-        return; // too long to queue; shouldn't happen
-    while (JD_EVENT_QUEUE_SIZE - info.qptr < reqlen)
-        ev_shift();
+    unsigned size = ev_size_for(data_bytes);
+    if (size > JD_EVENT_QUEUE_SIZE) {
+        info.stats.num_too_long++; // shouldn't happen
+        return;
+    }
+    ev_make_space(size);
 
-    ev_t *ev = (ev_t *)((uint8_t *)info.buffer + info.qptr);
+    ev_t *ev = ev_at(info.tail);
     ev->service_size = data_bytes;
     ev->service_command = cmd;
     ev->service_index = state->service_index;
-    memcpy(ev->data, data, data_bytes);
+    if (data_bytes)
+        memcpy(ev->data, data, data_bytes);
     // no randomization; it's somewhat often to generate multiple events in the same tick
     // they will this way get the same re-transmission time, and thus be packed in one frame
     // on both re-transmissions
     ev->timestamp = now + FIRST_DELAY * 1000;
-    info.qptr += ev_size(ev);
+
+    info.tail += size;
+    if (info.tail >= JD_EVENT_QUEUE_SIZE)
+        info.tail = 0;
+    if (++info.num_events > info.stats.max_events)
+        info.stats.max_events = info.num_events;
 }
@@ -56,7 +56,14 @@ void jd_alloc_init(void) {
 #endif
 
 #if JD_SIMPLE_ALLOC
+#if JD_SLAB_ALLOC
+// memory can't be returned; slab_alloc.c keeps empty pages instead
+void jd_heap_free(void *ptr) {}
+
+void *jd_heap_alloc(uint32_t size) {
+#else
 void *jd_alloc(uint32_t size) {
+#endif
     // convert size from bytes to words
     size = (size + 3) >> 2;
 
@@ -66,6 +73,9 @@ void *jd_alloc(uint32_t size) {
     if ((uintptr_t)aptr > HEAP_END)
         JD_PANIC();
     memset(r, 0x00, size << 2);
+#if !JD_SLAB_ALLOC
+    JD_ALLOC_PROFILE_ALLOC(r, size << 2);
+#endif
 
     return r;
 }
@@ -15,6 +15,9 @@ void jd_rx_init(void) {
     if (!rx_queue)
         rx_queue = jd_queue_alloc(JD_RX_QUEUE_SIZE);
 #endif
+#if JD_TRACE
+    jd_trace_init();
+#endif
 }
 
 static int jd_rx_frame_received_core(jd_frame_t *frame, bool is_loop) {
@@ -50,7 +53,10 @@ static int jd_rx_frame_received_core(jd_frame_t *frame, bool is_loop) {
 }
 
 int jd_rx_frame_received(jd_frame_t *frame) {
-    return jd_rx_frame_received_core(frame, 0);
+    int r = jd_rx_frame_received_core(frame, 0);
+    if (frame)
+        JD_TRACE_FRAME(frame, r ? JD_TRACE_FLAG_DROPPED : 0);
+    return r;
 }
 
 #if JD_CLIENT || JD_BRIDGE
@@ -76,6 +82,21 @@ void jd_rx_release_frame(jd_frame_t *frame) {
 #endif
 }
 
+#if JD_QUEUE_STATS
+int jd_rx_queue_stats(jd_queue_stats_t *dst, bool reset) {
+#if JD_RX_QUEUE
+    if (rx_queue) {
+        jd_queue_get_stats(rx_queue, dst);
+        if (reset)
+            jd_queue_reset_stats(rx_queue);
+        return 0;
+    }
+#endif
+    memset(dst, 0, sizeof(*dst));
+    return -1;
+}
+#endif
+
 bool jd_rx_has_frame(void) {
 #if JD_RX_QUEUE
     return jd_queue_front(rx_queue) != NULL;
@@ -0,0 +1,193 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+#include "jd_protocol.h"
+
+#if JD_SLAB_ALLOC
+
+// Every block is preceded by a pointer-sized header, which keeps the payload aligned.
+// For allocated blocks, the header points to the page the block belongs to,
+// or is LARGE_BLOCK for blocks from jd_heap_alloc(), which are preceded by their size.
+// In free blocks, the header links the free list of the page.
+// Pages with free blocks are kept in a doubly-linked list per size class.
+
+#define MIN_BLOCK_SHIFT 4
+#define MAX_BLOCK_SIZE (1 << (MIN_BLOCK_SHIFT + JD_SLAB_NUM_CLASSES - 1))
+#define HEADER_SIZE sizeof(void *)
+#define LARGE_BLOCK ((slab_page_t *)1)
+
+typedef struct slab_page {
+    struct slab_page *next;
+    struct slab_page *prev;
+    void **free_list;
+    uint16_t num_used;
+    uint16_t num_blocks;
+    uint8_t cls;
+} slab_page_t;
+
+static slab_page_t *partial_pages[JD_SLAB_NUM_CLASSES];
+static jd_slab_stats_t stats;
+
+static inline unsigned payload_size(unsigned cls) {
+    return 1 << (MIN_BLOCK_SHIFT + cls);
+}
+
+static inline unsigned block_size(unsigned cls) {
+    return HEADER_SIZE + payload_size(cls);
+}
+
+static unsigned size_class(uint32_t size) {
+    unsigned cls = 0;
+    while (payload_size(cls) < size)
+        cls++;
+    return cls;
+}
+
+static void page_link(slab_page_t *p) {
+    p->prev = NULL;
+    p->next = partial_pages[p->cls];
+    if (p->next)
+        p->next->prev = p;
+    partial_pages[p->cls] = p;
+}
+
+static void page_unlink(slab_page_t *p) {
+    if (p->prev)
+        p->prev->next = p->next;
+    else
+        partial_pages[p->cls] = p->next;
+    if (p->next)
+        p->next->prev = p->prev;
+    p->next = p->prev = NULL;
+}
+
+static unsigned page_bytes(slab_page_t *p) {
+    return sizeof(slab_page_t) + p->num_blocks * block_size(p->cls);
+}
+
+static slab_page_t *page_alloc(unsigned cls) {
+    unsigned bs = block_size(cls);
+    unsigned n = (JD_SLAB_PAGE_SIZE - sizeof(slab_page_t)) / bs;
+    if (n == 0)
+        n = 1;
+    slab_page_t *p = jd_heap_alloc(sizeof(slab_page_t) + n * bs);
+    p->cls = cls;
+    p->num_blocks = n;
+    uint8_t *blocks = (uint8_t *)(p + 1);
+    for (unsigned i = n; i > 0; --i) {
+        void **blk = (void **)(blocks + (i - 1) * bs);
+        *blk = p->free_list;
+        p->free_list = blk;
+    }
+    return p;
+}
+
+// called with IRQs disabled
+static void page_add(slab_page_t *p) {
+    unsigned cls = p->cls;
+    unsigned n = p->num_blocks;
+    page_link(p);
+    stats.num_page_allocs++;
+    stats.classes[cls].num_pages++;
+    stats.classes[cls].num_blocks += n;
+    stats.curr_page_bytes += page_bytes(p);
+    if (stats.curr_page_bytes > stats.max_page_bytes)
+        stats.max_page_bytes = stats.curr_page_bytes;
+}
+
+static void *large_alloc(uint32_t size) {
+    uintptr_t *r = jd_heap_alloc(size + 2 * HEADER_SIZE);
+    r[0] = size + 2 * HEADER_SIZE;
+    r[1] = (uintptr_t)LARGE_BLOCK;
+    target_disable_irq();
+    stats.num_allocs++;
+    stats.num_large_allocs++;
+    stats.curr_large_bytes += r[0];
+    target_enable_irq();
+    return r + 2;
+}
+
+void *jd_alloc(uint32_t size) {
+    if (size > MAX_BLOCK_SIZE) {
+        void *r = large_alloc(size);
+        JD_ALLOC_PROFILE_ALLOC(r, size);
+        return r;
+    }
+
+    unsigned cls = size_class(size);
+    target_disable_irq();
+    if (!partial_pages[cls]) {
+        // don't call into the heap with IRQs disabled
+        target_enable_irq();
+        slab_page_t *np = page_alloc(cls);
+        target_disable_irq();
+        page_add(np);
+    }
+    slab_page_t *p = partial_pages[cls];
+    void **blk = p->free_list;
+    p->free_list = *blk;
+    if (++p->num_used == p->num_blocks)
+        page_unlink(p);
+    *blk = p;
+    stats.num_allocs++;
+    stats.classes[cls].num_allocs++;
+    stats.classes[cls].num_used++;
+    stats.total_requested_bytes += size;
+    stats.total_block_bytes += block_size(cls);
+    target_enable_irq();
+
+    void *r = blk + 1;
+    memset(r, 0, size);
+    JD_ALLOC_PROFILE_ALLOC(r, size);
+    return r;
+}
+
+void jd_free(void *ptr) {
+    if (!ptr)
+        return;
+    JD_ALLOC_PROFILE_FREE(ptr);
+    void **blk = (void **)ptr - 1;
+    slab_page_t *p = *blk;
+
+    target_disable_irq();
+    stats.num_frees++;
+    if (p == LARGE_BLOCK) {
+        uintptr_t *hd = (uintptr_t *)blk - 1;
+        stats.curr_large_bytes -= hd[0];
+        target_enable_irq();
+        jd_heap_free(hd);
+        return;
+    }
+
+    JD_ASSERT(p->num_used > 0);
+    *blk = p->free_list;
+    p->free_list = blk;
+    if (p->num_used-- == p->num_blocks)
+        page_link(p);
+    stats.classes[p->cls].num_used--;
+
+#if !JD_SIMPLE_ALLOC
+    // keep one empty page per class, so that alloc/free in a loop doesn't hit the heap
+    if (p->num_used == 0 && (p->prev || p->next)) {
+        page_unlink(p);
+        stats.num_page_frees++;
+        stats.classes[p->cls].num_pages--;
+        stats.classes[p->cls].num_blocks -= p->num_blocks;
+        stats.curr_page_bytes -= page_bytes(p);
+        target_enable_irq();
+        jd_heap_free(p);
+        return;
+    }
+#endif
+    target_enable_irq();
+}
+
+void jd_slab_get_stats(jd_slab_stats_t *dst) {
+    target_disable_irq();
+    *dst = stats;
+    target_enable_irq();
+    for (unsigned i = 0; i < JD_SLAB_NUM_CLASSES; ++i)
+        dst->classes[i].block_size = payload_size(i);
+}
+
+#endif
@@ -16,6 +16,10 @@ uint8_t rawFrameSending;
 jd_frame_t *rawFrame;
 #endif
 
+#if JD_BUS_STATS && (JD_RAW_FRAME || !JD_SEND_FRAME)
+static uint32_t queued_at;
+#endif
+
 #if JD_SEND_FRAME
 
 #if !JD_DEVICESCRIPT
@@ -45,6 +49,8 @@ int jd_send_frame_raw(jd_frame_t *f) {
             OVF_ERROR("frm send ovf");
     }
 
+    JD_TRACE_FRAME(f, JD_TRACE_FLAG_TX | (r ? JD_TRACE_FLAG_DROPPED : 0));
+
     // this may modify flags
     if (jd_rx_frame_received_loopback(f))
         OVF_ERROR("loopback rx ovf");
@@ -68,6 +74,21 @@ bool jd_tx_will_fit(unsigned size) {
 }
 #endif
 
+#if JD_QUEUE_STATS
+int jd_tx_queue_stats(jd_queue_stats_t *dst, bool reset) {
+#if JD_SEND_FRAME
+    if (send_queue) {
+        jd_queue_get_stats(send_queue, dst);
+        if (reset)
+            jd_queue_reset_stats(send_queue);
+        return 0;
+    }
+#endif
+    memset(dst, 0, sizeof(*dst));
+    return -1;
+}
+#endif
+
 int jd_tx_is_idle(void) {
 #if JD_RAW_FRAME
     if (rawFrame || rawFrameSending)
@@ -129,6 +150,10 @@ jd_frame_t *jd_tx_get_frame(void) {
         jd_frame_t *r = rawFrame;
         rawFrame = NULL;
         rawFrameSending = true;
+#if JD_BUS_STATS
+        // we don't know when it was set
+        queued_at = tim_get_micros();
+#endif
         return r;
     }
 #endif
@@ -148,6 +173,20 @@ jd_frame_t *jd_tx_get_frame(void) {
     return NULL;
 }
 
+#if JD_BUS_STATS
+uint32_t jd_tx_frame_queued_at(void) {
+#if JD_RAW_FRAME
+    if (rawFrameSending)
+        return queued_at;
+#endif
+#if JD_SEND_FRAME
+    return jd_queue_front_time(send_queue);
+#else
+    return queued_at;
+#endif
+}
+#endif
+
 static void poke_ready(void) {
 #if JD_RAW_FRAME
     if (rawFrame)
@@ -202,6 +241,9 @@ void jd_tx_flush(void) {
 
     bufferPtr ^= 1;
     isSending = 1;
+#if JD_BUS_STATS
+    queued_at = tim_get_micros();
+#endif
     jd_packet_ready();
 #endif
     jd_services_packet_queued();
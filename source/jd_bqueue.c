@@ -5,6 +5,9 @@ struct jd_bqueue {
     uint16_t back;
     uint16_t size;
     uint16_t filled;
+#if JD_QUEUE_STATS
+    jd_queue_stats_t stats;
+#endif
     uint8_t data[0];
 };
 
@@ -56,6 +59,16 @@ int jd_bqueue_push(jd_bqueue_t q, const void *data, unsigned len) {
         }
     }
     validate(q);
+#if JD_QUEUE_STATS
+    if (ret) {
+        q->stats.num_dropped++;
+    } else {
+        q->stats.num_pushed++;
+        if (q->filled > q->stats.max_bytes)
+            q->stats.max_bytes = q->filled;
+        q->stats.occupancy_hist[jd_queue_hist_bucket(q->filled)]++;
+    }
+#endif
     target_enable_irq();
 
     return ret;
@@ -162,9 +175,29 @@ JD_FAST
 jd_bqueue_t jd_bqueue_alloc(unsigned size) {
     jd_bqueue_t q = jd_alloc(sizeof(*q) + size);
     q->size = size;
+#if JD_QUEUE_STATS
+    q->stats.size = size;
+#endif
     return q;
 }
 
+#if JD_QUEUE_STATS
+void jd_bqueue_get_stats(jd_bqueue_t q, jd_queue_stats_t *dst) {
+    target_disable_irq();
+    *dst = q->stats;
+    dst->curr_bytes = q->filled;
+    target_enable_irq();
+}
+
+void jd_bqueue_reset_stats(jd_bqueue_t q) {
+    target_disable_irq();
+    memset(&q->stats, 0, sizeof(q->stats));
+    q->stats.size = q->size;
+    q->stats.max_bytes = q->filled;
+    target_enable_irq();
+}
+#endif
+
 #if JD_64
 #define TEST_SIZE 512
 void jd_bqueue_test(void) {
@@ -9,6 +9,11 @@
 
 #include "jd_util.h"
 
+#define ALLOC_PROFILE_PIPE (JD_ALLOC_PROFILE && JD_PIPES)
+#if ALLOC_PROFILE_PIPE
+#include "jd_pipes.h"
+#endif
+
 struct srv_state {
     SRV_COMMON;
 #if JD_CONFIG_CONTROL_FLOOD == 1
@@ -21,6 +26,13 @@ struct srv_state {
     uint32_t flood_counter;
     uint32_t flood_remaining;
 #endif
+#if ALLOC_PROFILE_PIPE
+    // next record to write: 0 for jd_alloc_profile_t, then sites; -1 when not writing
+    int16_t alloc_profile_pos;
+    // from the jd_alloc_profile_t written; later sites are not sent
+    uint16_t alloc_profile_num_sites;
+    jd_opipe_desc_t alloc_profile_pipe;
+#endif
 };
 
 __attribute__((weak)) void target_standby(uint32_t duration_ms) {
@@ -52,12 +64,49 @@ static void process_flood(srv_t *state) {
 static void process_flood(srv_t *state) {}
 #endif
 
+#if ALLOC_PROFILE_PIPE
+static void process_alloc_profile(srv_t *state) {
+    while (state->alloc_profile_pos >= 0) {
+        int pos = state->alloc_profile_pos;
+        if (pos > state->alloc_profile_num_sites) {
+            jd_opipe_close(&state->alloc_profile_pipe);
+            state->alloc_profile_pos = -1;
+            break;
+        }
+        unsigned sz = pos == 0 ? sizeof(jd_alloc_profile_t) : sizeof(jd_alloc_site_stats_t);
+        int err = jd_opipe_check_space(&state->alloc_profile_pipe, sz);
+        if (err == JD_PIPE_TRY_AGAIN)
+            break;
+        if (err != 0) {
+            jd_opipe_close(&state->alloc_profile_pipe);
+            state->alloc_profile_pos = -1;
+            break;
+        }
+        void *dst = jd_opipe_begin_write(&state->alloc_profile_pipe, sz, sz, NULL);
+        JD_ASSERT(dst != NULL);
+        if (pos == 0) {
+            jd_alloc_profile_t *totals = dst;
+            jd_alloc_profile_get(totals);
+            state->alloc_profile_num_sites = totals->num_sites;
+        } else {
+            // sites are never removed
+            JD_CHK(jd_alloc_profile_get_site(pos - 1, dst));
+        }
+        jd_opipe_end_write(&state->alloc_profile_pipe, sz);
+        state->alloc_profile_pos++;
+    }
+}
+#else
+static void process_alloc_profile(srv_t *state) {}
+#endif
+
 #if JD_CONFIG_DEV_SPEC_URL == 1
 extern const char app_spec_url[];
 #endif
 
 void jd_ctrl_process(srv_t *state) {
     process_flood(state);
+    process_alloc_profile(state);
 #if JD_CONFIG_WATCHDOG == 1
     if (state->watchdog && in_past(state->watchdog))
         target_reset();
@@ -117,6 +166,46 @@ void jd_ctrl_handle_packet(srv_t *state, jd_packet_t *pkt) {
         break;
     }
 
+#if JD_PROFILE
+    case JD_GET(JD_CONTROL_REG_PROFILE): {
+        uint8_t buf[JD_SERIAL_PAYLOAD_SIZE - 4];
+        unsigned sz = jd_profile_report((jd_profile_report_t *)buf, sizeof(buf));
+        jd_send(JD_SERVICE_INDEX_CONTROL, pkt->service_command, buf, sz);
+        break;
+    }
+
+    case JD_CONTROL_CMD_PROFILE: {
+        uint8_t flags = pkt->service_size ? pkt->data[0] : JD_PROFILE_CMD_FLAG_DUMP;
+        if (flags & JD_PROFILE_CMD_FLAG_DUMP)
+            jd_profile_dump();
+        if (flags & JD_PROFILE_CMD_FLAG_RESET)
+            jd_profile_reset();
+        break;
+    }
+#endif
+
+#if JD_ALLOC_PROFILE
+    case JD_CONTROL_CMD_ALLOC_PROFILE:
+#if ALLOC_PROFILE_PIPE
+        if (pkt->service_size) {
+            if (jd_opipe_open_cmd(&state->alloc_profile_pipe, pkt) == 0)
+                state->alloc_profile_pos = 0;
+            break;
+        }
+#endif
+        jd_alloc_profile_dump(16);
+        break;
+#endif
+
+#if JD_PHYSICAL && JD_BUS_STATS
+    case JD_GET(JD_CONTROL_REG_BUS_STATS): {
+        jd_bus_stats_t st[2];
+        jd_get_bus_stats(&st[0], &st[1]);
+        jd_send(JD_SERVICE_INDEX_CONTROL, pkt->service_command, st, sizeof(st));
+        break;
+    }
+#endif
+
 #if JD_CONFIG_DEV_SPEC_URL == 1
     case JD_GET(JD_CONTROL_REG_DEVICE_SPECIFICATION_URL):
         jd_send(JD_SERVICE_INDEX_CONTROL, pkt->service_command, app_spec_url, strlen(app_spec_url));
@@ -154,4 +243,7 @@ void jd_ctrl_handle_packet(srv_t *state, jd_packet_t *pkt) {
 SRV_DEF(jd_ctrl, JD_SERVICE_CLASS_CONTROL);
 void jd_ctrl_init(void) {
     SRV_ALLOC(jd_ctrl);
+#if ALLOC_PROFILE_PIPE
+    state->alloc_profile_pos = -1;
+#endif
 }
@@ -1,7 +1,7 @@
 #include "jd_protocol.h"
 #include "jd_dmesg.h"
 
-#if JD_DMESG_BUFFER_SIZE > 0
+#if JD_DMESG_BUFFER_SIZE > 0 && !JD_DMESG_BINARY
 
 #if JD_DMESG_BUFFER_SIZE < 256
 #error "Too small DMESG buffer"
@@ -9,6 +9,124 @@
 
 struct CodalLogStore codalLogStore;
 
+#if JD_DMESG_LOCK_FREE
+
+// Writers reserve space by advancing 'reserved' (position in lower 24 bits, ticket in upper 8)
+// with compare-and-swap, and copy the message without any lock. Every message in progress
+// has a slot (ticket modulo JD_DMESG_SLOTS), which it marks committed when copied.
+// Committed messages are then published in ticket order by whichever writer gets to them,
+// by advancing codalLogStore.ptr; readers only see text before codalLogStore.ptr.
+// Unlike with target_disable_irq(), the text isn't followed by '\0'.
+// Readers don't take any lock either: if writers wrap around the buffer and reach the text
+// being copied by jd_dmesg_read*(), the reader gets a mix of old and new text.
+
+STATIC_ASSERT((JD_DMESG_BUFFER_SIZE & (JD_DMESG_BUFFER_SIZE - 1)) == 0);
+STATIC_ASSERT(JD_DMESG_BUFFER_SIZE < (1 << 24));
+STATIC_ASSERT((256 % JD_DMESG_SLOTS) == 0);
+
+#define POS_MASK 0xffffff
+#define SLOT_FREE 0 // or being written
+#define SLOT_COMMITTED 1
+#define SLOT_PUBLISHING 2
+// the round of the ticket (tickets in 'reserved' are 8 bit), and st; zero when free for
+// the first ticket
+#define SLOT_STATE(ticket, st) (((((ticket)&0xff) / JD_DMESG_SLOTS) << 2) | (st))
+
+typedef struct {
+    uint32_t state; // SLOT_STATE() of the ticket using it, or allowed to use it next
+    uint32_t len;
+} dmesg_slot_t;
+
+static uint32_t reserved;
+static uint32_t pub_ticket, pub_pos;
+static bool wrapped;
+static dmesg_slot_t slots[JD_DMESG_SLOTS];
+
+#define LOAD(p, order) __atomic_load_n(p, __ATOMIC_##order)
+#define STORE(p, v, order) __atomic_store_n(p, v, __ATOMIC_##order)
+#define CAS(p, exp, v)                                                                             \
+    __atomic_compare_exchange_n(p, exp, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+
+// called by the owner of pub_* (and of slot t)
+static void publish_one(uint32_t t, dmesg_slot_t *slot) {
+    pub_pos += slot->len;
+    if (pub_pos >= JD_DMESG_BUFFER_SIZE)
+        STORE(&wrapped, true, RELEASE);
+    STORE(&codalLogStore.ptr, pub_pos & (JD_DMESG_BUFFER_SIZE - 1), RELEASE);
+    STORE(&slot->state, SLOT_STATE(t + JD_DMESG_SLOTS, SLOT_FREE), RELEASE);
+    STORE(&pub_ticket, t + 1, SEQ_CST);
+}
+
+static void publish(void) {
+    for (;;) {
+        // a writer stores its commit before loading pub_ticket, and we store pub_ticket before
+        // checking the slot, so at least one of us sees the commit
+        uint32_t t = LOAD(&pub_ticket, SEQ_CST);
+        dmesg_slot_t *slot = &slots[t % JD_DMESG_SLOTS];
+        uint32_t exp = SLOT_STATE(t, SLOT_COMMITTED);
+        if (LOAD(&slot->state, SEQ_CST) != exp)
+            return;
+        // only one thread can move the slot to publishing, and pub_* are then owned by it
+        if (!CAS(&slot->state, &exp, SLOT_STATE(t, SLOT_PUBLISHING)))
+            return;
+        publish_one(t, slot);
+    }
+}
+
+void jd_dmesg_write(const char *msg, unsigned len) {
+    if (len > JD_DMESG_BUFFER_SIZE / 2)
+        len = JD_DMESG_BUFFER_SIZE / 2; // shouldn't happen
+
+    uint32_t r = LOAD(&reserved, RELAXED);
+    dmesg_slot_t *slot;
+    uint32_t t;
+    for (;;) {
+        t = r >> 24;
+        slot = &slots[t % JD_DMESG_SLOTS];
+        // once free for our ticket, the slot stays so until the ticket is taken
+        if (LOAD(&slot->state, ACQUIRE) != SLOT_STATE(t, SLOT_FREE))
+            return; // too many writers
+        uint32_t next = ((t + 1) << 24) | ((r + len) & POS_MASK);
+        if (CAS(&reserved, &r, next))
+            break;
+    }
+
+    slot->len = len;
+    unsigned pos = r & (JD_DMESG_BUFFER_SIZE - 1);
+    unsigned space = JD_DMESG_BUFFER_SIZE - pos;
+    if (space < len) {
+        memcpy(codalLogStore.buffer + pos, msg, space);
+        memcpy(codalLogStore.buffer, msg + space, len - space);
+    } else {
+        memcpy(codalLogStore.buffer + pos, msg, len);
+    }
+    uint32_t pt = LOAD(&pub_ticket, SEQ_CST);
+    if ((pt & 0xff) == t) {
+        // all earlier messages are published, and no one else will touch our slot
+        publish_one(pt, slot);
+    } else {
+        STORE(&slot->state, SLOT_STATE(t, SLOT_COMMITTED), SEQ_CST);
+    }
+    publish();
+}
+
+// see above; readers can race with writers
+#define LOCK() ((void)0)
+#define UNLOCK() ((void)0)
+#define CURR_PTR() LOAD(&codalLogStore.ptr, ACQUIRE)
+
+uint32_t jd_dmesg_startptr(void) {
+    // as with the lock, *state == ptr means there's nothing to read, so start after ptr
+    uint32_t curr_ptr = CURR_PTR();
+    return LOAD(&wrapped, ACQUIRE) ? (curr_ptr + 1) & (JD_DMESG_BUFFER_SIZE - 1) : 0;
+}
+
+#else
+
+#define LOCK() target_disable_irq()
+#define UNLOCK() target_enable_irq()
+#define CURR_PTR() codalLogStore.ptr
+
 JD_FAST
 void jd_dmesg_write(const char *msg, unsigned len) {
     target_disable_irq();
@@ -27,6 +145,20 @@ void jd_dmesg_write(const char *msg, unsigned len) {
     target_enable_irq();
 }
 
+JD_FAST
+uint32_t jd_dmesg_startptr(void) {
+    target_disable_irq();
+    // if we wrapped around already, we start at ptr+1 (buf[ptr] is always '\0')
+    uint32_t curr_ptr = codalLogStore.ptr + 1;
+    // if we find '\0' at ptr+1, it means we didn't wrap around yet - start at 0
+    if (curr_ptr >= sizeof(codalLogStore.buffer) || codalLogStore.buffer[curr_ptr] == 0)
+        curr_ptr = 0;
+    target_enable_irq();
+    return curr_ptr;
+}
+
+#endif
+
 void jd_vdmesg(const char *format, va_list ap) {
     char tmp[JD_DMESG_LINE_BUFFER];
     jd_vsprintf(tmp, sizeof(tmp) - 1, format, ap);
@@ -46,24 +178,12 @@ void jd_dmesg(const char *format, ...) {
     va_end(arg);
 }
 
-JD_FAST
-uint32_t jd_dmesg_startptr(void) {
-    target_disable_irq();
-    // if we wrapped around already, we start at ptr+1 (buf[ptr] is always '\0')
-    uint32_t curr_ptr = codalLogStore.ptr + 1;
-    // if we find '\0' at ptr+1, it means we didn't wrap around yet - start at 0
-    if (curr_ptr >= sizeof(codalLogStore.buffer) || codalLogStore.buffer[curr_ptr] == 0)
-        curr_ptr = 0;
-    target_enable_irq();
-    return curr_ptr;
-}
-
 JD_FAST
 unsigned jd_dmesg_read(void *dst, unsigned space, uint32_t *state) {
-    target_disable_irq();
+    LOCK();
     if (*state >= sizeof(codalLogStore.buffer))
         *state = 0;
-    uint32_t curr_ptr = codalLogStore.ptr;
+    uint32_t curr_ptr = CURR_PTR();
     if (curr_ptr < *state)
         curr_ptr = sizeof(codalLogStore.buffer);
     unsigned towrite = curr_ptr - *state;
@@ -73,16 +193,16 @@ unsigned jd_dmesg_read(void *dst, unsigned space, uint32_t *state) {
         memcpy(dst, codalLogStore.buffer + *state, towrite);
         *state += towrite;
     }
-    target_enable_irq();
+    UNLOCK();
 
     return towrite;
 }
 
 unsigned jd_dmesg_read_line(void *dst, unsigned space, uint32_t *state) {
-    target_disable_irq();
+    LOCK();
     if (*state >= sizeof(codalLogStore.buffer))
         *state = 0;
-    uint32_t curr_ptr = codalLogStore.ptr;
+    uint32_t curr_ptr = CURR_PTR();
     uint32_t sp = *state;
     unsigned len = 0;
     if (sp != curr_ptr) {
@@ -102,7 +222,7 @@ unsigned jd_dmesg_read_line(void *dst, unsigned space, uint32_t *state) {
         len = dp - (char *)dst;
         *dp = 0;
     }
-    target_enable_irq();
+    UNLOCK();
 
     return len;
 }
@@ -0,0 +1,538 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+#include "jd_protocol.h"
+#include "jd_dmesg.h"
+
+#if JD_DMESG_BUFFER_SIZE > 0 && JD_DMESG_BINARY
+
+#if JD_DMESG_BUFFER_SIZE < 256
+#error "Too small DMESG buffer"
+#endif
+
+// the offset in formatted text is kept in the upper 8 bits of reader state
+STATIC_ASSERT(JD_DMESG_LINE_BUFFER <= 0xff);
+
+#define SEQ_MASK 0xffffff
+#define STATIC_STRING 0xffffffff
+#define HDR_SIZE sizeof(jd_dmesg_record_t)
+#define REC_ALIGN(x) (((x) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+#define MAX_RECORD REC_ALIGN(HDR_SIZE + JD_DMESG_LINE_BUFFER)
+#define ARG_ALIGN(x) (((x) + 3) & ~3)
+#define BUF_SIZE sizeof(buffer)
+
+// Records are kept in a ring buffer, in the order they were written, and never wrap around
+// the end of the buffer; a record with size 0 (or lack of space for the header) marks the end.
+// When the buffer is full, the oldest records are dropped.
+static uintptr_t buffer[JD_DMESG_BUFFER_SIZE / sizeof(uintptr_t)];
+static uint32_t head, tail, head_seq, num_records;
+// position of the last record read, so that readers don't have to walk from head
+static uint32_t cursor_seq, cursor_pos;
+
+typedef union {
+    jd_dmesg_record_t hdr;
+    uintptr_t data[MAX_RECORD / sizeof(uintptr_t)];
+} record_buf_t;
+
+static inline jd_dmesg_record_t *rec_at(unsigned pos) {
+    return (jd_dmesg_record_t *)((uint8_t *)buffer + pos);
+}
+
+static unsigned rec_next(unsigned pos) {
+    pos += rec_at(pos)->size;
+    if (pos != tail && (pos + HDR_SIZE > BUF_SIZE || rec_at(pos)->size == 0))
+        pos = 0;
+    return pos;
+}
+
+// make space for 'size' bytes at tail, dropping oldest records if needed
+static void make_space(unsigned size) {
+    for (;;) {
+        if (num_records == 0) {
+            head = tail = 0;
+            return;
+        }
+        if (tail > head) {
+            if (tail + size <= BUF_SIZE)
+                return;
+            if (size <= head) {
+                if (tail + HDR_SIZE <= BUF_SIZE)
+                    rec_at(tail)->size = 0;
+                tail = 0;
+                return;
+            }
+        } else if (tail + size <= head) {
+            return;
+        }
+        head = rec_next(head);
+        head_seq = (head_seq + 1) & SEQ_MASK;
+        num_records--;
+    }
+}
+
+JD_FAST
+static void push_record(jd_dmesg_record_t *rec) {
+    target_disable_irq();
+    make_space(rec->size);
+    memcpy(rec_at(tail), rec, rec->size);
+    tail += rec->size;
+    if (tail >= BUF_SIZE)
+        tail = 0;
+    num_records++;
+    target_enable_irq();
+}
+
+/*
+ * Writing
+ */
+
+typedef struct {
+    uint8_t *ptr;
+    uint8_t *end;
+} encoder_t;
+
+static bool put(encoder_t *e, const void *src, unsigned size) {
+    if (e->ptr + ARG_ALIGN(size) > e->end)
+        return false;
+    memcpy(e->ptr, src, size);
+    e->ptr += ARG_ALIGN(size);
+    return true;
+}
+
+// length-prefixed, truncated to the space left
+static bool put_bytes(encoder_t *e, const void *src, int len) {
+    int space = e->end - e->ptr - 4;
+    if (space < 0)
+        return false;
+    if (len < 0)
+        len = 0;
+    if (len > space)
+        len = space;
+    uint32_t ulen = len;
+    put(e, &ulen, 4);
+    return put(e, src, len);
+}
+
+static bool put_string(encoder_t *e, const char *s) {
+    if (!s || JD_DMESG_STATIC_PTR(s)) {
+        uint32_t marker = STATIC_STRING;
+        uint8_t *p = e->ptr;
+        if (put(e, &marker, 4) && put(e, &s, sizeof(s)))
+            return true;
+        e->ptr = p;
+        return false;
+    }
+    return put_bytes(e, s, strlen(s));
+}
+
+static void finish_record(jd_dmesg_record_t *rec, encoder_t *e, uint8_t flags) {
+    rec->size = REC_ALIGN(e->ptr - (uint8_t *)rec);
+    rec->flags = flags;
+    rec->timestamp = now;
+    push_record(rec);
+}
+
+JD_FAST
+void jd_dmesg_write(const char *msg, unsigned len) {
+    record_buf_t tmp;
+    while (len > 0) {
+        unsigned n = len < JD_DMESG_LINE_BUFFER ? len : JD_DMESG_LINE_BUFFER;
+        encoder_t e = {tmp.hdr.args, (uint8_t *)&tmp + sizeof(tmp)};
+        tmp.hdr.format = NULL;
+        tmp.hdr.num_args = 1;
+        put_bytes(&e, msg, n);
+        finish_record(&tmp.hdr, &e, JD_DMESG_RECORD_TEXT);
+        msg += n;
+        len -= n;
+    }
+}
+
+void jd_vdmesg(const char *format, va_list ap) {
+    record_buf_t tmp;
+    encoder_t e = {tmp.hdr.args, (uint8_t *)&tmp + sizeof(tmp)};
+    unsigned num_args = 0;
+    bool full = false;
+
+    // walk the format the same way jd_vsprintf() does, and store the arguments
+    for (const char *p = format;;) {
+        char c = *p++;
+        if (c == 0)
+            break;
+        if (c != '%')
+            continue;
+
+        bool ok = true;
+#if JD_ADVANCED_STRING
+#if JD_LORA
+        while ('0' <= *p && *p <= '9')
+            p++;
+#endif
+        bool do_free = false;
+#if JD_FREE_SUPPORTED
+        if (p[0] == '-' && p[1] == 's') {
+            do_free = true;
+            p++;
+        }
+#endif
+        c = *p++;
+        switch (c) {
+        case 'c':
+        case 'd':
+        case 'u':
+        case 'x':
+        case 'X': {
+            int v = va_arg(ap, int);
+            ok = !full && put(&e, &v, sizeof(v));
+            break;
+        }
+        case 'p': {
+            uintptr_t v = va_arg(ap, uintptr_t);
+            ok = !full && put(&e, &v, sizeof(v));
+            break;
+        }
+        case 'f': {
+            double v = va_arg(ap, double);
+            ok = !full && put(&e, &v, sizeof(v));
+            break;
+        }
+        case '*': {
+            int len = va_arg(ap, int);
+            const void *d = va_arg(ap, const void *);
+            if (*p)
+                p++;
+            ok = !full && put_bytes(&e, d, len);
+            break;
+        }
+        case 's': {
+            const char *v = va_arg(ap, const char *);
+            ok = !full && put_string(&e, v);
+            if (do_free)
+                jd_free((void *)v);
+            break;
+        }
+        case 0:
+            p--;
+            continue;
+        default:
+            continue; // no argument
+        }
+#else
+        uint32_t v = va_arg(ap, uint32_t);
+        c = *p++;
+        if (c == 0)
+            p--;
+        if (c == 's')
+            ok = !full && put_string(&e, (const char *)(uintptr_t)v);
+        else
+            ok = !full && put(&e, &v, sizeof(v));
+#endif
+        if (ok)
+            num_args++;
+        else
+            full = true;
+    }
+
+    tmp.hdr.format = format;
+    tmp.hdr.num_args = num_args;
+    finish_record(&tmp.hdr, &e, 0);
+}
+
+void jd_dmesg(const char *format, ...) {
+    va_list arg;
+    va_start(arg, format);
+    jd_vdmesg(format, arg);
+    va_end(arg);
+}
+
+/*
+ * Reading
+ */
+
+typedef struct {
+    char *dst;
+    int left; // including final '\0'
+} formatter_t;
+
+static void emit(formatter_t *f, const char *s, int len) {
+    if (len > f->left - 1)
+        len = f->left - 1;
+    if (len <= 0)
+        return;
+    memcpy(f->dst, s, len);
+    f->dst += len;
+    f->left -= len;
+}
+
+static void emit_fmt(formatter_t *f, const char *format, ...) {
+    va_list arg;
+    va_start(arg, format);
+    int len = jd_vsprintf(f->dst, f->left, format, arg) - 1;
+    va_end(arg);
+    if (len > f->left - 1)
+        len = f->left - 1;
+    f->dst += len;
+    f->left -= len;
+}
+
+static const uint8_t *get_word(const uint8_t *a, void *dst, unsigned size) {
+    memcpy(dst, a, size);
+    return a + ARG_ALIGN(size);
+}
+
+static const uint8_t *emit_string(formatter_t *f, const uint8_t *a) {
+    uint32_t len;
+    a = get_word(a, &len, 4);
+    if (len == STATIC_STRING) {
+        const char *s;
+        a = get_word(a, &s, sizeof(s));
+        if (!s)
+            s = "(null)";
+        emit(f, s, strlen(s));
+        return a;
+    }
+    emit(f, (const char *)a, len);
+    return a + ARG_ALIGN(len);
+}
+
+// returns length of the text of rec
+static int format_record(jd_dmesg_record_t *rec, char *line) {
+    const uint8_t *a = rec->args;
+
+    if (rec->flags & JD_DMESG_RECORD_TEXT) {
+        uint32_t len;
+        a = get_word(a, &len, 4);
+        memcpy(line, a, len);
+        return len;
+    }
+
+    formatter_t f = {line, JD_DMESG_LINE_BUFFER - 1};
+    unsigned num_args = 0;
+    const char *p = rec->format;
+    for (;;) {
+        const char *start = p;
+        while (*p && *p != '%')
+            p++;
+        emit(&f, start, p - start);
+        if (!*p)
+            break;
+
+        // copy the directive, without '-' of %-s
+        char mini[8];
+        unsigned mlen = 0;
+        mini[mlen++] = *p++;
+#if JD_ADVANCED_STRING
+#if JD_LORA
+        while ('0' <= *p && *p <= '9') {
+            if (mlen < sizeof(mini) - 3)
+                mini[mlen++] = *p;
+            p++;
+        }
+#endif
+#if JD_FREE_SUPPORTED
+        if (p[0] == '-' && p[1] == 's')
+            p++;
+#endif
+        char c = *p;
+        if (c)
+            mini[mlen++] = *p++;
+        if (c == '*' && *p)
+            mini[mlen++] = *p++;
+        mini[mlen] = 0;
+        bool has_arg = strchr("cduxXpf*s", c) != NULL;
+#else
+        char c = *p;
+        if (c)
+            mini[mlen++] = *p++;
+        mini[mlen] = 0;
+        bool has_arg = true;
+#endif
+
+        if (!c) {
+            emit(&f, "?", 1); // trailing '%'
+            break;
+        }
+        if (!has_arg) {
+            emit_fmt(&f, mini);
+            continue;
+        }
+        if (num_args++ == rec->num_args) {
+            emit(&f, "...", 3);
+            break;
+        }
+
+        switch (c) {
+        case 's':
+            a = emit_string(&f, a);
+            break;
+#if JD_ADVANCED_STRING
+        case 'p': {
+            uintptr_t v;
+            a = get_word(a, &v, sizeof(v));
+            emit_fmt(&f, mini, v);
+            break;
+        }
+        case 'f': {
+            double v;
+            a = get_word(a, &v, sizeof(v));
+            emit_fmt(&f, mini, v);
+            break;
+        }
+        case '*': {
+            uint32_t len;
+            a = get_word(a, &len, 4);
+            emit_fmt(&f, mini, (int)len, a);
+            a += ARG_ALIGN(len);
+            break;
+        }
+        default: {
+            int v;
+            a = get_word(a, &v, sizeof(v));
+            emit_fmt(&f, mini, v);
+            break;
+        }
+#else
+        default: {
+            uint32_t v;
+            a = get_word(a, &v, sizeof(v));
+            emit_fmt(&f, mini, v);
+            break;
+        }
+#endif
+        }
+    }
+
+    int len = f.dst - line;
+#if JD_LORA || JD_ADVANCED_STRING
+    while (len && (line[len - 1] == '\r' || line[len - 1] == '\n'))
+        len--;
+#endif
+    line[len++] = '\n';
+    return len;
+}
+
+// called with IRQs disabled; 'd' is the distance of the record from head
+static unsigned find_record(uint32_t seq, uint32_t d) {
+    unsigned pos = head;
+    uint32_t cd = (cursor_seq - head_seq) & SEQ_MASK;
+    if (cd < num_records && cd <= d) {
+        pos = cursor_pos;
+        d -= cd;
+    }
+    while (d--)
+        pos = rec_next(pos);
+    cursor_seq = seq;
+    cursor_pos = pos;
+    return pos;
+}
+
+// copies the record at *seq to dst; returns 0 if there is none; jumps to the oldest record
+// (and sets *offset to 0) if *seq was already dropped
+static unsigned copy_record(uint32_t *seq, uint32_t *offset, void *dst, unsigned space) {
+    unsigned size = 0;
+    target_disable_irq();
+    uint32_t d = (*seq - head_seq) & SEQ_MASK;
+    if (d > num_records) {
+        *seq = head_seq;
+        *offset = 0;
+        d = 0;
+    }
+    if (d < num_records) {
+        jd_dmesg_record_t *rec = rec_at(find_record(*seq, d));
+        if (rec->size <= space) {
+            size = rec->size;
+            memcpy(dst, rec, size);
+        }
+    }
+    target_enable_irq();
+    return size;
+}
+
+// formats the record at *state (with its text offset) into line; returns -1 if none
+static int fetch_text(uint32_t *state, char *line) {
+    record_buf_t tmp;
+    uint32_t seq = *state & SEQ_MASK, offset = *state >> 24;
+    int len = -1;
+    if (copy_record(&seq, &offset, &tmp, sizeof(tmp)))
+        len = format_record(&tmp.hdr, line);
+    if (len >= 0 && (int)offset > len)
+        offset = len;
+    *state = seq | (offset << 24);
+    return len;
+}
+
+static void advance_text(uint32_t *state, int len, uint32_t offset) {
+    uint32_t seq = *state & SEQ_MASK;
+    if ((int)offset >= len) {
+        seq = (seq + 1) & SEQ_MASK;
+        offset = 0;
+    }
+    *state = seq | (offset << 24);
+}
+
+unsigned jd_dmesg_read(void *dst, unsigned space, uint32_t *state) {
+    char line[JD_DMESG_LINE_BUFFER + 1];
+    unsigned r = 0;
+    while (r < space) {
+        int len = fetch_text(state, line);
+        if (len < 0)
+            break;
+        uint32_t offset = *state >> 24;
+        unsigned n = len - offset;
+        if (n > space - r)
+            n = space - r;
+        memcpy((uint8_t *)dst + r, line + offset, n);
+        r += n;
+        advance_text(state, len, offset + n);
+    }
+    return r;
+}
+
+unsigned jd_dmesg_read_line(void *dst, unsigned space, uint32_t *state) {
+    char line[JD_DMESG_LINE_BUFFER + 1];
+    char *dp = dst;
+    char *endp = dp + space - 1;
+    while (dp < endp) {
+        int len = fetch_text(state, line);
+        if (len < 0)
+            break;
+        uint32_t offset = *state >> 24;
+        bool eol = false;
+        while (dp < endp && (int)offset < len) {
+            char c = line[offset++];
+            if (c == '\n') {
+                eol = true;
+                break;
+            }
+            *dp++ = c;
+        }
+        advance_text(state, len, offset);
+        if (eol)
+            break;
+    }
+    *dp = 0;
+    return dp - (char *)dst;
+}
+
+unsigned jd_dmesg_read_raw(void *dst, unsigned space, uint32_t *state) {
+    uint32_t seq = *state & SEQ_MASK, offset = 0;
+    unsigned r = 0;
+    for (;;) {
+        unsigned n = copy_record(&seq, &offset, (uint8_t *)dst + r, space - r);
+        if (!n)
+            break;
+        r += n;
+        seq = (seq + 1) & SEQ_MASK;
+    }
+    *state = seq;
+    return r;
+}
+
+uint32_t jd_dmesg_startptr(void) {
+    return head_seq;
+}
+
+uint32_t jd_dmesg_currptr(void) {
+    return (head_seq + num_records) & SEQ_MASK;
+}
+
+#endif
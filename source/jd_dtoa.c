@@ -0,0 +1,612 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+#include "jd_protocol.h"
+
+#if JD_ADVANCED_STRING
+
+// Shortest round-trip formatting of doubles, based on Ryu (https://github.com/ulfjack/ryu):
+//
+// Copyright 2018 Ulf Adams
+//
+// The contents of this file may be used under the terms of the Apache License,
+// Version 2.0.
+//
+//    (See accompanying file LICENSE-Apache or copy at
+//     http://www.apache.org/licenses/LICENSE-2.0)
+//
+// Alternatively, the contents of this file may be used under the terms of
+// the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE-Boost or copy at
+//     https://www.boost.org/LICENSE_1_0.txt)
+//
+// Unless required by applicable law or agreed to in writing, this software
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+//
+// The double tables are the "small" variant: every 26th power of 5 is stored,
+// the rest are computed with one 64x128 multiplication, and fixed up with 2-bit corrections.
+// jd_print_float() uses the float32 variant, which has smaller tables and is faster.
+
+#define DOUBLE_MANTISSA_BITS 52
+#define DOUBLE_EXPONENT_BITS 11
+#define DOUBLE_BIAS 1023
+#define DOUBLE_POW5_INV_BITCOUNT 125
+#define DOUBLE_POW5_BITCOUNT 125
+
+#define FLOAT_MANTISSA_BITS 23
+#define FLOAT_EXPONENT_BITS 8
+#define FLOAT_BIAS 127
+#define FLOAT_POW5_INV_BITCOUNT 59
+#define FLOAT_POW5_BITCOUNT 61
+
+#define POW5_TABLE_SIZE 26
+
+// generated with exact big-integer arithmetic, as in the Ryu sources
+static const uint64_t POW5_TABLE[POW5_TABLE_SIZE] = {
+    0x0000000000000001ULL, 0x0000000000000005ULL, 0x0000000000000019ULL,
+    0x000000000000007dULL, 0x0000000000000271ULL, 0x0000000000000c35ULL,
+    0x0000000000003d09ULL, 0x000000000001312dULL, 0x000000000005f5e1ULL,
+    0x00000000001dcd65ULL, 0x00000000009502f9ULL, 0x0000000002e90eddULL,
+    0x000000000e8d4a51ULL, 0x0000000048c27395ULL, 0x000000016bcc41e9ULL,
+    0x000000071afd498dULL, 0x0000002386f26fc1ULL, 0x000000b1a2bc2ec5ULL,
+    0x000003782dace9d9ULL, 0x00001158e460913dULL, 0x000056bc75e2d631ULL,
+    0x0001b1ae4d6e2ef5ULL, 0x000878678326eac9ULL, 0x002a5a058fc295edULL,
+    0x00d3c21bcecceda1ULL, 0x0422ca8b0a00a425ULL,
+};
+
+static const uint64_t POW5_SPLIT2[13][2] = {
+    {0x0000000000000000ULL, 0x1000000000000000ULL},
+    {0x0000000000000000ULL, 0x14adf4b7320334b9ULL},
+    {0x0e549208b31adb10ULL, 0x1aba4714957d300dULL},
+    {0x6dc6ad264d8f0866ULL, 0x1145b7e285bf98f5ULL},
+    {0xeb1dbd923d8596caULL, 0x1652efdc6018a1fcULL},
+    {0xb4c1b80b22ae923cULL, 0x1cda62055b2d9d83ULL},
+    {0x5bb28b4e8f7e4c30ULL, 0x12a5568b9f52f416ULL},
+    {0xf08aed437682d4fbULL, 0x1819651531f9e78fULL},
+    {0xb4ee134ad99bf150ULL, 0x1f25c186a6f04c28ULL},
+    {0x16499ecb70c25f03ULL, 0x1420eb449c8842e6ULL},
+    {0x85a56ead360865b0ULL, 0x1a03fde214caf085ULL},
+    {0x093db1d57999890bULL, 0x10cfeb353a97dad8ULL},
+    {0xcf38bb735e3f36acULL, 0x15baaf44fa52673eULL},
+};
+
+static const uint32_t POW5_OFFSETS[21] = {
+    0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x40000000,
+    0x59695995, 0x55545555, 0x56555515, 0x41150504, 0x40555410,
+    0x44555145, 0x44504540, 0x45555550, 0x40004000, 0x96440440,
+    0x55565565, 0x54454045, 0x40154151, 0x55559155, 0x51405555,
+    0x00000105,
+};
+
+static const uint64_t POW5_INV_SPLIT2[13][2] = {
+    {0x0000000000000000ULL, 0x2000000000000000ULL},
+    {0x52a6c95fc0655033ULL, 0x18c240c4aecb13bbULL},
+    {0x7ca8d50071dfc805ULL, 0x1327fc58da0f6ff5ULL},
+    {0x6520247d3556476dULL, 0x1da48ce468e7c702ULL},
+    {0x6139cdd76802e6e8ULL, 0x16ef5b40c2fc7779ULL},
+    {0xf951a7ff43de8c78ULL, 0x11bebdf578b2f391ULL},
+    {0x7be8bee8d6e957e7ULL, 0x1b758d848fac54b0ULL},
+    {0x8bd3f9e999a423e9ULL, 0x153eda614071a3b7ULL},
+    {0x0848f973cb3ee3cdULL, 0x10701bd527b4978cULL},
+    {0x153285ebb9efbfa1ULL, 0x196fbb9bb44db44dULL},
+    {0xadeee7f86c07b695ULL, 0x13ae3591f5b4d936ULL},
+    {0x4d686a4eaf182221ULL, 0x1e74404f3daada91ULL},
+    {0x98c0a106e09ebd9eULL, 0x17900ea4fda7c257ULL},
+};
+
+static const uint32_t POW5_INV_OFFSETS[19] = {
+    0xa9a99aa9, 0x595aaa9a, 0x65596555, 0x55955969, 0x95565555,
+    0x966aaaaa, 0x555559a9, 0x55565599, 0x95555555, 0x99555596,
+    0xa59a99a5, 0xaaaa55a9, 0xa6baaaa9, 0x95559555, 0x56555556,
+    0x55565a55, 0xa6a6a966, 0x5aaaaaa9, 0x00000055,
+};
+
+static const uint64_t FLOAT_POW5_INV_SPLIT[32] = {
+    0x0800000000000001ULL, 0x0666666666666667ULL, 0x051eb851eb851eb9ULL,
+    0x04189374bc6a7efaULL, 0x068db8bac710cb2aULL, 0x053e2d6238da3c22ULL,
+    0x0431bde82d7b634eULL, 0x06b5fca6af2bd216ULL, 0x055e63b88c230e78ULL,
+    0x044b82fa09b5a52dULL, 0x06df37f675ef6eaeULL, 0x057f5ff85e592558ULL,
+    0x0465e6604b7a8447ULL, 0x0709709a125da071ULL, 0x05a126e1a84ae6c1ULL,
+    0x0480ebe7b9d58567ULL, 0x0734aca5f6226f0bULL, 0x05c3bd5191b525a3ULL,
+    0x049c97747490eae9ULL, 0x0760f253edb4ab0eULL, 0x05e72843249088d8ULL,
+    0x04b8ed0283a6d3e0ULL, 0x078e480405d7b966ULL, 0x060b6cd004ac9452ULL,
+    0x04d5f0a66a23a9dbULL, 0x07bcb43d769f762bULL, 0x063090312bb2c4efULL,
+    0x04f3a68dbc8f03f3ULL, 0x07ec3daf94180651ULL, 0x065697bfa9acd1daULL,
+    0x051212ffbaf0a7e2ULL, 0x040e7599625a1fe8ULL,
+};
+
+static const uint64_t FLOAT_POW5_SPLIT[48] = {
+    0x1000000000000000ULL, 0x1400000000000000ULL, 0x1900000000000000ULL,
+    0x1f40000000000000ULL, 0x1388000000000000ULL, 0x186a000000000000ULL,
+    0x1e84800000000000ULL, 0x1312d00000000000ULL, 0x17d7840000000000ULL,
+    0x1dcd650000000000ULL, 0x12a05f2000000000ULL, 0x174876e800000000ULL,
+    0x1d1a94a200000000ULL, 0x12309ce540000000ULL, 0x16bcc41e90000000ULL,
+    0x1c6bf52634000000ULL, 0x11c37937e0800000ULL, 0x16345785d8a00000ULL,
+    0x1bc16d674ec80000ULL, 0x1158e460913d0000ULL, 0x15af1d78b58c4000ULL,
+    0x1b1ae4d6e2ef5000ULL, 0x10f0cf064dd59200ULL, 0x152d02c7e14af680ULL,
+    0x1a784379d99db420ULL, 0x108b2a2c28029094ULL, 0x14adf4b7320334b9ULL,
+    0x19d971e4fe8401e7ULL, 0x1027e72f1f128130ULL, 0x1431e0fae6d7217cULL,
+    0x193e5939a08ce9dbULL, 0x1f8def8808b02452ULL, 0x13b8b5b5056e16b3ULL,
+    0x18a6e32246c99c60ULL, 0x1ed09bead87c0378ULL, 0x13426172c74d822bULL,
+    0x1812f9cf7920e2b6ULL, 0x1e17b84357691b64ULL, 0x12ced32a16a1b11eULL,
+    0x178287f49c4a1d66ULL, 0x1d6329f1c35ca4bfULL, 0x125dfa371a19e6f7ULL,
+    0x16f578c4e0a060b5ULL, 0x1cb2d6f618c878e3ULL, 0x11efc659cf7d4b8dULL,
+    0x166bb7f0435c9e71ULL, 0x1c06a5ec5433c60dULL, 0x118427b3b4a05bc8ULL,
+};
+
+typedef struct {
+    uint64_t mantissa; // decimal digits
+    int32_t exponent;  // value is mantissa * 10^exponent
+} decimal_t;
+
+// returns e == 0 ? 1 : ceil(log_2(5^e))
+static inline int32_t pow5bits(int32_t e) {
+    return (int32_t)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+// floor(log_10(2^e))
+static inline uint32_t log10_pow2(int32_t e) {
+    return ((uint32_t)e * 78913) >> 18;
+}
+
+// floor(log_10(5^e))
+static inline uint32_t log10_pow5(int32_t e) {
+    return ((uint32_t)e * 732923) >> 20;
+}
+
+static uint32_t pow5_factor(uint64_t v) {
+    uint32_t count = 0;
+    while (v % 5 == 0) {
+        v /= 5;
+        count++;
+    }
+    return count;
+}
+
+static inline bool multiple_of_pow5(uint64_t v, uint32_t p) {
+    return pow5_factor(v) >= p;
+}
+
+static inline bool multiple_of_pow2(uint64_t v, uint32_t p) {
+    return (v & ((1ULL << p) - 1)) == 0;
+}
+
+#ifdef __SIZEOF_INT128__
+static inline uint64_t umul128(uint64_t a, uint64_t b, uint64_t *hi) {
+    unsigned __int128 r = (unsigned __int128)a * b;
+    *hi = (uint64_t)(r >> 64);
+    return (uint64_t)r;
+}
+#else
+// 32-bit targets have no 128-bit type
+static inline uint64_t umul128(uint64_t a, uint64_t b, uint64_t *hi) {
+    uint32_t a_lo = (uint32_t)a, a_hi = (uint32_t)(a >> 32);
+    uint32_t b_lo = (uint32_t)b, b_hi = (uint32_t)(b >> 32);
+    uint64_t b00 = (uint64_t)a_lo * b_lo;
+    uint64_t b01 = (uint64_t)a_lo * b_hi;
+    uint64_t b10 = (uint64_t)a_hi * b_lo;
+    uint64_t b11 = (uint64_t)a_hi * b_hi;
+    uint64_t mid1 = b10 + (b00 >> 32);
+    uint64_t mid2 = b01 + (uint32_t)mid1;
+    *hi = b11 + (mid1 >> 32) + (mid2 >> 32);
+    return (mid2 << 32) | (uint32_t)b00;
+}
+#endif
+
+// 0 < dist < 64
+static inline uint64_t shiftright128(uint64_t lo, uint64_t hi, uint32_t dist) {
+    return (hi << (64 - dist)) | (lo >> dist);
+}
+
+// (m * mul) >> j, where mul is 128 bit, and j >= 64
+static inline uint64_t mul_shift64(uint64_t m, const uint64_t *mul, int32_t j) {
+    uint64_t high1, high0;
+    uint64_t low1 = umul128(m, mul[1], &high1);
+    umul128(m, mul[0], &high0);
+    uint64_t sum = high0 + low1;
+    if (sum < high0)
+        high1++;
+    return shiftright128(sum, high1, j - 64);
+}
+
+static inline uint32_t table_corr(const uint32_t *tbl, uint32_t i) {
+    return (tbl[i / 16] >> ((i % 16) << 1)) & 3;
+}
+
+static void mul_table(uint64_t m, const uint64_t *mul, uint32_t delta, uint32_t corr,
+                      uint64_t *result) {
+    uint64_t high1, high0;
+    uint64_t low1 = umul128(m, mul[1], &high1);
+    uint64_t low0 = umul128(m, mul[0], &high0);
+    uint64_t sum = high0 + low1;
+    if (sum < high0)
+        high1++;
+    result[0] = shiftright128(low0, sum, delta) + corr;
+    result[1] = shiftright128(sum, high1, delta);
+}
+
+// 5^i, normalized to DOUBLE_POW5_BITCOUNT bits
+static void compute_pow5(uint32_t i, uint64_t *result) {
+    uint32_t base = i / POW5_TABLE_SIZE;
+    uint32_t base2 = base * POW5_TABLE_SIZE;
+    const uint64_t *mul = POW5_SPLIT2[base];
+    if (i == base2) {
+        result[0] = mul[0];
+        result[1] = mul[1];
+    } else {
+        mul_table(POW5_TABLE[i - base2], mul, pow5bits(i) - pow5bits(base2),
+                  table_corr(POW5_OFFSETS, i), result);
+    }
+}
+
+// 2^k / 5^i (plus one), normalized to DOUBLE_POW5_INV_BITCOUNT bits
+static void compute_inv_pow5(uint32_t i, uint64_t *result) {
+    uint32_t base = (i + POW5_TABLE_SIZE - 1) / POW5_TABLE_SIZE;
+    uint32_t base2 = base * POW5_TABLE_SIZE;
+    const uint64_t *mul = POW5_INV_SPLIT2[base];
+    // the bases are stored minus one, which is always fixed by the correction
+    if (i == base2) {
+        result[0] = mul[0] + table_corr(POW5_INV_OFFSETS, i);
+        result[1] = mul[1];
+    } else {
+        mul_table(POW5_TABLE[base2 - i], mul, pow5bits(base2) - pow5bits(i),
+                  table_corr(POW5_INV_OFFSETS, i), result);
+    }
+}
+
+static decimal_t d2d(uint64_t ieee_mantissa, uint32_t ieee_exponent) {
+    int32_t e2;
+    uint64_t m2;
+    if (ieee_exponent == 0) {
+        e2 = 1 - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+        m2 = ieee_mantissa;
+    } else {
+        e2 = (int32_t)ieee_exponent - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+        m2 = (1ULL << DOUBLE_MANTISSA_BITS) | ieee_mantissa;
+    }
+    bool accept_bounds = (m2 & 1) == 0;
+
+    // step 2: determine the interval of valid decimal representations
+    uint64_t mv = 4 * m2;
+    uint32_t mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+
+    // step 3: convert to a decimal power base using 128-bit arithmetic
+    uint64_t vr, vp, vm;
+    uint64_t pow5[2];
+    int32_t e10;
+    bool vm_trailing_zeros = false, vr_trailing_zeros = false;
+    if (e2 >= 0) {
+        uint32_t q = log10_pow2(e2) - (e2 > 3);
+        e10 = (int32_t)q;
+        int32_t k = DOUBLE_POW5_INV_BITCOUNT + pow5bits(q) - 1;
+        int32_t i = -e2 + (int32_t)q + k;
+        compute_inv_pow5(q, pow5);
+        vr = mul_shift64(4 * m2, pow5, i);
+        vp = mul_shift64(4 * m2 + 2, pow5, i);
+        vm = mul_shift64(4 * m2 - 1 - mm_shift, pow5, i);
+        if (q <= 21) {
+            // only one of mp, mv, and mm can be a multiple of 5, if any
+            if (mv % 5 == 0)
+                vr_trailing_zeros = multiple_of_pow5(mv, q);
+            else if (accept_bounds)
+                vm_trailing_zeros = multiple_of_pow5(mv - 1 - mm_shift, q);
+            else
+                vp -= multiple_of_pow5(mv + 2, q);
+        }
+    } else {
+        uint32_t q = log10_pow5(-e2) - (-e2 > 1);
+        e10 = (int32_t)q + e2;
+        int32_t i = -e2 - (int32_t)q;
+        int32_t k = pow5bits(i) - DOUBLE_POW5_BITCOUNT;
+        int32_t j = (int32_t)q - k;
+        compute_pow5(i, pow5);
+        vr = mul_shift64(4 * m2, pow5, j);
+        vp = mul_shift64(4 * m2 + 2, pow5, j);
+        vm = mul_shift64(4 * m2 - 1 - mm_shift, pow5, j);
+        if (q <= 1) {
+            // {vr,vp,vm} is trailing zeros if {mv,mp,mm} has at least q trailing 0 bits
+            vr_trailing_zeros = true;
+            if (accept_bounds)
+                vm_trailing_zeros = mm_shift == 1;
+            else
+                --vp;
+        } else if (q < 63) {
+            vr_trailing_zeros = multiple_of_pow2(mv, q);
+        }
+    }
+
+    // step 4: find the shortest decimal representation in the interval
+    int32_t removed = 0;
+    uint8_t last_removed = 0;
+    uint64_t output;
+    if (vm_trailing_zeros || vr_trailing_zeros) {
+        // general case, which happens rarely (~0.7%)
+        while (vp / 10 > vm / 10) {
+            vm_trailing_zeros &= vm % 10 == 0;
+            vr_trailing_zeros &= last_removed == 0;
+            last_removed = (uint8_t)(vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        if (vm_trailing_zeros) {
+            while (vm % 10 == 0) {
+                vr_trailing_zeros &= last_removed == 0;
+                last_removed = (uint8_t)(vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+        if (vr_trailing_zeros && last_removed == 5 && vr % 2 == 0)
+            last_removed = 4; // round even if the exact number is .....50..0
+        output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) || last_removed >= 5);
+    } else {
+        // specialized for the common case (~99.3%)
+        bool round_up = false;
+        if (vp / 100 > vm / 100) {
+            round_up = vr % 100 >= 50;
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+        while (vp / 10 > vm / 10) {
+            round_up = vr % 10 >= 5;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        output = vr + (vr == vm || round_up);
+    }
+
+    decimal_t r = {output, e10 + removed};
+    return r;
+}
+
+static inline uint32_t mul_shift32(uint32_t m, uint64_t factor, int32_t shift) {
+    uint64_t bits0 = (uint64_t)m * (uint32_t)factor;
+    uint64_t bits1 = (uint64_t)m * (uint32_t)(factor >> 32);
+    return (uint32_t)(((bits0 >> 32) + bits1) >> (shift - 32));
+}
+
+static decimal_t f2d(uint32_t ieee_mantissa, uint32_t ieee_exponent) {
+    int32_t e2;
+    uint32_t m2;
+    if (ieee_exponent == 0) {
+        e2 = 1 - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+        m2 = ieee_mantissa;
+    } else {
+        e2 = (int32_t)ieee_exponent - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+        m2 = (1U << FLOAT_MANTISSA_BITS) | ieee_mantissa;
+    }
+    bool accept_bounds = (m2 & 1) == 0;
+
+    uint32_t mv = 4 * m2;
+    uint32_t mp = 4 * m2 + 2;
+    uint32_t mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+    uint32_t mm = 4 * m2 - 1 - mm_shift;
+
+    uint32_t vr, vp, vm;
+    int32_t e10;
+    bool vm_trailing_zeros = false, vr_trailing_zeros = false;
+    uint8_t last_removed = 0;
+    if (e2 >= 0) {
+        uint32_t q = log10_pow2(e2);
+        e10 = (int32_t)q;
+        int32_t k = FLOAT_POW5_INV_BITCOUNT + pow5bits(q) - 1;
+        int32_t i = -e2 + (int32_t)q + k;
+        vr = mul_shift32(mv, FLOAT_POW5_INV_SPLIT[q], i);
+        vp = mul_shift32(mp, FLOAT_POW5_INV_SPLIT[q], i);
+        vm = mul_shift32(mm, FLOAT_POW5_INV_SPLIT[q], i);
+        if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+            // we need to know one removed digit even if we don't loop below
+            int32_t l = FLOAT_POW5_INV_BITCOUNT + pow5bits(q - 1) - 1;
+            last_removed =
+                (uint8_t)(mul_shift32(mv, FLOAT_POW5_INV_SPLIT[q - 1], -e2 + (int32_t)q - 1 + l) %
+                          10);
+        }
+        if (q <= 9) {
+            if (mv % 5 == 0)
+                vr_trailing_zeros = multiple_of_pow5(mv, q);
+            else if (accept_bounds)
+                vm_trailing_zeros = multiple_of_pow5(mm, q);
+            else
+                vp -= multiple_of_pow5(mp, q);
+        }
+    } else {
+        uint32_t q = log10_pow5(-e2);
+        e10 = (int32_t)q + e2;
+        int32_t i = -e2 - (int32_t)q;
+        int32_t k = pow5bits(i) - FLOAT_POW5_BITCOUNT;
+        int32_t j = (int32_t)q - k;
+        vr = mul_shift32(mv, FLOAT_POW5_SPLIT[i], j);
+        vp = mul_shift32(mp, FLOAT_POW5_SPLIT[i], j);
+        vm = mul_shift32(mm, FLOAT_POW5_SPLIT[i], j);
+        if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+            j = (int32_t)q - 1 - (pow5bits(i + 1) - FLOAT_POW5_BITCOUNT);
+            last_removed = (uint8_t)(mul_shift32(mv, FLOAT_POW5_SPLIT[i + 1], j) % 10);
+        }
+        if (q <= 1) {
+            vr_trailing_zeros = true;
+            if (accept_bounds)
+                vm_trailing_zeros = mm_shift == 1;
+            else
+                --vp;
+        } else if (q < 31) {
+            vr_trailing_zeros = multiple_of_pow2(mv, q - 1);
+        }
+    }
+
+    int32_t removed = 0;
+    uint32_t output;
+    if (vm_trailing_zeros || vr_trailing_zeros) {
+        while (vp / 10 > vm / 10) {
+            vm_trailing_zeros &= vm % 10 == 0;
+            vr_trailing_zeros &= last_removed == 0;
+            last_removed = (uint8_t)(vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        if (vm_trailing_zeros) {
+            while (vm % 10 == 0) {
+                vr_trailing_zeros &= last_removed == 0;
+                last_removed = (uint8_t)(vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+        if (vr_trailing_zeros && last_removed == 5 && vr % 2 == 0)
+            last_removed = 4;
+        output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) || last_removed >= 5);
+    } else {
+        while (vp / 10 > vm / 10) {
+            last_removed = (uint8_t)(vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        output = vr + (vr == vm || last_removed >= 5);
+    }
+
+    decimal_t r = {output, e10 + removed};
+    return r;
+}
+
+// writes digits of v (without leading zeros) to buf, returns their number
+static int format_digits(char *buf, uint64_t v) {
+    char tmp[20];
+    int n = 0;
+    do {
+        tmp[n++] = '0' + (char)(v % 10);
+        v /= 10;
+    } while (v);
+    for (int i = 0; i < n; ++i)
+        buf[i] = tmp[n - 1 - i];
+    return n;
+}
+
+// prints dec, the digits of d (positive and finite)
+static void format_decimal(char *buf, decimal_t dec, double d, int numdigits) {
+    char digits[20];
+    int len = format_digits(digits, dec.mantissa);
+    int exp10 = dec.exponent + len - 1; // d == 0.digits * 10^(exp10 + 1)
+
+    // if outside 1e-6 -- 1e21 range, we use the e-notation
+    bool e_notation = d < 1e-6 || d > 1e21;
+
+    // we're going to print out the whole number anyways, so ignore too small precision
+    if (!e_notation && numdigits > 0 && numdigits <= exp10)
+        numdigits = exp10 + 1;
+    if (numdigits > 0 && len > numdigits) {
+        bool up = digits[numdigits] >= '5';
+        len = numdigits;
+        for (int i = len - 1; up && i >= 0; --i) {
+            if (digits[i] == '9') {
+                digits[i] = '0';
+            } else {
+                digits[i]++;
+                up = false;
+            }
+        }
+        if (up) {
+            // 9.99 -> 10.0
+            digits[0] = '1';
+            exp10++;
+        }
+    }
+
+    while (len > 1 && digits[len - 1] == '0')
+        len--;
+
+    int dot_after = e_notation ? 1 : exp10 + 1; // at which position the dot should be
+
+    if (dot_after < 1) {
+        // if number is less than 1, we need 0.00...00 at the beginning
+        *buf++ = '0';
+        *buf++ = '.';
+        for (int n = -dot_after; n > 0; --n)
+            *buf++ = '0';
+    }
+
+    for (int i = 0; i < len; ++i) {
+        if (i > 0 && i == dot_after)
+            *buf++ = '.';
+        *buf++ = digits[i];
+    }
+
+    // trailing zeroes of large integers
+    for (int n = dot_after - len; n > 0; --n)
+        *buf++ = '0';
+
+    if (e_notation) {
+        *buf++ = 'e';
+        if (exp10 > 0)
+            *buf++ = '+';
+        jd_itoa(exp10, buf);
+    } else {
+        *buf = 0;
+    }
+}
+
+void jd_print_double(char *buf, double d, int numdigits) {
+    if (d < 0) {
+        *buf++ = '-';
+        d = -d;
+    }
+
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    uint64_t ieee_mantissa = bits & ((1ULL << DOUBLE_MANTISSA_BITS) - 1);
+    uint32_t ieee_exponent =
+        (uint32_t)(bits >> DOUBLE_MANTISSA_BITS) & ((1U << DOUBLE_EXPONENT_BITS) - 1);
+
+    if (ieee_exponent == (1U << DOUBLE_EXPONENT_BITS) - 1) {
+        strcpy(buf, ieee_mantissa ? "NaN" : "inf");
+        return;
+    }
+
+    if (ieee_exponent == 0 && ieee_mantissa == 0) {
+        *buf++ = '0';
+        *buf++ = 0;
+        return;
+    }
+
+    format_decimal(buf, d2d(ieee_mantissa, ieee_exponent), d, numdigits);
+}
+
+void jd_print_float(char *buf, float f, int numdigits) {
+    if (f < 0) {
+        *buf++ = '-';
+        f = -f;
+    }
+
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    uint32_t ieee_mantissa = bits & ((1U << FLOAT_MANTISSA_BITS) - 1);
+    uint32_t ieee_exponent = (bits >> FLOAT_MANTISSA_BITS) & ((1U << FLOAT_EXPONENT_BITS) - 1);
+
+    if (ieee_exponent == (1U << FLOAT_EXPONENT_BITS) - 1) {
+        strcpy(buf, ieee_mantissa ? "NaN" : "inf");
+        return;
+    }
+
+    if (ieee_exponent == 0 && ieee_mantissa == 0) {
+        *buf++ = '0';
+        *buf++ = 0;
+        return;
+    }
+
+    format_decimal(buf, f2d(ieee_mantissa, ieee_exponent), f, numdigits);
+}
+
+#endif
@@ -11,6 +11,59 @@
 
 static jd_ipipe_desc_t *ipipes;
 
+// packets less than this ahead of the expected one are out-of-order; others are duplicates
+#define COUNTER_HALF ((JD_PIPE_COUNTER_MASK + 1) / 2)
+
+#if JD_IPIPE_REORDER
+// Out-of-order packets are copied into a slot, shared by all pipes.
+// Once the expected packet arrives, the following ones are delivered from the slots.
+
+typedef struct {
+    jd_ipipe_desc_t *owner; // NULL if free
+    jd_frame_t frame;       // holds a single packet
+} ipipe_slot_t;
+
+static ipipe_slot_t *slots;
+
+static ipipe_slot_t *find_slot(jd_ipipe_desc_t *str, unsigned counter) {
+    if (!slots)
+        return NULL;
+    for (int i = 0; i < JD_IPIPE_REORDER; ++i) {
+        jd_packet_t *pkt = (jd_packet_t *)&slots[i].frame;
+        if (slots[i].owner == str &&
+            (pkt->service_command & JD_PIPE_COUNTER_MASK) == (counter & JD_PIPE_COUNTER_MASK))
+            return &slots[i];
+    }
+    return NULL;
+}
+
+static bool has_slots(jd_ipipe_desc_t *str) {
+    if (slots)
+        for (int i = 0; i < JD_IPIPE_REORDER; ++i)
+            if (slots[i].owner == str)
+                return true;
+    return false;
+}
+
+static void buffer_packet(jd_ipipe_desc_t *s, jd_packet_t *pkt) {
+    if (find_slot(s, pkt->service_command)) {
+        s->stats.num_duplicates++;
+        return;
+    }
+    if (!has_slots(s))
+        s->stats.num_gaps++;
+    if (!slots)
+        slots = jd_alloc(sizeof(ipipe_slot_t) * JD_IPIPE_REORDER);
+    for (int i = 0; i < JD_IPIPE_REORDER; ++i)
+        if (!slots[i].owner) {
+            slots[i].owner = s;
+            memcpy(&slots[i].frame, pkt, JD_SERIAL_FULL_HEADER_SIZE + pkt->service_size);
+            return;
+        }
+    s->stats.num_dropped++;
+}
+#endif
+
 static void jd_ipipe_free(jd_ipipe_desc_t *str) {
     if (ipipes == str) {
         ipipes = str->next;
@@ -21,6 +74,12 @@ static void jd_ipipe_free(jd_ipipe_desc_t *str) {
                 break;
             }
     }
+#if JD_IPIPE_REORDER
+    if (slots)
+        for (int i = 0; i < JD_IPIPE_REORDER; ++i)
+            if (slots[i].owner == str)
+                slots[i].owner = NULL;
+#endif
     str->counter = 0;
 }
 
@@ -40,6 +99,7 @@ int jd_ipipe_open(jd_ipipe_desc_t *str, jd_ipipe_handler_t handler,
     jd_ipipe_free(str);
     str->handler = handler;
     str->meta_handler = meta_handler;
+    memset(&str->stats, 0, sizeof(str->stats));
     for (;;) {
         int p = jd_random() & 511;
         if (is_free_port(p)) {
@@ -53,6 +113,23 @@ int jd_ipipe_open(jd_ipipe_desc_t *str, jd_ipipe_handler_t handler,
     return str->counter >> JD_PIPE_PORT_SHIFT;
 }
 
+// pkt has the expected counter
+static void deliver(jd_ipipe_desc_t *s, jd_packet_t *pkt) {
+    uint16_t cmd = pkt->service_command;
+    s->counter =
+        ((s->counter + 1) & JD_PIPE_COUNTER_MASK) | (s->counter & ~JD_PIPE_COUNTER_MASK);
+    s->stats.num_packets++;
+    if (cmd & JD_PIPE_METADATA_MASK) {
+        s->meta_handler(s, pkt);
+    } else {
+        s->handler(s, pkt);
+    }
+    if (cmd & JD_PIPE_CLOSE_MASK) {
+        s->meta_handler(s, NULL); // indicate EOF
+        jd_ipipe_free(s);
+    }
+}
+
 void jd_ipipe_handle_packet(jd_packet_t *pkt) {
     if (pkt->service_index != JD_SERVICE_INDEX_STREAM || jd_is_report(pkt) ||
         pkt->device_identifier != jd_device_id())
@@ -62,18 +139,31 @@ void jd_ipipe_handle_packet(jd_packet_t *pkt) {
     int port = cmd >> JD_PIPE_PORT_SHIFT;
     for (jd_ipipe_desc_t *s = ipipes; s; s = s->next) {
         if ((s->counter >> JD_PIPE_PORT_SHIFT) == port) {
-            if ((s->counter & JD_PIPE_COUNTER_MASK) == (cmd & JD_PIPE_COUNTER_MASK)) {
-                s->counter = ((s->counter + 1) & JD_PIPE_COUNTER_MASK) |
-                             (s->counter & ~JD_PIPE_COUNTER_MASK);
-                if (cmd & JD_PIPE_METADATA_MASK) {
-                    s->meta_handler(s, pkt);
-                } else {
-                    s->handler(s, pkt);
-                }
-                if (cmd & JD_PIPE_CLOSE_MASK) {
-                    s->meta_handler(s, NULL); // indicate EOF
-                    jd_ipipe_free(s);
+            unsigned dist = (cmd - s->counter) & JD_PIPE_COUNTER_MASK;
+            if (dist == 0) {
+                deliver(s, pkt);
+#if JD_IPIPE_REORDER
+                // the handler may have closed the pipe (or re-opened it on another port)
+                while ((s->counter >> JD_PIPE_PORT_SHIFT) == port) {
+                    ipipe_slot_t *slot = find_slot(s, s->counter);
+                    if (!slot)
+                        break;
+                    s->stats.num_reordered++;
+                    deliver(s, (jd_packet_t *)&slot->frame);
+                    // only free after delivery, so the handler doesn't see it overwritten
+                    if (slot->owner == s)
+                        slot->owner = NULL;
                 }
+#endif
+            } else if (dist < COUNTER_HALF) {
+#if JD_IPIPE_REORDER
+                buffer_packet(s, pkt);
+#else
+                s->stats.num_gaps++;
+                s->stats.num_dropped++;
+#endif
+            } else {
+                s->stats.num_duplicates++;
             }
             break;
         }
@@ -83,3 +173,9 @@ void jd_ipipe_handle_packet(jd_packet_t *pkt) {
 void jd_ipipe_close(jd_ipipe_desc_t *str) {
     jd_ipipe_free(str);
 }
+
+void jd_ipipe_get_stats(jd_ipipe_desc_t *str, jd_ipipe_stats_t *dst) {
+    LOCK();
+    memcpy(dst, &str->stats, sizeof(*dst));
+    UNLOCK();
+}
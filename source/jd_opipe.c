@@ -18,10 +18,223 @@ static jd_opipe_desc_t *opipes;
 int _jd_tx_push_frame(jd_frame_t *f, int wait);
 
 static int jd_opipe_send_close_pkt(jd_opipe_desc_t *str);
+static void jd_opipe_unlink(jd_opipe_desc_t *str);
+
+#if JD_OPIPE_STATS
+#define STAT_INC(str, field) ((str)->stats.field++)
+
+// RTT estimation and RTO as in RFC 6298; samples are taken from first transmissions only
+static void rtt_sample(jd_opipe_desc_t *str, uint32_t rtt) {
+    jd_opipe_stats_t *st = &str->stats;
+    if (st->num_samples == 0) {
+        st->srtt = rtt;
+        st->rttvar = rtt / 2;
+        st->rtt_min = rtt;
+    } else {
+        uint32_t err = st->srtt > rtt ? st->srtt - rtt : rtt - st->srtt;
+        st->rttvar = st->rttvar - st->rttvar / 4 + err / 4;
+        st->srtt = st->srtt - st->srtt / 8 + rtt / 8;
+    }
+    st->num_samples++;
+    if (rtt < st->rtt_min)
+        st->rtt_min = rtt;
+    if (rtt > st->rtt_max)
+        st->rtt_max = rtt;
+
+    uint32_t rto = st->srtt + 4 * st->rttvar;
+    if (rto < JD_OPIPE_RTO_MIN)
+        rto = JD_OPIPE_RTO_MIN;
+    if (rto > JD_OPIPE_RTO_MAX)
+        rto = JD_OPIPE_RTO_MAX;
+    st->rto = rto;
+    st->backoff = 0;
+}
+
+static uint32_t rto_timeout(jd_opipe_desc_t *str) {
+    uint32_t rto = str->stats.rto << str->stats.backoff;
+    return rto > JD_OPIPE_RTO_MAX ? JD_OPIPE_RTO_MAX : rto;
+}
+
+// on timeout or TX queue overflow
+static void rto_backoff(jd_opipe_desc_t *str) {
+    if (rto_timeout(str) < JD_OPIPE_RTO_MAX)
+        str->stats.backoff++;
+}
+#else
+#define STAT_INC(str, field) ((void)0)
+// without RTT samples, the timeout is doubled with every retry
+#define rtt_sample(str, rtt) ((void)0)
+#define rto_backoff(str) ((void)0)
+static uint32_t rto_timeout(jd_opipe_desc_t *str) {
+    return (4 * 1024) << str->curr_retry;
+}
+#endif
+
+#if JD_OPIPE_FRAME_POOL
+// With the frame pool, descriptors borrow frames (slots) from a buffer shared by all pipes.
+// The slot with seq == next_seq is being filled. Once full (or flushed), it's sent,
+// and up to WINDOW_SIZE slots can be in flight. A new slot is borrowed for further writes.
+// Only the oldest slot is released, when its ACK comes; see jd_opipe_handle_packet().
+// When the oldest slot times out, it and all the following ones are re-sent,
+// since the receiver drops (but still ACKs) out-of-order packets.
+// curr_retry and retry_time refer to the oldest slot of the pipe.
+
+#if JD_OPIPE_WINDOW > 127
+#error "JD_OPIPE_WINDOW too large"
+#endif
+
+#define WINDOW_SIZE (JD_OPIPE_WINDOW ? JD_OPIPE_WINDOW : 1)
+
+#define SLOT_SENT 0x01
+#define SLOT_RESENT 0x02 // no RTT sample
+
+// frames in flight are queued for TX before the ACK of the oldest one can come back
+#define FRAME_WIRE_US ((JD_SERIAL_PAYLOAD_SIZE + 16) * 10)
+
+typedef struct {
+    jd_opipe_desc_t *owner; // NULL if free
+    uint8_t seq;
+    uint8_t flags;
+#if JD_OPIPE_STATS
+    uint32_t sent_time;
+#endif
+    jd_frame_t frame;
+} opipe_slot_t;
+
+static opipe_slot_t *slots;
+
+static opipe_slot_t *find_slot(jd_opipe_desc_t *str, uint8_t seq) {
+    if (!slots)
+        return NULL;
+    for (int i = 0; i < JD_OPIPE_FRAME_POOL; ++i)
+        if (slots[i].owner == str && slots[i].seq == seq)
+            return &slots[i];
+    return NULL;
+}
+
+// returns NULL if there is no frame being filled, and alloc is not set or the pool is empty
+static jd_frame_t *fill_frame(jd_opipe_desc_t *str, bool alloc) {
+    opipe_slot_t *slot = find_slot(str, str->next_seq);
+    if (slot)
+        return &slot->frame;
+    if (!alloc)
+        return NULL;
+    if (!slots)
+        slots = jd_alloc(sizeof(opipe_slot_t) * JD_OPIPE_FRAME_POOL);
+    for (int i = 0; i < JD_OPIPE_FRAME_POOL; ++i) {
+        slot = &slots[i];
+        if (slot->owner)
+            continue;
+        slot->owner = str;
+        slot->seq = str->next_seq;
+        slot->flags = 0;
+        jd_frame_t *f = &slot->frame;
+        jd_reset_frame(f);
+        f->device_identifier = str->device_identifier;
+        f->flags = JD_FRAME_FLAG_COMMAND | JD_FRAME_FLAG_ACK_REQUESTED;
+        return f;
+    }
+    STAT_INC(str, num_pool_waits);
+    return NULL;
+}
+
+static unsigned pending_size(jd_opipe_desc_t *str) {
+    jd_frame_t *f = fill_frame(str, false);
+    return f ? f->size : 0;
+}
+
+static unsigned num_in_flight(jd_opipe_desc_t *str) {
+    return (uint8_t)(str->next_seq - str->head_seq);
+}
+
+// RTT samples come from frames sent as they fill up, and don't include the time to drain
+// a window sent (or re-sent) at once
+static uint32_t retry_delay(jd_opipe_desc_t *str) {
+    return rto_timeout(str) + num_in_flight(str) * FRAME_WIRE_US;
+}
+
+static void free_slots(jd_opipe_desc_t *str) {
+    if (!slots)
+        return;
+    for (int i = 0; i < JD_OPIPE_FRAME_POOL; ++i)
+        if (slots[i].owner == str)
+            slots[i].owner = NULL;
+    str->head_seq = str->next_seq;
+}
+
+// send frames not sent yet; if 'all' is set, re-send everything in flight
+static int send_window(jd_opipe_desc_t *str, bool all) {
+    uint8_t seq;
+    // mark all of them first, in case the TX queue overflows below
+    for (seq = str->head_seq; all && seq != str->next_seq; seq++) {
+        opipe_slot_t *slot = find_slot(str, seq);
+        JD_ASSERT(slot != NULL);
+        if (slot->flags & SLOT_SENT)
+            slot->flags = SLOT_RESENT;
+    }
+    for (seq = str->head_seq; seq != str->next_seq; seq++) {
+        opipe_slot_t *slot = find_slot(str, seq);
+        if (slot->flags & SLOT_SENT)
+            continue;
+        if (jd_send_frame(&slot->frame) != 0)
+            // in case of ovf, the rest is sent later
+            return seq == str->head_seq ? -1 : 0;
+        if (slot->flags & SLOT_RESENT) {
+            STAT_INC(str, num_retransmits);
+        } else {
+#if JD_OPIPE_STATS
+            slot->sent_time = now;
+#endif
+            STAT_INC(str, num_frames);
+        }
+        slot->flags |= SLOT_SENT;
+    }
+    return 0;
+}
+
+// packet counters of everything that was not ACKed must be distinct
+static bool counter_space_left(jd_opipe_desc_t *str) {
+    if (!num_in_flight(str))
+        return true;
+    jd_packet_t *head = (jd_packet_t *)&find_slot(str, str->head_seq)->frame;
+    return ((str->counter - head->service_command) & JD_PIPE_COUNTER_MASK) != 0;
+}
+
+static void release_head(jd_opipe_desc_t *str) {
+    find_slot(str, str->head_seq)->owner = NULL;
+    str->head_seq++;
+
+    if (num_in_flight(str)) {
+        // restart the timer for the new oldest frame
+        str->curr_retry = 2;
+        str->retry_time = now + retry_delay(str);
+        return;
+    }
+
+    str->curr_retry = 0;
+    if (str->status == ST_CLOSED_WAITING && pending_size(str) == 0) {
+        jd_opipe_unlink(str);
+    } else if (str->status == ST_CLOSED_UNSENT) {
+        jd_opipe_send_close_pkt(str);
+    }
+}
+#else
+#if JD_OPIPE_WINDOW
+#error "JD_OPIPE_WINDOW requires JD_OPIPE_FRAME_POOL"
+#endif
+#define free_slots(str) ((void)0)
+#define retry_delay(str) rto_timeout(str)
+#define fill_frame(str, alloc) (&(str)->frame)
+#define pending_size(str) ((str)->frame.size)
+#endif
 
 static void jd_opipe_unlink(jd_opipe_desc_t *str) {
     if (str->status == ST_FREE)
         return;
+    free_slots(str);
+#if JD_OPIPE_STATS
+    jd_opipe_stats_t stats = str->stats;
+#endif
     if (opipes == str) {
         opipes = str->next;
     } else {
@@ -32,21 +245,31 @@ static void jd_opipe_unlink(jd_opipe_desc_t *str) {
             }
     }
     memset(str, 0, sizeof(*str));
+#if JD_OPIPE_STATS
+    str->stats = stats;
+#endif
 }
 
 int jd_opipe_open(jd_opipe_desc_t *str, uint64_t device_id, uint16_t port_num) {
     if (device_id == 0)
         return JD_PIPE_ERROR;
 
-    jd_frame_t *f = &str->frame;
-
     LOCK();
     jd_opipe_unlink(str);
+#if JD_OPIPE_FRAME_POOL
+    str->device_identifier = device_id;
+#else
+    jd_frame_t *f = &str->frame;
     f->device_identifier = device_id;
     f->flags = JD_FRAME_FLAG_COMMAND | JD_FRAME_FLAG_ACK_REQUESTED;
+#endif
     str->counter = port_num << JD_PIPE_PORT_SHIFT;
     str->status = ST_OPEN;
     str->curr_retry = 0;
+#if JD_OPIPE_STATS
+    memset(&str->stats, 0, sizeof(str->stats));
+    str->stats.rto = JD_OPIPE_RTO_INIT;
+#endif
     str->next = opipes;
     opipes = str;
     UNLOCK();
@@ -71,9 +294,27 @@ void jd_opipe_handle_packet(jd_packet_t *pkt) {
     if (pkt->service_index != JD_SERVICE_INDEX_CRC_ACK || (pkt->flags & JD_FRAME_FLAG_COMMAND))
         return;
     LOCK();
+#if JD_OPIPE_FRAME_POOL
+    // Only the ACK of the oldest slot counts. The receiver also ACKs frames it drops because
+    // an earlier one was lost, and a late ACK of such a copy looks the same as the ACK of
+    // the re-sent one. ACKs come in order, so an ACK that comes after the one of the
+    // previous slot is for a copy received after that slot was accepted.
+    for (jd_opipe_desc_t *str = opipes; str; str = str->next) {
+        opipe_slot_t *slot = num_in_flight(str) ? find_slot(str, str->head_seq) : NULL;
+        if (slot && (slot->flags & SLOT_SENT) && pkt->service_command == slot->frame.crc &&
+            slot->frame.device_identifier == pkt->device_identifier) {
+            if (!(slot->flags & SLOT_RESENT))
+                rtt_sample(str, now - slot->sent_time);
+            release_head(str);
+            break;
+        }
+    }
+#else
     for (jd_opipe_desc_t *str = opipes; str; str = str->next) {
         if (str->curr_retry && pkt->service_command == str->frame.crc &&
             str->frame.device_identifier == pkt->device_identifier) {
+            if (str->curr_retry == 2) // sent only once
+                rtt_sample(str, now - str->sent_time);
             str->curr_retry = 0;
             jd_reset_frame(&str->frame);
             if (str->status == ST_CLOSED_WAITING) {
@@ -83,25 +324,72 @@ void jd_opipe_handle_packet(jd_packet_t *pkt) {
             }
         }
     }
+#endif
     UNLOCK();
 }
 
+static int do_flush(jd_opipe_desc_t *str);
+
+// send, or re-send from the oldest frame on timeout
+static int send_pending(jd_opipe_desc_t *str, bool timeout) {
+#if JD_OPIPE_FRAME_POOL
+    return send_window(str, timeout);
+#else
+    if (!timeout)
+        return 0;
+    if (jd_send_frame(&str->frame) != 0)
+        return -1;
+    if (str->curr_retry == 1) {
+#if JD_OPIPE_STATS
+        str->sent_time = now;
+#endif
+        STAT_INC(str, num_frames);
+    } else {
+        STAT_INC(str, num_retransmits);
+    }
+    return 0;
+#endif
+}
+
 void jd_opipe_process(void) {
     LOCK();
     for (jd_opipe_desc_t *str = opipes; str; str = str->next) {
-        if (str->curr_retry && in_past(str->retry_time)) {
+#if JD_OPIPE_FRAME_POOL
+        opipe_slot_t *fill = find_slot(str, str->next_seq);
+        if (fill && fill->frame.size == 0)
+            // jd_opipe_check_space() was not followed by write; return the frame to the pool
+            fill->owner = NULL;
+        else if (fill && str->status == ST_CLOSED_WAITING)
+            // the close packet didn't fit in the window before
+            do_flush(str);
+#endif
+        if (str->curr_retry && !in_past(str->retry_time)) {
+            send_pending(str, false);
+        } else if (str->curr_retry) {
             if (str->curr_retry < JD_OPIPE_MAX_RETRIES + 1) {
-                if (jd_send_frame(&str->frame) == 0) {
-                    str->retry_time = now + ((4 * 1024) << str->curr_retry);
+                if (send_pending(str, true) == 0) {
+                    if (str->curr_retry > 1) {
+                        STAT_INC(str, num_timeouts);
+                        rto_backoff(str);
+                    }
+                    str->retry_time = now + retry_delay(str);
                     str->curr_retry++;
                 } else {
-                    // in case of ovf, give it some time
-                    str->retry_time = now + (64 << 10);
+                    // in case of ovf, the bus is busy; give it some time
+                    STAT_INC(str, num_tx_overflows);
+                    rto_backoff(str);
+                    str->retry_time = now + retry_delay(str);
                 }
             } else if (str->curr_retry == JD_OPIPE_MAX_RETRIES + 1) {
-                str->retry_time = now + 32 * 1024; // grace period for final ACK
+                // grace period for final ACK
+                STAT_INC(str, num_timeouts);
+                rto_backoff(str);
+                uint32_t grace = rto_timeout(str);
+                str->retry_time = now + (grace < 32 * 1024 ? 32 * 1024 : grace);
                 str->curr_retry++;
             } else {
+                free_slots(str);
+                str->curr_retry = 0;
                 str->status = ST_DROPPED;
             }
         }
@@ -109,11 +397,27 @@ void jd_opipe_process(void) {
     UNLOCK();
 }
 
-static void do_flush(jd_opipe_desc_t *str) {
+// returns JD_PIPE_TRY_AGAIN if the window is full
+static int do_flush(jd_opipe_desc_t *str) {
+#if JD_OPIPE_FRAME_POOL
+    opipe_slot_t *slot = find_slot(str, str->next_seq);
+    if (!slot || slot->frame.size == 0)
+        return JD_PIPE_OK;
+    if (num_in_flight(str) >= WINDOW_SIZE)
+        return JD_PIPE_TRY_AGAIN;
+    jd_compute_crc(&slot->frame);
+    str->next_seq++;
+    if (str->curr_retry == 0) {
+        str->curr_retry = 1;
+        str->retry_time = now;
+    }
+#else
     JD_ASSERT(str->curr_retry == 0);
     jd_compute_crc(&str->frame);
     str->curr_retry = 1;
     str->retry_time = now;
+#endif
+    return JD_PIPE_OK;
 }
 
 int jd_opipe_check_space(jd_opipe_desc_t *str, unsigned len) {
@@ -121,6 +425,17 @@ int jd_opipe_check_space(jd_opipe_desc_t *str, unsigned len) {
         return JD_PIPE_TIMEOUT;
     if (str->status != ST_OPEN)
         return JD_PIPE_ERROR;
+#if JD_OPIPE_FRAME_POOL
+    if (!counter_space_left(str))
+        return JD_PIPE_TRY_AGAIN;
+    jd_frame_t *f = fill_frame(str, false);
+    if (f && f->size + 4 + len <= JD_SERIAL_PAYLOAD_SIZE)
+        return JD_PIPE_OK;
+    // the full frame is sent if there is space in the window, and a new one is borrowed
+    if (do_flush(str) != JD_PIPE_OK || 4 + len > JD_SERIAL_PAYLOAD_SIZE)
+        return JD_PIPE_TRY_AGAIN;
+    return fill_frame(str, true) ? JD_PIPE_OK : JD_PIPE_TRY_AGAIN;
+#else
     if (str->curr_retry != 0)
         return JD_PIPE_TRY_AGAIN;
 
@@ -129,6 +444,17 @@ int jd_opipe_check_space(jd_opipe_desc_t *str, unsigned len) {
 
     do_flush(str);
     return JD_PIPE_TRY_AGAIN;
+#endif
+}
+
+// jd_opipe_check_space(str, len) has to be OK
+static void *push_packet(jd_opipe_desc_t *str, unsigned len, int flags) {
+    jd_frame_t *f = fill_frame(str, false);
+    void *trg = jd_push_in_frame(f, JD_SERVICE_INDEX_STREAM, str->counter | flags, len);
+    JD_ASSERT(trg != NULL);
+    str->counter =
+        ((str->counter + 1) & JD_PIPE_COUNTER_MASK) | (str->counter & ~JD_PIPE_COUNTER_MASK);
+    return trg;
 }
 
 static int jd_opipe_write_ex(jd_opipe_desc_t *str, const void *data, unsigned len, int flags) {
@@ -136,17 +462,35 @@ static int jd_opipe_write_ex(jd_opipe_desc_t *str, const void *data, unsigned le
     if (r)
         return r;
 
-    void *trg = jd_push_in_frame(&str->frame, JD_SERVICE_INDEX_STREAM, str->counter | flags, len);
-    JD_ASSERT(trg != NULL);
-    memcpy(trg, data, len);
-    str->counter =
-        ((str->counter + 1) & JD_PIPE_COUNTER_MASK) | (str->counter & ~JD_PIPE_COUNTER_MASK);
+    void *trg = push_packet(str, len, flags);
+    if (len)
+        memcpy(trg, data, len);
+
+    return JD_PIPE_OK;
+}
+
+void *jd_opipe_begin_write(jd_opipe_desc_t *str, unsigned min, unsigned max, unsigned *size) {
+    JD_ASSERT(min <= max);
+    if (jd_opipe_check_space(str, min) != JD_PIPE_OK)
+        return NULL;
+    jd_frame_t *f = fill_frame(str, false);
+    unsigned space = JD_SERIAL_PAYLOAD_SIZE - 4 - f->size;
+    if (size)
+        *size = space < max ? space : max;
+    // jd_push_in_frame() in jd_opipe_end_write() will put the packet header before this
+    return f->data + f->size + 4;
+}
 
+int jd_opipe_end_write(jd_opipe_desc_t *str, unsigned used) {
+    jd_frame_t *f = fill_frame(str, false);
+    JD_ASSERT(f != NULL && str->status == ST_OPEN);
+    JD_ASSERT(f->size + 4 + used <= JD_SERIAL_PAYLOAD_SIZE);
+    push_packet(str, used, 0);
     return JD_PIPE_OK;
 }
 
 int jd_opipe_flush(jd_opipe_desc_t *str) {
-    if (str->status == ST_OPEN && str->curr_retry == 0 && str->frame.size == 0)
+    if (str->status == ST_OPEN && str->curr_retry == 0 && pending_size(str) == 0)
         return JD_PIPE_OK;
     return jd_opipe_check_space(str, 0x100000);
 }
@@ -164,7 +508,7 @@ static int jd_opipe_send_close_pkt(jd_opipe_desc_t *str) {
     int r = jd_opipe_write_ex(str, NULL, 0, JD_PIPE_CLOSE_MASK | JD_PIPE_METADATA_MASK);
     if (r == JD_PIPE_OK) {
         str->status = ST_CLOSED_WAITING;
-        do_flush(str);
+        do_flush(str); // if the window is full, retried in jd_opipe_process()
         return JD_PIPE_TRY_AGAIN;
     } else {
         str->status = ST_CLOSED_UNSENT;
@@ -172,6 +516,14 @@ static int jd_opipe_send_close_pkt(jd_opipe_desc_t *str) {
     }
 }
 
+#if JD_OPIPE_STATS
+void jd_opipe_get_stats(jd_opipe_desc_t *str, jd_opipe_stats_t *dst) {
+    LOCK();
+    memcpy(dst, &str->stats, sizeof(*dst));
+    UNLOCK();
+}
+#endif
+
 int jd_opipe_close(jd_opipe_desc_t *str) {
     switch (str->status) {
     case ST_DROPPED:
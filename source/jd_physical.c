@@ -3,6 +3,10 @@
 
 #include "jd_protocol.h"
 
+#if JD_QUEUE_STATS && JD_USB_BRIDGE
+#include "interfaces/jd_usb.h"
+#endif
+
 #if JD_PHYSICAL
 
 // Enabling logging can cause delays and dropped packets!
@@ -18,13 +22,151 @@ static void set_tick_timer(uint8_t statusClear);
 static volatile uint8_t phys_status;
 
 static jd_frame_t *txFrame;
+static uint32_t start_tx;
 static uint64_t nextAnnounce;
 static uint8_t txPending;
+static jd_tx_backoff_t txBackoff;
 
 static jd_diagnostics_t jd_diagnostics;
 
+#if JD_BUS_STATS
+#define SECOND_US 1000000
+
+static jd_bus_stats_t bus_curr, bus_minute_acc, bus_last_second, bus_last_minute;
+static uint32_t bus_window_start, bus_rx_start;
+static uint8_t bus_seconds;
+
+static void bus_stats_add(jd_bus_stats_t *dst, const jd_bus_stats_t *src) {
+    dst->duration_us += src->duration_us;
+    dst->busy_us += src->busy_us;
+    dst->rx_frames += src->rx_frames;
+    dst->rx_bytes += src->rx_bytes;
+    dst->rx_errors += src->rx_errors;
+    dst->tx_frames += src->tx_frames;
+    dst->tx_bytes += src->tx_bytes;
+    dst->tx_races += src->tx_races;
+    dst->tx_wait_total_us += src->tx_wait_total_us;
+    if (src->tx_wait_max_us > dst->tx_wait_max_us)
+        dst->tx_wait_max_us = src->tx_wait_max_us;
+    dst->rx_queued += src->rx_queued;
+    dst->rx_handling_total_us += src->rx_handling_total_us;
+    if (src->rx_handling_max_us > dst->rx_handling_max_us)
+        dst->rx_handling_max_us = src->rx_handling_max_us;
+}
+
+// has to be called with IRQs disabled
+static void bus_stats_roll(uint32_t t) {
+    if (t - bus_window_start < SECOND_US)
+        return;
+
+    if (t - bus_window_start > 120 * SECOND_US) {
+        // idle for a long time (or first call) - start from scratch
+        memset(&bus_curr, 0, sizeof(bus_curr));
+        memset(&bus_minute_acc, 0, sizeof(bus_minute_acc));
+        memset(&bus_last_second, 0, sizeof(bus_last_second));
+        memset(&bus_last_minute, 0, sizeof(bus_last_minute));
+        bus_last_second.duration_us = SECOND_US;
+        bus_last_minute.duration_us = 60 * SECOND_US;
+        bus_window_start = t;
+        bus_seconds = 0;
+        return;
+    }
+
+    while (t - bus_window_start >= SECOND_US) {
+        bus_curr.duration_us = SECOND_US;
+        bus_last_second = bus_curr;
+        bus_stats_add(&bus_minute_acc, &bus_curr);
+        memset(&bus_curr, 0, sizeof(bus_curr));
+        bus_window_start += SECOND_US;
+        if (++bus_seconds == 60) {
+            bus_last_minute = bus_minute_acc;
+            memset(&bus_minute_acc, 0, sizeof(bus_minute_acc));
+            bus_seconds = 0;
+        }
+    }
+}
+
+static void bus_stats_busy(uint32_t start, uint32_t t) {
+    bus_stats_roll(t);
+    bus_curr.busy_us += t - start;
+}
+
+static void bus_stats_rx_start(void) {
+    bus_rx_start = tim_get_micros();
+}
+
+// empty frames are noise; they only count towards busy time
+static void bus_stats_rx_done(bool is_frame) {
+    target_disable_irq();
+    bus_stats_busy(bus_rx_start, tim_get_micros());
+    if (is_frame)
+        bus_curr.rx_frames++;
+    target_enable_irq();
+}
+
+static void bus_stats_rx_error(void) {
+    target_disable_irq();
+    bus_curr.rx_errors++;
+    target_enable_irq();
+}
+
+// only for frames successfully pushed to the RX queue
+static void bus_stats_rx_queued(uint32_t received, unsigned size) {
+    target_disable_irq();
+    uint32_t d = tim_get_micros() - received;
+    bus_curr.rx_queued++;
+    bus_curr.rx_bytes += size;
+    bus_curr.rx_handling_total_us += d;
+    if (d > bus_curr.rx_handling_max_us)
+        bus_curr.rx_handling_max_us = d;
+    target_enable_irq();
+}
+
+static void bus_stats_tx_start(unsigned size) {
+    target_disable_irq();
+    bus_stats_roll(start_tx);
+    uint32_t d = start_tx - jd_tx_frame_queued_at();
+    bus_curr.tx_frames++;
+    bus_curr.tx_bytes += size;
+    bus_curr.tx_wait_total_us += d;
+    if (d > bus_curr.tx_wait_max_us)
+        bus_curr.tx_wait_max_us = d;
+    target_enable_irq();
+}
+
+static void bus_stats_tx_race(void) {
+    target_disable_irq();
+    bus_curr.tx_races++;
+    target_enable_irq();
+}
+
+void jd_get_bus_stats(jd_bus_stats_t *last_second, jd_bus_stats_t *last_minute) {
+    target_disable_irq();
+    bus_stats_roll(tim_get_micros());
+    if (last_second)
+        *last_second = bus_last_second;
+    if (last_minute)
+        *last_minute = bus_last_minute;
+    target_enable_irq();
+}
+#else
+#define bus_stats_rx_start() ((void)0)
+#define bus_stats_rx_done(is_frame) ((void)0)
+#define bus_stats_rx_error() ((void)0)
+#define bus_stats_rx_queued(received, size) ((void)0)
+#define bus_stats_tx_start(size) ((void)0)
+#define bus_stats_tx_race() ((void)0)
+#endif
+
 jd_diagnostics_t *jd_get_diagnostics(void) {
-    jd_diagnostics.bus_state = 0; // TODO?
+    jd_diagnostics.bus_state = phys_status;
+#if JD_QUEUE_STATS
+    jd_tx_queue_stats(&jd_diagnostics.send_queue, false);
+    jd_rx_queue_stats(&jd_diagnostics.rx_queue, false);
+#if JD_USB_BRIDGE
+    jd_usb_queue_stats(&jd_diagnostics.usb_queue, false);
+#endif
+#endif
     return &jd_diagnostics;
 }
 
@@ -43,12 +185,16 @@ static void tx_done(void) {
 
 void jd_tx_completed(int errCode) {
     LOG("tx done: %d", errCode);
+#if JD_BUS_STATS
+    target_disable_irq();
+    bus_stats_busy(start_tx, tim_get_micros());
+    target_enable_irq();
+#endif
     jd_tx_frame_sent(txFrame);
     txFrame = NULL;
     tx_done();
 }
 
-static uint32_t start_tx;
 static void tick(void) {
     if (phys_status & JD_STATUS_TX_ACTIVE) {
         uint32_t d = tim_get_micros() - start_tx;
@@ -66,6 +212,9 @@ static void flush_tx_queue(void) {
     LOG("flush %d", phys_status);
     target_disable_irq();
     if (phys_status & (JD_STATUS_RX_ACTIVE | JD_STATUS_TX_ACTIVE)) {
+        // someone else got the line first; we'll retry when they're done
+        if (phys_status & JD_STATUS_RX_ACTIVE)
+            jd_tx_backoff_lost(&txBackoff);
         target_enable_irq();
         return;
     }
@@ -88,11 +237,17 @@ static void flush_tx_queue(void) {
     if (uart_start_tx(txFrame, JD_FRAME_SIZE(txFrame)) < 0) {
         // ERROR("race on TX");
         jd_diagnostics.bus_lo_error++;
-        tx_done();
+        bus_stats_tx_race();
+        jd_tx_backoff_lost(&txBackoff);
+        // set before tx_done(), so that a retry is scheduled, unless RX is already in progress
         txPending = 1;
+        tx_done();
         return;
     }
 
+    jd_tx_backoff_won(&txBackoff);
+
+    bus_stats_tx_start(JD_FRAME_SIZE(txFrame));
     set_tick_timer(0);
 }
 
@@ -109,7 +264,7 @@ static void set_tick_timer(uint8_t statusClear) {
             // (when the line below is uncommented)
             // tim_set_timer(150 - JD_WR_OVERHEAD, flush_tx_queue);
             phys_status |= JD_STATUS_TX_QUEUED;
-            tim_set_timer(jd_random_around(150) - JD_WR_OVERHEAD, flush_tx_queue);
+            tim_set_timer(jd_tx_backoff_delay(&txBackoff) - JD_WR_OVERHEAD, flush_tx_queue);
         } else {
             phys_status &= ~JD_STATUS_TX_QUEUED;
             tim_set_timer(JD_MIN_MAX_SLEEP, tick);
@@ -121,6 +276,8 @@ static void set_tick_timer(uint8_t statusClear) {
 static void rx_timeout(void) {
     target_disable_irq();
     jd_diagnostics.bus_timeout_error++;
+    bus_stats_rx_done(true);
+    bus_stats_rx_error();
     LINE_ERROR("RX t/o");
     uart_disable();
     jd_debug_signal_read(0);
@@ -151,6 +308,7 @@ void jd_line_falling(void) {
     LOG("line fall");
 
     jd_debug_signal_read(1);
+    bus_stats_rx_start();
 
     // target_disable_irq();
     // no need to disable IRQ - we're at the highest IRQ level
@@ -188,11 +346,16 @@ void jd_line_falling(void) {
 void jd_rx_completed(int dataLeft) {
     LOG("rx cmpl");
     jd_frame_t *frame = &rxFrame;
+#if JD_BUS_STATS
+    uint32_t received = tim_get_micros();
+#endif
 
     jd_debug_signal_read(0);
 
     set_tick_timer(JD_STATUS_RX_ACTIVE);
 
+    bus_stats_rx_done(frame->size != 0);
+
     if (frame->size == 0) {
         // TODO we can't report it, since it happens *very often* when line is held down on ESP32
         return;
@@ -201,6 +364,7 @@ void jd_rx_completed(int dataLeft) {
     if (dataLeft < 0) {
         LINE_ERROR("rx err: %d", dataLeft);
         jd_diagnostics.bus_uart_error++;
+        bus_stats_rx_error();
         return;
     }
 
@@ -209,6 +373,7 @@ void jd_rx_completed(int dataLeft) {
     if (txSize < declaredSize) {
         LINE_ERROR("short frm");
         jd_diagnostics.bus_uart_error++;
+        bus_stats_rx_error();
         return;
     }
 
@@ -216,6 +381,7 @@ void jd_rx_completed(int dataLeft) {
     if (crc != frame->crc) {
         LINE_ERROR("crc err");
         jd_diagnostics.bus_uart_error++;
+        bus_stats_rx_error();
         return;
     }
 
@@ -223,6 +389,7 @@ void jd_rx_completed(int dataLeft) {
         ((jd_packet_t *)frame)->service_size > JD_SERIAL_PAYLOAD_SIZE) {
         LINE_ERROR("bad size");
         jd_diagnostics.bus_uart_error++;
+        bus_stats_rx_error();
         return;
     }
 
@@ -239,6 +406,8 @@ void jd_rx_completed(int dataLeft) {
     if (err) {
         LINE_ERROR("drop RX");
         jd_diagnostics.packets_dropped++;
+    } else {
+        bus_stats_rx_queued(received, declaredSize);
     }
 }
 
@@ -0,0 +1,93 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+#include "jd_protocol.h"
+
+#if JD_PROFILE
+
+#define LOG(fmt, ...) DMESG("prof: " fmt, ##__VA_ARGS__)
+
+static const char *phase_names[JD_PROFILE_NUM_PHASES] = {
+    "events", "status", "opipe", "client", "trace", "lstore", "usb", "wifi", "app", "routing",
+};
+
+static jd_profile_entry_t *entries;
+static uint8_t num_services;
+static uint32_t reset_time;
+
+void jd_profile_init(unsigned num_serv) {
+    jd_free(entries);
+    num_services = num_serv;
+    entries = jd_alloc(sizeof(jd_profile_entry_t) * jd_profile_num_entries());
+    reset_time = JD_PROFILE_TICKS();
+}
+
+unsigned jd_profile_num_entries(void) {
+    return JD_PROFILE_NUM_PHASES + 2 * num_services;
+}
+
+jd_profile_entry_t *jd_profile_get(unsigned entry) {
+    if (!entries || entry >= jd_profile_num_entries())
+        return NULL;
+    return &entries[entry];
+}
+
+void jd_profile_add(unsigned entry, uint32_t start) {
+    uint32_t delta = JD_PROFILE_TICKS() - start;
+    jd_profile_entry_t *e = jd_profile_get(entry);
+    if (!e)
+        return;
+    e->total += delta;
+    e->calls++;
+    if (delta > e->max)
+        e->max = delta;
+}
+
+void jd_profile_reset(void) {
+    if (entries)
+        memset(entries, 0, sizeof(jd_profile_entry_t) * jd_profile_num_entries());
+    reset_time = JD_PROFILE_TICKS();
+}
+
+static void dump_entry(const char *name, jd_profile_entry_t *e) {
+    if (!e->calls)
+        return;
+    LOG("%s: %u us total, %u calls, avg %u max %u us", name,
+        (unsigned)(e->total / JD_PROFILE_TICKS_PER_US), (unsigned)e->calls,
+        (unsigned)(e->total / e->calls / JD_PROFILE_TICKS_PER_US),
+        (unsigned)(e->max / JD_PROFILE_TICKS_PER_US));
+}
+
+void jd_profile_dump(void) {
+    if (!entries)
+        return;
+    uint32_t elapsed = JD_PROFILE_TICKS() - reset_time;
+    LOG("%u us since reset", (unsigned)(elapsed / JD_PROFILE_TICKS_PER_US));
+    for (int i = 0; i < JD_PROFILE_NUM_PHASES; ++i)
+        dump_entry(phase_names[i], &entries[i]);
+    char name[16];
+    for (int i = 0; i < num_services; ++i) {
+        jd_sprintf(name, sizeof(name), "process#%d", i);
+        dump_entry(name, &entries[JD_PROFILE_SERVICE_PROCESS(i)]);
+        jd_sprintf(name, sizeof(name), "pkt#%d", i);
+        dump_entry(name, &entries[JD_PROFILE_SERVICE_PACKET(i)]);
+    }
+}
+
+unsigned jd_profile_report(jd_profile_report_t *dst, unsigned size) {
+    if (size < sizeof(jd_profile_report_t))
+        return 0;
+    dst->num_phases = JD_PROFILE_NUM_PHASES;
+    dst->num_services = num_services;
+    dst->ticks_per_us = JD_PROFILE_TICKS_PER_US;
+    dst->elapsed = JD_PROFILE_TICKS() - reset_time;
+    unsigned n = (size - sizeof(jd_profile_report_t)) / sizeof(jd_profile_entry_t);
+    if (!entries)
+        n = 0;
+    if (n > jd_profile_num_entries())
+        n = jd_profile_num_entries();
+    memcpy(dst->entries, entries, n * sizeof(jd_profile_entry_t));
+    return sizeof(jd_profile_report_t) + n * sizeof(jd_profile_entry_t);
+}
+
+#endif
@@ -2,15 +2,102 @@
 
 #define ASSERT JD_ASSERT
 
+// dwell times, and the TX wait in JD_BUS_STATS, need the push time of every frame
+#define QUEUE_TIMESTAMPS (JD_QUEUE_STATS || JD_BUS_STATS)
+
 struct jd_queue {
     uint16_t front;
     uint16_t back;
     uint16_t size;
     uint16_t curr_size;
+#if QUEUE_TIMESTAMPS
+    // push timestamps, in the same order as frames in the queue
+    uint32_t *timestamps;
+    uint16_t ts_front;
+    uint16_t ts_len;
+    uint16_t ts_size;
+#endif
+#if JD_QUEUE_STATS
+    jd_queue_stats_t stats;
+#endif
     uint8_t data[0];
 };
 
 #define FRM_SIZE(f) ((JD_FRAME_SIZE(f) + 3) & ~3)
+// smallest possible FRM_SIZE()
+#define MIN_FRM_SIZE 16
+
+#if QUEUE_TIMESTAMPS
+static void ts_push(jd_queue_t q) {
+    q->timestamps[(q->ts_front + q->ts_len++) % q->ts_size] = (uint32_t)tim_get_micros();
+}
+
+// returns the push time of the frame being shifted
+static uint32_t ts_shift(jd_queue_t q) {
+    uint32_t t = q->timestamps[q->ts_front];
+    q->ts_front = (q->ts_front + 1) % q->ts_size;
+    q->ts_len--;
+    return t;
+}
+
+uint32_t jd_queue_front_time(jd_queue_t q) {
+    return q->timestamps[q->ts_front];
+}
+#else
+#define ts_push(q) ((void)0)
+#define ts_shift(q) 0
+#endif
+
+#if JD_QUEUE_STATS
+static void stats_push(jd_queue_t q, unsigned size, int ret) {
+    jd_queue_stats_t *st = &q->stats;
+    if (ret) {
+        st->num_dropped++;
+        return;
+    }
+    st->num_pushed++;
+    st->curr_frames++;
+    st->curr_bytes += size;
+    if (st->curr_frames > st->max_frames)
+        st->max_frames = st->curr_frames;
+    if (st->curr_bytes > st->max_bytes)
+        st->max_bytes = st->curr_bytes;
+    st->occupancy_hist[jd_queue_hist_bucket(st->curr_bytes)]++;
+}
+
+static void stats_shift(jd_queue_t q, unsigned size, uint32_t pushed) {
+    jd_queue_stats_t *st = &q->stats;
+    uint32_t dwell = (uint32_t)tim_get_micros() - pushed;
+    st->num_shifted++;
+    st->curr_frames--;
+    st->curr_bytes -= size;
+    st->dwell_total_us += dwell;
+    if (dwell > st->dwell_max_us)
+        st->dwell_max_us = dwell;
+    st->dwell_hist[jd_queue_hist_bucket(dwell)]++;
+}
+
+void jd_queue_get_stats(jd_queue_t q, jd_queue_stats_t *dst) {
+    target_disable_irq();
+    *dst = q->stats;
+    target_enable_irq();
+}
+
+void jd_queue_reset_stats(jd_queue_t q) {
+    target_disable_irq();
+    jd_queue_stats_t *st = &q->stats;
+    uint16_t curr_bytes = st->curr_bytes;
+    uint16_t curr_frames = st->curr_frames;
+    memset(st, 0, sizeof(*st));
+    st->size = q->size;
+    st->curr_bytes = st->max_bytes = curr_bytes;
+    st->curr_frames = st->max_frames = curr_frames;
+    target_enable_irq();
+}
+#else
+#define stats_push(q, size, ret) ((void)0)
+#define stats_shift(q, size, pushed) ((void)(pushed))
+#endif
 
 int jd_queue_will_fit(jd_queue_t q, unsigned size) {
     int ret;
@@ -48,8 +135,12 @@ int jd_queue_push(jd_queue_t q, jd_frame_t *pkt) {
         else
             ret = -2;
     }
-    if (ret == 0)
+    if (ret == 0) {
         memcpy(q->data + q->back - size, pkt, size);
+        ts_push(q);
+    }
+
+    stats_push(q, size, ret);
 
     ASSERT(q->front <= q->size);
     ASSERT(q->back <= q->size);
@@ -77,6 +168,7 @@ void jd_queue_shift(jd_queue_t q) {
     jd_frame_t *pkt = jd_queue_front(q);
     ASSERT(pkt != NULL);
     unsigned size = FRM_SIZE(pkt);
+    stats_shift(q, size, ts_shift(q));
     if (q->front >= q->curr_size) {
         ASSERT(q->front == q->curr_size);
         q->front = size;
@@ -90,6 +182,12 @@ void jd_queue_shift(jd_queue_t q) {
 void jd_queue_clear(jd_queue_t q) {
     target_disable_irq();
     q->front = q->back = 0;
+#if QUEUE_TIMESTAMPS
+    q->ts_len = 0;
+#endif
+#if JD_QUEUE_STATS
+    q->stats.curr_bytes = q->stats.curr_frames = 0;
+#endif
     target_enable_irq();
 }
 
@@ -97,6 +195,13 @@ jd_queue_t jd_queue_alloc(unsigned size) {
     jd_queue_t q = jd_alloc(sizeof(*q) + size);
     q->size = q->curr_size = size;
     q->front = q->back = 0;
+#if QUEUE_TIMESTAMPS
+    q->ts_size = size / MIN_FRM_SIZE + 1;
+    q->timestamps = jd_alloc(q->ts_size * sizeof(uint32_t));
+#endif
+#if JD_QUEUE_STATS
+    q->stats.size = size;
+#endif
     return q;
 }
 
@@ -140,6 +245,19 @@ void jd_queue_test(void) {
         }
     }
 
+#if JD_QUEUE_STATS
+    jd_queue_stats_t st;
+    jd_queue_get_stats(q, &st);
+    ASSERT(st.num_pushed == (unsigned)push);
+    ASSERT(st.num_shifted == (unsigned)shift);
+    ASSERT(st.curr_frames == push - shift);
+    ASSERT(st.max_bytes <= TEST_SIZE);
+    uint32_t total = 0;
+    for (int i = 0; i < JD_QUEUE_HIST_BUCKETS; ++i)
+        total += st.dwell_hist[i];
+    ASSERT(total == st.num_shifted);
+#endif
+
     DMESG("q-test OK");
 }
 #endif
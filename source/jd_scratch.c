@@ -0,0 +1,116 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+#include "jd_protocol.h"
+
+#define SCRATCH_ALIGN(x) (((x) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+// Blocks that don't fit in the arena are taken from jd_alloc() and linked through
+// a pointer-sized header, so that jd_scratch_reset() can free them.
+typedef struct overflow_block {
+    struct overflow_block *next;
+} overflow_block_t;
+
+static uint8_t *arena;
+static unsigned arena_ptr;
+static overflow_block_t *overflow;
+static uint32_t tick_bytes;
+static jd_scratch_stats_t stats;
+
+static void *overflow_alloc(unsigned size) {
+#if JD_FREE_SUPPORTED
+    overflow_block_t *b = jd_alloc(sizeof(overflow_block_t) + size);
+    b->next = overflow;
+    overflow = b;
+    stats.num_overflows++;
+    return b + 1;
+#else
+    DMESG("scratch overflow: %d", size);
+    JD_PANIC();
+    return NULL;
+#endif
+}
+
+static void count_alloc(unsigned size) {
+    stats.num_allocs++;
+    tick_bytes += size;
+    if (tick_bytes > stats.max_used)
+        stats.max_used = tick_bytes;
+}
+
+static uint8_t *arena_top(void) {
+    if (!arena)
+        arena = jd_alloc(JD_SCRATCH_SIZE);
+    return arena + arena_ptr;
+}
+
+void *jd_scratch_alloc(unsigned size) {
+    if (target_in_irq())
+        JD_PANIC();
+
+    size = SCRATCH_ALIGN(size);
+    count_alloc(size);
+
+    if (arena_ptr + size > JD_SCRATCH_SIZE)
+        return overflow_alloc(size);
+
+    void *r = arena_top();
+    arena_ptr += size;
+    memset(r, 0, size);
+    return r;
+}
+
+// The string is formatted directly at the top of the arena, and only formatted again
+// when it doesn't fit there.
+char *jd_scratch_vsprintf(const char *format, va_list ap) {
+    if (target_in_irq())
+        JD_PANIC();
+
+    va_list ap2;
+    va_copy(ap2, ap);
+    char *r = (char *)arena_top();
+    unsigned left = JD_SCRATCH_SIZE - arena_ptr;
+    unsigned len = jd_vsprintf(r, left, format, ap);
+    if (len <= left) {
+        len = SCRATCH_ALIGN(len);
+        if (len > left)
+            len = left;
+        count_alloc(len);
+        arena_ptr += len;
+    } else {
+        r = jd_scratch_alloc(len);
+        jd_vsprintf(r, len, format, ap2);
+    }
+    va_end(ap2);
+    return r;
+}
+
+char *jd_scratch_sprintf(const char *format, ...) {
+    va_list arg;
+    va_start(arg, format);
+    char *r = jd_scratch_vsprintf(format, arg);
+    va_end(arg);
+    return r;
+}
+
+char *jd_scratch_to_hex(const void *src, size_t len) {
+    char *r = jd_scratch_alloc(len * 2 + 1);
+    jd_to_hex(r, src, len);
+    return r;
+}
+
+void jd_scratch_reset(void) {
+#if JD_FREE_SUPPORTED
+    while (overflow) {
+        overflow_block_t *b = overflow;
+        overflow = b->next;
+        jd_free(b);
+    }
+#endif
+    arena_ptr = 0;
+    tick_bytes = 0;
+}
+
+void jd_scratch_get_stats(jd_scratch_stats_t *dst) {
+    *dst = stats;
+}
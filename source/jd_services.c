@@ -21,6 +21,27 @@ struct srv_state {
     SRV_COMMON;
 };
 
+#if JD_STATIC_SERVICES
+static srv_t *services_table[JD_MAX_SERVICES];
+extern const jd_srv_static_t __start_jd_srv[] __attribute__((weak));
+extern const jd_srv_static_t __stop_jd_srv[] __attribute__((weak));
+
+static const jd_srv_static_t *find_static(const srv_vt_t *vt) {
+    for (const jd_srv_static_t *e = __start_jd_srv; e < __stop_jd_srv; ++e)
+        if (e->vt == vt)
+            return e;
+    return NULL;
+}
+
+// NULL when there is no storage reserved for vt, or it's already used by another instance
+static srv_t *static_storage(const srv_vt_t *vt) {
+    const jd_srv_static_t *e = find_static(vt);
+    if (!e || ((srv_t *)e->storage)->vt)
+        return NULL;
+    return e->storage;
+}
+#endif
+
 #define REG_IS_SIGNED(r) ((r) <= 4 && !((r)&1))
 #define REG_IS_OPT(r) ((r) >= _JD_REG_OPT8)
 static const uint8_t regSize[16] = {1, 1, 2, 2, 4, 4, 4, 8, 1, 0, 1, 2, 4, JD_PTRSIZE};
@@ -174,7 +195,13 @@ srv_t *jd_allocate_service(const srv_vt_t *vt) {
     // always allocate instances idx - it should be stable when we disable some services
     if (num_services >= JD_MAX_SERVICES)
         JD_PANIC();
+#if JD_STATIC_SERVICES
+    srv_t *r = static_storage(vt);
+    if (!r)
+        r = jd_alloc(vt->state_size);
+#else
     srv_t *r = jd_alloc(vt->state_size);
+#endif
     r->vt = vt;
     r->service_index = num_services;
     // sleeping is allowed in service init
@@ -190,8 +217,12 @@ uint8_t _jd_services_curr_idx(void) {
 
 void jd_services_init(void) {
     num_services = 0;
+#if JD_STATIC_SERVICES
+    services = services_table;
+#else
     srv_t *tmp[JD_MAX_SERVICES];
     services = tmp;
+#endif
 
     jd_refresh_now();
 
@@ -206,17 +237,34 @@ void jd_services_init(void) {
 #endif
 
     curr_service_process = 0;
+#if !JD_STATIC_SERVICES
     services = jd_alloc(sizeof(void *) * num_services);
     memcpy(services, tmp, sizeof(void *) * num_services);
+#endif
+
+#if JD_PROFILE
+    jd_profile_init(num_services);
+#endif
 
     // don't flash red initially - pretend we just heard from brain
     lastMax = tim_get_micros();
 }
 
 void jd_services_deinit(void) {
-    for (int i = 0; i < num_services; ++i)
+    for (int i = 0; i < num_services; ++i) {
+#if JD_STATIC_SERVICES
+        const jd_srv_static_t *e = find_static(services[i]->vt);
+        if (e && e->storage == services[i]) {
+            // mark as free for the next jd_services_init()
+            memset(services[i], 0, services[i]->vt->state_size);
+            continue;
+        }
+#endif
         jd_free(services[i]);
+    }
+#if !JD_STATIC_SERVICES
     jd_free(services);
+#endif
     num_services = 0;
     services = NULL;
 }
@@ -289,7 +337,7 @@ bool jd_services_needs_frame(jd_frame_t *frame) {
 __attribute__((weak)) void jd_app_handle_packet(jd_packet_t *pkt) {}
 __attribute__((weak)) void jd_app_handle_command(jd_packet_t *pkt) {}
 
-void jd_services_handle_packet(jd_packet_t *pkt) {
+static void route_packet(jd_packet_t *pkt) {
     jd_app_handle_packet(pkt);
 
 #if JD_PIPES
@@ -300,6 +348,10 @@ void jd_services_handle_packet(jd_packet_t *pkt) {
 #if JD_CLIENT
     jd_client_handle_packet(pkt);
 #endif
+}
+
+void jd_services_handle_packet(jd_packet_t *pkt) {
+    JD_PROFILE_RUN(JD_PROFILE_ROUTING, route_packet(pkt));
 
     if (!(pkt->flags & JD_FRAME_FLAG_COMMAND)) {
         handle_ctrl_tick(pkt);
@@ -334,7 +386,8 @@ void jd_services_handle_packet(jd_packet_t *pkt) {
                 }
             }
 #endif
-            s->vt->handle_pkt(s, pkt);
+            JD_PROFILE_RUN(JD_PROFILE_SERVICE_PACKET(pkt->service_index),
+                           s->vt->handle_pkt(s, pkt));
         }
     } else if (pkt->flags & JD_FRAME_FLAG_IDENTIFIER_IS_SERVICE_CLASS) {
         uint32_t id = (uint32_t)pkt->device_identifier; // match lower 32-bits
@@ -342,7 +395,7 @@ void jd_services_handle_packet(jd_packet_t *pkt) {
             srv_t *s = services[i];
             if (id == s->vt->service_class) {
                 pkt->service_index = i;
-                s->vt->handle_pkt(s, pkt);
+                JD_PROFILE_RUN(JD_PROFILE_SERVICE_PACKET(i), s->vt->handle_pkt(s, pkt));
             }
         }
     }
@@ -358,44 +411,50 @@ void jd_services_tick(void) {
     }
 
     // do ctrl process regardless of sleep status
-    services[0]->vt->process(services[0]);
+    JD_PROFILE_RUN(JD_PROFILE_SERVICE_PROCESS(0), services[0]->vt->process(services[0]));
 
     // while in sleep state, do not run any more nested process()
     if (curr_service_process != IN_SERV_SLEEP) {
         for (int i = 1; i < num_services; ++i) {
             curr_service_process = i;
-            services[i]->vt->process(services[i]);
+            JD_PROFILE_RUN(JD_PROFILE_SERVICE_PROCESS(i), services[i]->vt->process(services[i]));
         }
         curr_service_process = 0;
     }
 
-    jd_process_event_queue();
+    JD_PROFILE_RUN(JD_PROFILE_EVENT_QUEUE, jd_process_event_queue());
 
 #if JD_CONFIG_STATUS == 1
-    jd_status_process();
+    JD_PROFILE_RUN(JD_PROFILE_STATUS, jd_status_process());
 #endif
 
 #if JD_PIPES
-    jd_opipe_process();
+    JD_PROFILE_RUN(JD_PROFILE_OPIPE, jd_opipe_process());
 #endif
 
 #if JD_CLIENT
-    jd_client_process();
+    JD_PROFILE_RUN(JD_PROFILE_CLIENT, jd_client_process());
+#endif
+
+#if JD_TRACE
+    JD_PROFILE_RUN(JD_PROFILE_TRACE, jd_trace_process());
 #endif
 
 #if JD_LSTORE
     void jd_lstore_process(void);
-    jd_lstore_process();
+    JD_PROFILE_RUN(JD_PROFILE_LSTORE, jd_lstore_process());
 #endif
 
 #if JD_USB_BRIDGE
-    jd_usb_proto_process();
-    jd_usb_process();
+    JD_PROFILE_RUN(JD_PROFILE_USB, {
+        jd_usb_proto_process();
+        jd_usb_process();
+    });
 #endif
 
 #if JD_WIFI
     void jd_wifi_process(void);
-    jd_wifi_process();
+    JD_PROFILE_RUN(JD_PROFILE_WIFI, jd_wifi_process());
 #endif
 
     jd_tx_flush();
@@ -412,7 +471,7 @@ static void jd_process_everything_core(void) {
         }
 
         jd_services_tick();
-        app_process();
+        JD_PROFILE_RUN(JD_PROFILE_APP, app_process());
 
         // if no frame was received, stop
         if (fr == NULL)
@@ -451,6 +510,7 @@ void jd_process_everything(void) {
     jd_max_sleep = JD_MIN_MAX_SLEEP;
     jd_refresh_now();
     jd_process_everything_core();
+    jd_scratch_reset();
 }
 
 void jd_services_sleep_us(uint32_t delta) {
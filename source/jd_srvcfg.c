@@ -14,6 +14,7 @@
 static uint8_t jd_srvcfg_idx;
 static uint8_t jd_srvcfg_idx_map[JD_MAX_SERVICES];
 
+// the key is in the dcfg_idx_key() buffer (DCFG_KEYSIZE), valid until the next call
 static char *mk_key(unsigned idx, const char *key) {
     if (idx == 0xff)
         return NULL;
@@ -89,7 +90,9 @@ static const jd_srvcfg_entry_t jd_srvcfg_entries[] = { //
 uint8_t _jd_services_curr_idx(void);
 
 void jd_srvcfg_run(void) {
-    JD_ASSERT(jd_srvcfg_idx == 0);
+    // 0xff when run again after jd_services_deinit()
+    JD_ASSERT(jd_srvcfg_idx == 0 || jd_srvcfg_idx == 0xff);
+    jd_srvcfg_idx = 0;
     memset(jd_srvcfg_idx_map, 0xff, sizeof(jd_srvcfg_idx_map));
 
     for (;;) {
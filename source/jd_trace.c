@@ -0,0 +1,93 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+#include "jd_protocol.h"
+
+#if JD_TRACE
+
+#if JD_TRACE_LSTORE
+#include "storage/jd_storage.h"
+#endif
+
+#define LOG(fmt, ...) DMESG("trace: " fmt, ##__VA_ARGS__)
+
+#ifndef JD_TRACE_LSTORE_FILE
+#define JD_TRACE_LSTORE_FILE 0
+#endif
+
+static jd_bqueue_t trace_buf;
+static uint8_t trace_enabled;
+static uint8_t lost_pending;
+static uint32_t num_lost;
+
+void jd_trace_init(void) {
+    if (trace_buf)
+        return;
+    trace_buf = jd_bqueue_alloc(JD_TRACE_BUFFER_SIZE);
+    trace_enabled = 1;
+}
+
+void jd_trace_enable(bool en) {
+    trace_enabled = en;
+}
+
+uint32_t jd_trace_num_lost(void) {
+    return num_lost;
+}
+
+void jd_trace_frame(jd_frame_t *frame, unsigned flags) {
+    if (!trace_enabled || !trace_buf)
+        return;
+
+    unsigned size = JD_FRAME_SIZE(frame);
+    if (size > sizeof(jd_frame_t))
+        return; // shouldn't happen
+
+    jd_trace_record_t hd = {.timestamp = (uint32_t)tim_get_micros(), .flags = flags};
+
+    target_disable_irq();
+    if (jd_bqueue_free_bytes(trace_buf) < JD_TRACE_RECORD_HEADER_SIZE + size) {
+        num_lost++;
+        lost_pending = 1;
+    } else {
+        if (lost_pending) {
+            hd.flags |= JD_TRACE_FLAG_OVERFLOW;
+            lost_pending = 0;
+        }
+        jd_bqueue_push(trace_buf, &hd, JD_TRACE_RECORD_HEADER_SIZE);
+        jd_bqueue_push(trace_buf, frame, size);
+    }
+    target_enable_irq();
+}
+
+unsigned jd_trace_read(void *dst, unsigned size) {
+    if (!trace_buf)
+        return 0;
+    return jd_bqueue_pop_at_most(trace_buf, dst, size);
+}
+
+#if JD_TRACE_LSTORE
+void jd_trace_process(void) {
+    if (!trace_buf)
+        return;
+
+    // records are always pushed atomically, so if there is a header, there is a whole record
+    uint8_t buf[JD_TRACE_RECORD_HEADER_SIZE + sizeof(jd_frame_t)];
+    jd_frame_t *frame = (jd_frame_t *)(buf + JD_TRACE_RECORD_HEADER_SIZE);
+    while (jd_bqueue_pop_atomic(trace_buf, buf, JD_TRACE_RECORD_HEADER_SIZE + 12) == 0) {
+        unsigned size = JD_FRAME_SIZE(frame);
+        if (size > 12 && jd_bqueue_pop_atomic(trace_buf, frame->data, size - 12) != 0) {
+            LOG("corrupted");
+            jd_bqueue_clear(trace_buf);
+            return;
+        }
+        if (jd_lstore_append_frag(JD_TRACE_LSTORE_FILE, JD_LSTORE_TYPE_JD_FRAME_TRACE, buf,
+                                  JD_TRACE_RECORD_HEADER_SIZE + size) != 0)
+            num_lost++;
+    }
+}
+#else
+void jd_trace_process(void) {}
+#endif
+
+#endif
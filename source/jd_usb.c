@@ -356,6 +356,19 @@ void jd_usb_proto_process(void) {
 void jd_usb_proto_process(void) {}
 #endif
 
+#if JD_QUEUE_STATS
+int jd_usb_queue_stats(jd_queue_stats_t *dst, bool reset) {
+    if (!usb_queue) {
+        memset(dst, 0, sizeof(*dst));
+        return -1;
+    }
+    jd_queue_get_stats(usb_queue, dst);
+    if (reset)
+        jd_queue_reset_stats(usb_queue);
+    return 0;
+}
+#endif
+
 __attribute__((weak)) void jd_usb_flush_stdout(void) {}
 
 __attribute__((weak)) void jd_usb_process(void) {}
@@ -51,6 +51,40 @@ uint32_t jd_random_around(uint32_t v) {
     return (v - (mask >> 1)) + (jd_random() & mask);
 }
 
+void jd_tx_backoff_lost(jd_tx_backoff_t *b) {
+    if (b->lost < 0xff)
+        b->lost++;
+}
+
+void jd_tx_backoff_won(jd_tx_backoff_t *b) {
+    // all nodes competing for the bus lose about the same number of attempts per transmission,
+    // so their estimates (and thus delay spreads) converge, which keeps arbitration fair;
+    // the estimate rises slowly, but falls quickly once the contention is gone
+    int diff = (b->lost << 4) - (int)b->contention;
+    b->contention += diff < 0 ? diff / 2 : diff / 8;
+    b->lost = 0;
+}
+
+uint32_t jd_tx_backoff_delay(jd_tx_backoff_t *b) {
+    uint32_t d = jd_random_around(JD_TX_BACKOFF_BASE);
+    // the spread grows with the square root of the estimate; a linear one keeps the line
+    // idle for too long, and the queues fill up long before the bus is saturated
+    uint32_t r = 0;
+    while ((r + 1) * (r + 1) <= b->contention)
+        r++;
+    // contention has 4 fractional bits, so r has 2
+    uint32_t spread = r * JD_TX_BACKOFF_SLOT / 4;
+    if (spread > JD_TX_BACKOFF_MAX)
+        spread = JD_TX_BACKOFF_MAX;
+    if (spread) {
+        uint32_t mask = 1;
+        while (mask < spread)
+            mask = (mask << 1) | 1;
+        d += jd_random() & (mask >> 1);
+    }
+    return d;
+}
+
 // https://wiki.nicksoft.info/mcu:pic16:crc-16:home
 uint16_t jd_crc16(const void *data0, uint32_t size) {
     const uint8_t *ptr = (const uint8_t *)data0;
@@ -343,15 +377,46 @@ typedef struct {
     char *dstend;
 #if JD_ADVANCED_STRING
     unsigned ulen;
+    bool count_ulen;
+#endif
+#if JD_FREE_SUPPORTED
+    // with 'grow', the output starts at 'start', and is moved to the heap when it doesn't fit
+    char *start;
+    bool grow;
+    bool on_heap;
 #endif
 } printf_ctx_t;
 
+#if JD_FREE_SUPPORTED
+static void grow_ctx(printf_ctx_t *ctx, int needed) {
+    int len = ctx->dst - ctx->start;
+    int size = (ctx->dstend - ctx->start) * 2;
+    if (size < len + needed)
+        size = len + needed;
+    char *p = jd_alloc(size);
+    memcpy(p, ctx->start, len);
+    if (ctx->on_heap)
+        jd_free(ctx->start);
+    ctx->start = p;
+    ctx->dst = p + len;
+    ctx->dstend = p + size;
+    ctx->on_heap = true;
+}
+#endif
+
 static void write_n(printf_ctx_t *ctx, const char *src, int srclen) {
     int left = ctx->dstend - ctx->dst;
 #if JD_ADVANCED_STRING
-    for (int i = 0; i < srclen; ++i)
-        if ((src[i] & 0xC0) != 0x80)
-            ctx->ulen++;
+    if (ctx->count_ulen)
+        for (int i = 0; i < srclen; ++i)
+            if ((src[i] & 0xC0) != 0x80)
+                ctx->ulen++;
+#endif
+#if JD_FREE_SUPPORTED
+    if (ctx->grow && srclen >= left) {
+        grow_ctx(ctx, srclen + 1);
+        left = ctx->dstend - ctx->dst;
+    }
 #endif
     if (left > 0) {
         int srctrimmed = srclen >= left ? left - 1 : srclen;
@@ -361,18 +426,14 @@ static void write_n(printf_ctx_t *ctx, const char *src, int srclen) {
     ctx->dst += srclen;
 }
 
-#define WRITEN(p, sz) write_n(&ctx, p, sz)
+#define WRITEN(p, sz) write_n(ctx, p, sz)
 
-#if !JD_ADVANCED_STRING
-static
-#endif
-    int
-    jd_vsprintf_ext(char *dst, unsigned dstsize, const char *format, unsigned *ulen, va_list ap) {
+static void vsprintf_core(printf_ctx_t *ctx, const char *format, va_list ap) {
     const char *end = format;
-    printf_ctx_t ctx = {
-        .dst = dst,
-        .dstend = dst + dstsize,
-    };
+#if JD_ADVANCED_STRING && JD_FREE_SUPPORTED
+    // %-s only frees when actually writing
+    bool dst = ctx->dst != NULL;
+#endif
 #if JD_ADVANCED_STRING
     char buf[64];
 #else
@@ -513,6 +574,22 @@ static
             WRITEN(buf, strlen(buf));
         }
     }
+}
+
+#if !JD_ADVANCED_STRING
+static
+#endif
+    int
+    jd_vsprintf_ext(char *dst, unsigned dstsize, const char *format, unsigned *ulen, va_list ap) {
+    printf_ctx_t ctx = {
+        .dst = dst,
+        .dstend = dst + dstsize,
+    };
+#if JD_ADVANCED_STRING
+    ctx.count_ulen = ulen != NULL;
+#endif
+
+    vsprintf_core(&ctx, format, ap);
 
 #if JD_ADVANCED_STRING
     if (ulen)
@@ -581,139 +658,36 @@ void jd_log_packet(jd_packet_t *pkt) {
           sz == pkt->service_size ? "" : "...");
 }
 
-#if JD_ADVANCED_STRING
-#include <math.h>
-
-#define NUMBER double
-
-#define p10(v) __builtin_powi(10, v)
-
-static const uint64_t pows[] = {
-    1LL,           10LL,           100LL,           1000LL,           10000LL,
-    100000LL,      1000000LL,      10000000LL,      100000000LL,      1000000000LL,
-    10000000000LL, 100000000000LL, 1000000000000LL, 10000000000000LL, 100000000000000LL,
-};
-
-// The basic idea is we convert d to a 64 bit integer with numdigits
-// digits, and then print it out, putting dot in the right place.
-
-void jd_print_double(char *buf, NUMBER d, int numdigits) {
-    if (d < 0) {
-        *buf++ = '-';
-        d = -d;
-    }
-
-    if (isnan(d)) {
-        strcpy(buf, "NaN");
-        return;
-    }
-
-    if (isinf(d)) {
-        strcpy(buf, "inf");
-        return;
-    }
-
-    if (d < 2.3e-308) {
-        *buf++ = '0';
-        *buf++ = 0;
-        return;
-    }
-
-    if (numdigits < 4)
-        numdigits = 4;
-    int maxdigits = sizeof(NUMBER) == 4 ? 8 : 15;
-    if (numdigits > maxdigits)
-        numdigits = maxdigits;
-
-    int pw = sizeof(NUMBER) == 4 ? (int)log10f(d) : (int)log10(d);
-    int e = 1;
-
-    // if outside 1e-6 -- 1e21 range, we use the e-notation
-    if (d < 1e-6 || d > 1e21) {
-        // normalize number to 1.XYZ, save e, and reset pw
-        if (pw < 0)
-            d *= p10(-pw);
-        else
-            d /= p10(pw);
-        e = pw;
-        pw = 0;
-    }
-
-    int trailingZ = 0;
-    int dotAfter = pw + 1; // at which position the dot should be in the number
-
-    uint64_t dd;
-
-    if (pw >= numdigits) {
-        // we're going to print out the whole number anyways, so ignore the requested precision if
-        // too small
-        numdigits = pw + 1;
-        if (numdigits > maxdigits)
-            numdigits = maxdigits;
-    }
-
-    // normalize number to be integer with exactly numdigits digits
-    if (pw >= numdigits) {
-        // if the number is larger than numdigits, we need trailing zeroes
-        trailingZ = pw - numdigits + 1;
-        dd = (uint64_t)(d / p10(trailingZ) + 0.5);
-    } else {
-        dd = (uint64_t)(d * p10(numdigits - pw - 1) + 0.5);
-    }
-
-    // if number is less than 1, we need 0.00...00 at the beginning
-    if (dotAfter < 1) {
-        *buf++ = '0';
-        *buf++ = '.';
-        int n = -dotAfter;
-        while (n--)
-            *buf++ = '0';
-    }
-
-    // now print out the actual number
-    for (int i = numdigits - 1; i >= 0; i--) {
-        uint64_t q = pows[i];
-        // this may be faster than fp-division and fmod(); or maybe not
-        // anyways, it works
-        int k = '0';
-        while (dd >= q) {
-            dd -= q;
-            k++;
-        }
-        *buf++ = k;
-        // if we're after dot, and what's left is zeroes, stop
-        if (dd == 0 && (numdigits - i) >= dotAfter)
-            break;
-        // print the dot, if we arrived at it
-        if ((numdigits - i) == dotAfter)
-            *buf++ = '.';
-    }
-
-    // print out remaining trailing zeroes if any
-    while (trailingZ-- > 0)
-        *buf++ = '0';
-
-    // if we used e-notation, handle that
-    if (e != 1) {
-        *buf++ = 'e';
-        if (e > 0)
-            *buf++ = '+';
-        jd_itoa(e, buf);
-    } else {
-        *buf = 0;
-    }
+#if JD_FREE_SUPPORTED
+// most strings fit here, and then only the result is allocated
+#define SPRINTF_A_STACK 64
+
+static void init_grow_ctx(printf_ctx_t *ctx, char *buf, unsigned size) {
+    memset(ctx, 0, sizeof(*ctx));
+    buf[0] = 0;
+    ctx->start = ctx->dst = buf;
+    ctx->dstend = buf + size;
+    ctx->grow = true;
+}
+
+// returns exact-size copy of the output, and frees the heap buffer if any
+static char *finish_grow_ctx(printf_ctx_t *ctx) {
+    unsigned size = ctx->dst - ctx->start + 1;
+    if (ctx->on_heap && ctx->dstend - ctx->start == (int)size)
+        return ctx->start;
+    char *r = jd_alloc(size);
+    memcpy(r, ctx->start, size);
+    if (ctx->on_heap)
+        jd_free(ctx->start);
+    return r;
 }
-#endif
 
-#if JD_FREE_SUPPORTED
 char *jd_vsprintf_a(const char *format, va_list ap) {
-    va_list ap2;
-    va_copy(ap2, ap);
-    int len = jd_vsprintf(NULL, 0, format, ap);
-    char *r = jd_alloc(len);
-    jd_vsprintf(r, len, format, ap2);
-    va_end(ap2);
-    return r;
+    char buf[SPRINTF_A_STACK];
+    printf_ctx_t ctx;
+    init_grow_ctx(&ctx, buf, sizeof(buf));
+    vsprintf_core(&ctx, format, ap);
+    return finish_grow_ctx(&ctx);
 }
 
 char *jd_sprintf_a(const char *format, ...) {
@@ -736,45 +710,50 @@ char *jd_device_short_id_a(uint64_t long_id) {
     return r;
 }
 
-static int urlencode_core(char *dst, const char *src) {
-    int len = 0;
-    while (*src) {
-        uint8_t c = *src++;
-        if (('0' <= c && c <= '9') || ('a' <= (c | 0x20) && (c | 0x20) <= 'z') ||
-            (c == '-' || c == '.' || c == '_' || c == '~')) {
-            if (dst)
-                *dst++ = c;
-            len++;
-        } else {
-            if (dst) {
-                *dst++ = '%';
-                jd_to_hex(dst, &c, 1);
-                dst += 2;
-            }
-            len += 3;
+char *jd_urlencode(const char *src) {
+    char buf[SPRINTF_A_STACK];
+    printf_ctx_t ctx;
+    init_grow_ctx(&ctx, buf, sizeof(buf));
+    for (;;) {
+        // copy runs of characters that don't need escaping at once
+        const char *run = src;
+        uint8_t c;
+        for (;;) {
+            c = *src;
+            if (('0' <= c && c <= '9') || ('a' <= (c | 0x20) && (c | 0x20) <= 'z') ||
+                (c == '-' || c == '.' || c == '_' || c == '~'))
+                src++;
+            else
+                break;
         }
+        if (src != run)
+            write_n(&ctx, run, src - run);
+        if (!c)
+            break;
+        char esc[4] = {'%'};
+        jd_to_hex(esc + 1, &c, 1);
+        write_n(&ctx, esc, 3);
+        src++;
     }
-    if (dst)
-        *dst++ = 0;
-    return len + 1;
-}
-
-char *jd_urlencode(const char *src) {
-    int len = urlencode_core(NULL, src);
-    char *r = jd_alloc(len);
-    urlencode_core(r, src);
-    return r;
+    return finish_grow_ctx(&ctx);
 }
 
+#define CONCAT_LENS 8
 char *jd_concat_many(const char **parts) {
+    // remember lengths of first few parts, so that strlen() is called once per part
+    unsigned lens[CONCAT_LENS];
     int len = 0;
-    for (int i = 0; parts[i]; ++i)
-        len += strlen(parts[i]);
+    for (int i = 0; parts[i]; ++i) {
+        unsigned k = strlen(parts[i]);
+        if (i < CONCAT_LENS)
+            lens[i] = k;
+        len += k;
+    }
     char *r = jd_alloc(len + 1);
     len = 0;
 
     for (int i = 0; parts[i]; ++i) {
-        int k = strlen(parts[i]);
+        int k = i < CONCAT_LENS ? lens[i] : strlen(parts[i]);
         memcpy(r + len, parts[i], k);
         len += k;
     }
@@ -15,6 +15,53 @@
 #define JD_LSTORE_NUM_FILES 2
 #endif
 
+// Block buffers per log; entries are dropped when all but one wait to be written.
+// SD cards occasionally take tens of ms for a write; logging frames at full bus rate
+// needs 4 or more.
+#ifndef JD_LSTORE_BUFFERS
+#define JD_LSTORE_BUFFERS 2
+#endif
+
+// Write blocks from a background thread; otherwise they are written from jd_lstore_process(),
+// at most JD_LSTORE_FLUSH_SECTORS per disk write, and for at most JD_LSTORE_FLUSH_US per call
+// (but at least one write).
+// The thread needs the pthread backend (JD_THR_PTHREAD) and jd_thr_init() to have run before
+// jd_lstore_init(); it's off by default.
+#ifndef JD_LSTORE_WRITER_THREAD
+#define JD_LSTORE_WRITER_THREAD 0
+#endif
+
+#ifndef JD_LSTORE_FLUSH_SECTORS
+#define JD_LSTORE_FLUSH_SECTORS 8
+#endif
+
+#ifndef JD_LSTORE_FLUSH_US
+#define JD_LSTORE_FLUSH_US 5000
+#endif
+
+// Sectors after the main header used for the sparse time index of new logs (0 to disable).
+// Each sector has 32 entries, spread evenly over the data blocks.
+#ifndef JD_LSTORE_INDEX_SECTORS
+#define JD_LSTORE_INDEX_SECTORS 7
+#endif
+
+// When non-zero, blocks are compressed when written, and block buffers hold up to
+// JD_LSTORE_COMPRESS times more data than a block on disk (eg., 4 needs 16kB more RAM per
+// 4kB buffer). How many entries go in a buffer is based on the compression of previous blocks.
+#ifndef JD_LSTORE_COMPRESS
+#define JD_LSTORE_COMPRESS 0
+#endif
+
+// jd_lz4_compress() uses a table of 2 << JD_LZ4_HASH_LOG bytes
+#ifndef JD_LZ4_HASH_LOG
+#define JD_LZ4_HASH_LOG 10
+#endif
+
+// jd_lstore_reader_*() can also be used without JD_LSTORE, eg., on a PC
+#ifndef JD_LSTORE_READER
+#define JD_LSTORE_READER JD_LSTORE
+#endif
+
 #if JD_LSTORE
 
 // user-facing functions
@@ -61,11 +108,13 @@ static inline bool jd_lstore_is_enabled(void) {
 #define JD_LSTORE_TYPE_LOG 0x03
 #define JD_LSTORE_TYPE_JD_FRAME 0x04
 #define JD_LSTORE_TYPE_PANIC_LOG 0x05
+// jd_trace_record_t followed by the frame; see jd_trace.h
+#define JD_LSTORE_TYPE_JD_FRAME_TRACE 0x06
 
 // file format
 #define JD_LSTORE_MAGIC0 0x0a4c444a
 #define JD_LSTORE_MAGIC1 0xb5d1841e
-#define JD_LSTORE_VERSION 5
+#define JD_LSTORE_VERSION 6
 
 #define JD_LSTORE_BLOCK_OVERHEAD                                                                   \
     (sizeof(jd_lstore_block_header_t) + sizeof(jd_lstore_block_footer_t))
@@ -90,7 +139,10 @@ typedef struct {
     uint32_t num_rewrites;      // how many times the whole log was rewritten (wrapped-around)
     uint32_t block_magic0;      // used in all blocks in this file
     uint32_t block_magic1;      // used in all blocks in this file
-    uint32_t reserved[6];
+    uint32_t index_stride;      // data blocks per index entry; 0 if no index
+    uint32_t index_entries;     // stored in sectors following this header
+    uint32_t max_data_size;     // of entries in a block (after decompression)
+    uint32_t reserved[3];
 
     // meta-data about device
     jd_lstore_device_info_t devinfo;
@@ -104,10 +156,17 @@ typedef struct {
 typedef struct {
     uint32_t block_magic0;
     uint32_t generation;
-    uint64_t timestamp; // in ms
+    uint64_t timestamp;   // in ms
+    uint32_t num_dropped; // entries dropped just before this block, as no buffer was free
+    uint16_t data_size;   // of entries (after decompression)
+    uint8_t flags;        // JD_LSTORE_BLOCK_*
+    uint8_t reserved;
     uint8_t data[0];
 } jd_lstore_block_header_t;
 
+// data is in LZ4 block format, followed by zeros
+#define JD_LSTORE_BLOCK_COMPRESSED 0x01
+
 typedef struct {
     uint32_t block_magic1;
     uint32_t crc32;
@@ -119,3 +178,76 @@ typedef struct {
     uint16_t tdelta; // wrt to block timestamp
     uint8_t data[0];
 } jd_lstore_entry_t;
+
+// Index entry i is a copy of the header of data block i * index_stride, written after that
+// block. It may be out of date (or zero), so readers check it against the block.
+typedef struct {
+    uint32_t generation;
+    uint32_t reserved;
+    uint64_t timestamp;
+} jd_lstore_index_entry_t;
+
+#define JD_LSTORE_INDEX_PER_SECTOR (512 / sizeof(jd_lstore_index_entry_t))
+
+#if JD_LSTORE || JD_LSTORE_READER
+// LZ4 block format. 'table' has 1 << JD_LZ4_HASH_LOG entries; src_size is at most 0xffff.
+// Returns the compressed size, or -1 if it doesn't fit in dst_size.
+int jd_lz4_compress(const void *src, unsigned src_size, void *dst, unsigned dst_size,
+                    uint16_t *table);
+// Stops when dst is full (src can be followed by padding); returns the number of bytes
+// written to dst, or -1 on invalid data.
+int jd_lz4_decompress(const void *src, unsigned src_size, void *dst, unsigned dst_size);
+#endif
+
+#if JD_LSTORE_READER
+// Reads sectors, relative to the start of the log file; returns 0 on success.
+typedef int (*jd_lstore_read_t)(void *userdata, uint32_t sector, void *dst,
+                                uint32_t num_sectors);
+
+typedef struct {
+    jd_lstore_read_t read;
+    void *userdata;
+    jd_lstore_block_header_t *block; // current block
+    jd_lstore_index_entry_t *index;  // one sector of the index
+    uint8_t *unpacked;               // data of current block, if compressed
+    uint8_t *data;                   // of current block
+    uint32_t data_size;
+    uint32_t max_data_size;
+    uint32_t index_sector;
+    uint32_t block_size;
+    uint32_t header_blocks;
+    uint32_t data_blocks;
+    uint32_t block_magic0;
+    uint32_t block_magic1;
+    uint32_t index_stride;
+    uint32_t index_entries;
+    uint32_t oldest;     // data block with the oldest entries
+    uint32_t num_blocks; // from the oldest to the newest one
+    uint32_t pos;        // of current block, counting from oldest
+    uint32_t data_ptr;   // in current block
+    bool block_valid;
+    // last entry in the log, when opened
+    uint32_t newest_generation;
+    uint64_t newest_timestamp;
+    // statistics
+    uint32_t num_block_reads;
+} jd_lstore_reader_t;
+
+// Finds the oldest block, and positions the reader there. Returns 0 on success.
+int jd_lstore_reader_open(jd_lstore_reader_t *r, jd_lstore_read_t read, void *userdata);
+void jd_lstore_reader_close(jd_lstore_reader_t *r);
+// Positions the reader at the first entry at or after 'timestamp' of 'generation' (or later
+// generation). For the last 5 minutes use:
+// jd_lstore_reader_seek(r, r->newest_generation, r->newest_timestamp - 5 * 60 * 1000)
+void jd_lstore_reader_seek(jd_lstore_reader_t *r, uint32_t generation, uint64_t timestamp);
+// Returns the next entry of given type (0 for any), or NULL at the end of the log.
+// The entry is valid until the next call; the generation is in r->block->generation.
+jd_lstore_entry_t *jd_lstore_reader_next(jd_lstore_reader_t *r, unsigned type,
+                                         uint64_t *timestamp);
+#endif
+
+#if JD_LSTORE
+// Opens a reader for a log being written. Blocks not written to disk yet are not visible,
+// see jd_lstore_force_flush().
+int jd_lstore_open_reader(jd_lstore_reader_t *r, unsigned logidx);
+#endif
@@ -10,6 +10,15 @@
 #define JD_LSTORE_FF 1
 #endif
 
+#if JD_LSTORE_WRITER_THREAD
+#include "jd_thr.h"
+#define LOCK_DISK() jd_thr_lock(&ls_ctx->disk_mutex)
+#define UNLOCK_DISK() jd_thr_unlock(&ls_ctx->disk_mutex)
+#else
+#define LOCK_DISK() ((void)0)
+#define UNLOCK_DISK() ((void)0)
+#endif
+
 #define NOT_IRQ()                                                                                  \
     if (target_in_irq())                                                                           \
     JD_PANIC()
@@ -24,25 +33,44 @@
 
 STATIC_ASSERT(sizeof(jd_lstore_main_header_t) <= SECTOR_SIZE);
 STATIC_ASSERT(JD_LSTORE_ENTRY_HEADER_SIZE == offsetof(jd_lstore_entry_t, data));
+STATIC_ASSERT(JD_LSTORE_BUFFERS >= 2 && JD_LSTORE_BUFFERS <= 0xff);
+// data_size in block header is 16 bit
+STATIC_ASSERT(JD_LSTORE_COMPRESS <= 16);
 
+// Every log has a ring of JD_LSTORE_BUFFERS blocks: ring[ring_head] is being filled
+// (and is also pointed to by 'block'), and the num_full blocks before it wait to be written,
+// oldest first. Entries are dropped only when all the other blocks are waiting.
 typedef struct {
     struct jd_lstore_ctx *parent;
     jd_lstore_block_header_t *block;
-    jd_lstore_block_header_t *block_alt;
+    jd_lstore_block_header_t *ring[JD_LSTORE_BUFFERS];
     // file properties
     uint32_t sector_off;
     uint32_t size;
     uint32_t header_blocks;
     uint32_t data_blocks;
+    uint32_t index_stride;
     uint8_t block_shift; // block_size == 1 << block_shift
-    volatile uint8_t needs_flushing;
+    uint8_t ring_head;
+    volatile uint8_t num_full;
+    // sectors of the oldest full block already written
+    uint8_t write_sector;
     // block-common information
     uint32_t block_magic0;
     uint32_t block_magic1;
     uint32_t block_generation;
     // information about current block
-    uint32_t block_ptr;
+    uint32_t block_ptr; // where the oldest full block goes
     uint32_t data_ptr;
+    // entries dropped since the current block was started
+    uint32_t num_dropped;
+    // data_ptr at which the current block is considered full
+    uint32_t fill_limit;
+#if JD_LSTORE_COMPRESS
+    // the oldest full block (or its first part) as it's written to disk
+    jd_lstore_block_header_t *packed;
+    uint32_t packed_size; // bytes of entries of the full block in 'packed'
+#endif
 } jd_lstore_file_t;
 
 typedef struct jd_lstore_ctx {
@@ -51,6 +79,14 @@ typedef struct jd_lstore_ctx {
     uint8_t panic_mode;
     uint8_t panic_char_ptr;
     uint8_t panic_max_char_ptr;
+#if JD_LSTORE_WRITER_THREAD
+    // held while writing blocks
+    jd_mutex_t disk_mutex;
+    jd_event_t writer_event;
+#endif
+#if JD_LSTORE_COMPRESS
+    uint16_t *lz4_table;
+#endif
     jd_lstore_file_t logs[JD_LSTORE_NUM_FILES];
 } jd_lstore_ctx_t;
 
@@ -169,6 +205,15 @@ static bool validate_header(jd_lstore_file_t *f, jd_lstore_main_header_t *hd) {
             return 0;
         }
 
+        uint32_t index_sectors =
+            (hd->index_entries + JD_LSTORE_INDEX_PER_SECTOR - 1) / JD_LSTORE_INDEX_PER_SECTOR;
+        if (hd->index_stride && (1 + index_sectors > hd->header_blocks * hd->sectors_per_block ||
+                                 hd->index_stride * hd->index_entries <
+                                     hd->num_blocks - hd->header_blocks)) {
+            LOG("invalid index");
+            return 0;
+        }
+
         f->block_shift = sh + SECTOR_SHIFT;
 
         return 1;
@@ -195,19 +240,25 @@ static inline unsigned block_data_size(jd_lstore_file_t *f) {
     return block_size(f) - JD_LSTORE_BLOCK_OVERHEAD;
 }
 
-static inline jd_lstore_block_footer_t *block_footer(jd_lstore_file_t *f) {
-    return (void *)((uint8_t *)f->block + block_size(f) - sizeof(jd_lstore_block_footer_t));
+// of entries in a block buffer
+static inline unsigned block_capacity(jd_lstore_file_t *f) {
+#if JD_LSTORE_COMPRESS
+    return block_data_size(f) * JD_LSTORE_COMPRESS;
+#else
+    return block_data_size(f);
+#endif
 }
 
-static inline jd_lstore_block_footer_t *block_alt_footer(jd_lstore_file_t *f) {
-    return (void *)((uint8_t *)f->block_alt + block_size(f) - sizeof(jd_lstore_block_footer_t));
+static inline jd_lstore_block_footer_t *block_footer(jd_lstore_file_t *f,
+                                                     jd_lstore_block_header_t *b) {
+    return (void *)((uint8_t *)b + block_size(f) - sizeof(jd_lstore_block_footer_t));
 }
 
 static bool block_valid(jd_lstore_file_t *f) {
     LOGV("bl %x %x", f->block->block_magic0, f->block_magic0);
     if (f->block->block_magic0 == f->block_magic0 &&
-        block_footer(f)->block_magic1 == f->block_magic1) {
-        if (jd_crc32(f->block, block_size(f) - 4) == block_footer(f)->crc32)
+        block_footer(f, f->block)->block_magic1 == f->block_magic1) {
+        if (jd_crc32(f->block, block_size(f) - 4) == block_footer(f, f->block)->crc32)
             return 1;
         return 0;
     } else {
@@ -231,12 +282,6 @@ static int read_block(jd_lstore_file_t *f, uint32_t idx) {
     return 0;
 }
 
-static void write_block(jd_lstore_file_t *f, uint32_t idx) {
-    int sh = f->block_shift - SECTOR_SHIFT;
-    JD_ASSERT(idx < f->data_blocks);
-    write_sectors(f, (f->header_blocks + idx) << sh, f->block_alt, 1 << sh);
-}
-
 static bool block_lt(jd_lstore_block_header_t *a, jd_lstore_block_header_t *b) {
     return a->generation < b->generation ||
            (a->generation == b->generation && a->timestamp < b->timestamp);
@@ -302,9 +347,17 @@ static void mount_log(jd_lstore_file_t *f, const char *name, int bl_shift) {
         hd->version = JD_LSTORE_VERSION;
         hd->sector_size = SECTOR_SIZE;
         hd->sectors_per_block = 1 << bl_shift;
-        hd->header_blocks = 1;
+        // the index follows the main header, in the header block(s)
+        hd->header_blocks = (1 + JD_LSTORE_INDEX_SECTORS + (1 << bl_shift) - 1) >> bl_shift;
         f->block_shift = bl_shift + SECTOR_SHIFT;
         hd->num_blocks = f->size >> f->block_shift;
+#if JD_LSTORE_INDEX_SECTORS
+        uint32_t max_entries = JD_LSTORE_INDEX_SECTORS * JD_LSTORE_INDEX_PER_SECTOR;
+        uint32_t data_blocks = hd->num_blocks - hd->header_blocks;
+        hd->index_stride = (data_blocks + max_entries - 1) / max_entries;
+        hd->index_entries = (data_blocks + hd->index_stride - 1) / hd->index_stride;
+#endif
+        hd->max_data_size = block_capacity(f);
         hd->block_magic0 = random_magic();
         hd->block_magic1 = random_magic();
         fill_devinfo(&hd->devinfo);
@@ -313,54 +366,206 @@ static void mount_log(jd_lstore_file_t *f, const char *name, int bl_shift) {
         write_sectors(f, 0, hd, 1);
         if (!validate_header(f, hd))
             JD_PANIC();
+        // clear index
+        void *zero = jd_alloc(SECTOR_SIZE);
+        for (unsigned i = 0; i * JD_LSTORE_INDEX_PER_SECTOR < hd->index_entries; ++i)
+            write_sectors(f, 1 + i, zero, 1);
+        jd_free(zero);
     }
 
     f->header_blocks = hd->header_blocks;
     f->data_blocks = hd->num_blocks - f->header_blocks;
     f->block_magic0 = hd->block_magic0;
     f->block_magic1 = hd->block_magic1;
+    f->index_stride = hd->index_stride;
+
+    if (hd->max_data_size < block_capacity(f)) {
+        LOG("max data size %u -> %u", (unsigned)hd->max_data_size, block_capacity(f));
+        hd->max_data_size = block_capacity(f);
+        write_sectors(f, 0, hd, 1);
+    }
 
     hd->purpose[sizeof(hd->purpose) - 1] = 0;
     LOG("mounted '%s' (%ukB) shift=%u", hd->purpose,
         (unsigned)(f->data_blocks << f->block_shift >> 10), (unsigned)f->block_shift);
 
     jd_free(hd);
-    f->block = jd_alloc(block_size(f));
+    unsigned buf_size = JD_LSTORE_BLOCK_OVERHEAD + block_capacity(f);
+    f->block = jd_alloc(buf_size);
 
     find_boundry(f);
 
-    // prep block for writing
-    memset(f->block, 0, block_size(f));
+    // prep blocks for writing
+    memset(f->block, 0, buf_size);
     f->block->block_magic0 = f->block_magic0;
-    block_footer(f)->block_magic1 = f->block_magic1;
+#if JD_LSTORE_COMPRESS
+    f->packed = jd_memdup(f->block, block_size(f));
+    block_footer(f, f->packed)->block_magic1 = f->block_magic1;
+#else
+    block_footer(f, f->block)->block_magic1 = f->block_magic1;
+#endif
+    f->fill_limit = block_data_size(f);
 
-    f->block_alt = jd_memdup(f->block, block_size(f));
+    f->ring[0] = f->block;
+    for (int i = 1; i < JD_LSTORE_BUFFERS; ++i)
+        f->ring[i] = jd_memdup(f->block, buf_size);
 
     LOG("generation %u (ptr=%u)", (unsigned)f->block_generation, (unsigned)f->block_ptr);
 }
 
+static void update_index(jd_lstore_file_t *f, jd_lstore_block_header_t *b) {
+    uint32_t slot = f->block_ptr / f->index_stride;
+    uint32_t sector = 1 + slot / JD_LSTORE_INDEX_PER_SECTOR;
+    jd_lstore_index_entry_t *idx = jd_alloc(SECTOR_SIZE);
+    read_sectors(f, sector, idx, 1);
+    idx[slot % JD_LSTORE_INDEX_PER_SECTOR].generation = b->generation;
+    idx[slot % JD_LSTORE_INDEX_PER_SECTOR].timestamp = b->timestamp;
+    write_sectors(f, sector, idx, 1);
+    jd_free(idx);
+}
+
+// called with IRQs disabled
 static int request_flush(jd_lstore_file_t *f) {
     JD_ASSERT(f->data_ptr != 0);
-    if (f->needs_flushing)
+    if (f->num_full == JD_LSTORE_BUFFERS - 1)
         return -1;
-    jd_lstore_block_header_t *tmp = f->block;
-    f->block = f->block_alt;
-    f->block_alt = tmp;
-    f->needs_flushing = 1;
-    LOG("flushing %u/%u @%d", (unsigned)f->data_ptr, block_data_size(f),
-        (int)(f - f->parent->logs));
+    f->num_full++;
+    f->block->data_size = f->data_ptr;
+    f->ring_head = (f->ring_head + 1) % JD_LSTORE_BUFFERS;
+    f->block = f->ring[f->ring_head];
+    LOGV("flushing %u/%u @%d", (unsigned)f->data_ptr, block_data_size(f),
+         (int)(f - f->parent->logs));
     f->data_ptr = 0;
     return 0;
 }
 
-static void flush_to_disk_core(jd_lstore_file_t *f) {
-    block_alt_footer(f)->crc32 = jd_crc32(f->block_alt, block_size(f) - 4);
-    LOGV("writing block %d g=%d", f->block_ptr, f->block_alt->generation);
-    write_block(f, f->block_ptr++);
-    // clear it for future use
-    memset(f->block_alt->data, 0, block_data_size(f));
+static void request_partial_flush(jd_lstore_file_t *f) {
+    target_disable_irq();
+    if (f->data_ptr != 0)
+        request_flush(f);
+    target_enable_irq();
+}
+
+#if JD_LSTORE_COMPRESS
+// offset of the last entry boundary in b, at or before 'limit'
+static unsigned entry_boundary(jd_lstore_block_header_t *b, unsigned limit) {
+    unsigned p = 0;
+    for (;;) {
+        jd_lstore_entry_t *ent = (void *)&b->data[p];
+        unsigned next = p + JD_LSTORE_ENTRY_HEADER_SIZE + ent->size;
+        if (p == b->data_size || next > limit)
+            return p;
+        p = next;
+    }
+}
+
+// Compresses as many entries of b as fit in a block into f->packed.
+static void pack_block(jd_lstore_file_t *f, jd_lstore_block_header_t *b) {
+    jd_lstore_block_header_t *z = f->packed;
+    unsigned dsize = block_data_size(f);
+    unsigned len = b->data_size;
+    int zlen;
+
+    for (;;) {
+        zlen = jd_lz4_compress(b->data, len, z->data, dsize, f->parent->lz4_table);
+        if (zlen >= 0 || len <= dsize)
+            break;
+        // fill_limit was too optimistic; try with fewer entries
+        len = entry_boundary(b, len * 3 / 4 > dsize ? len * 3 / 4 : dsize);
+    }
+
+    z->generation = b->generation;
+    z->timestamp = b->timestamp;
+    z->num_dropped = b->num_dropped;
+    z->data_size = len;
+    if (zlen >= 0) {
+        z->flags = JD_LSTORE_BLOCK_COMPRESSED;
+        memset(z->data + zlen, 0, dsize - zlen);
+    } else {
+        // doesn't compress; the entries fit anyway
+        z->flags = 0;
+        zlen = len;
+        memcpy(z->data, b->data, len);
+        memset(z->data + len, 0, dsize - len);
+    }
+    block_footer(f, z)->crc32 = jd_crc32(z, block_size(f) - 4);
+    f->packed_size = len;
+
+    // fill the next blocks so that they compress to about 15/16 of a block
+    if (len >= dsize / 2) {
+        unsigned limit = (uint64_t)len * (dsize - dsize / 16) / zlen;
+        if (limit < dsize)
+            limit = dsize;
+        if (limit > block_capacity(f))
+            limit = block_capacity(f);
+        target_disable_irq();
+        f->fill_limit = limit;
+        target_enable_irq();
+    }
+
+    LOGV("packed %u -> %d", len, zlen);
+}
 
-    if (f->block_ptr >= f->data_blocks) {
+// Removes entries written to disk from b; the rest goes in the next block.
+static void drop_packed(jd_lstore_file_t *f, jd_lstore_block_header_t *b) {
+    unsigned len = f->packed_size;
+    unsigned rest = b->data_size - len;
+    unsigned t0 = ((jd_lstore_entry_t *)&b->data[len])->tdelta;
+    memmove(b->data, b->data + len, rest);
+    memset(b->data + rest, 0, len);
+    for (unsigned p = 0; p < rest;) {
+        jd_lstore_entry_t *ent = (void *)&b->data[p];
+        ent->tdelta -= t0;
+        p += JD_LSTORE_ENTRY_HEADER_SIZE + ent->size;
+    }
+    b->timestamp += t0;
+    b->data_size = rest;
+    b->num_dropped = 0;
+}
+#endif
+
+// Writes up to max_sectors of the oldest full block; returns 0 if there was nothing to write.
+// Called with disk lock held (if any).
+static int flush_step(jd_lstore_file_t *f, unsigned max_sectors) {
+    target_disable_irq();
+    jd_lstore_block_header_t *b =
+        f->num_full
+            ? f->ring[(f->ring_head + JD_LSTORE_BUFFERS - f->num_full) % JD_LSTORE_BUFFERS]
+            : NULL;
+    target_enable_irq();
+    if (!b)
+        return 0;
+
+#if JD_LSTORE_COMPRESS
+    jd_lstore_block_header_t *src = f->packed;
+#else
+    jd_lstore_block_header_t *src = b;
+#endif
+
+    unsigned sh = f->block_shift - SECTOR_SHIFT;
+    unsigned n = (1 << sh) - f->write_sector;
+    if (n > max_sectors)
+        n = max_sectors;
+    if (f->write_sector == 0) {
+#if JD_LSTORE_COMPRESS
+        pack_block(f, b);
+#else
+        block_footer(f, b)->crc32 = jd_crc32(b, block_size(f) - 4);
+#endif
+        LOGV("writing block %d g=%d", f->block_ptr, b->generation);
+    }
+    JD_ASSERT(f->block_ptr < f->data_blocks);
+    write_sectors(f, ((f->header_blocks + f->block_ptr) << sh) + f->write_sector,
+                  (uint8_t *)src + (f->write_sector << SECTOR_SHIFT), n);
+    f->write_sector += n;
+    if (f->write_sector < (1U << sh))
+        return 1;
+
+    f->write_sector = 0;
+    if (f->index_stride && f->block_ptr % f->index_stride == 0 && !f->parent->panic_mode)
+        update_index(f, src);
+
+    if (++f->block_ptr >= f->data_blocks) {
         if (!f->parent->panic_mode) {
             jd_lstore_main_header_t *hd = jd_alloc(SECTOR_SIZE);
             read_sectors(f, 0, hd, 1);
@@ -372,43 +577,68 @@ static void flush_to_disk_core(jd_lstore_file_t *f) {
         f->block_ptr = 0;
     }
 
-    f->needs_flushing = 0;
-}
-
-static void flush_to_disk(jd_lstore_file_t *f) {
-    NOT_IRQ();
+#if JD_LSTORE_COMPRESS
+    if (f->packed_size < b->data_size) {
+        drop_packed(f, b);
+        return 1;
+    }
+#endif
 
-    int needs_flushing = 0;
+    // clear it for future use
+    memset(b->data, 0, block_capacity(f));
 
     target_disable_irq();
-    if (f->data_ptr != 0 && !f->needs_flushing)
-        request_flush(f);
-    if (f->needs_flushing) {
-        JD_ASSERT(f->needs_flushing == 1);
-        f->needs_flushing = 2;
-        needs_flushing = 1;
-    }
+    f->num_full--;
     target_enable_irq();
 
-    if (!needs_flushing)
-        return;
+    return 1;
+}
 
-    flush_to_disk_core(f);
+static void flush_all(jd_lstore_file_t *f) {
+    while (flush_step(f, 0xff))
+        ;
 }
 
+#if JD_LSTORE_WRITER_THREAD
+static void writer_worker(void *userdata) {
+    jd_lstore_ctx_t *ctx = userdata;
+    for (;;) {
+        jd_thr_wait_event(&ctx->writer_event, 100);
+        LOCK_DISK();
+        for (int i = 0; i < JD_LSTORE_NUM_FILES; ++i)
+            flush_all(&ctx->logs[i]);
+        UNLOCK_DISK();
+    }
+}
+#endif
+
 void jd_lstore_process(void) {
     jd_lstore_ctx_t *ctx = ls_ctx;
 
     if (!ctx || !ctx->logs[0].block)
         return;
 
-    int force = jd_should_sample_ms(&ctx->flush_timer, JD_LSTORE_FLUSH_SECONDS * 1000);
+    NOT_IRQ();
 
-    for (int i = 0; i < JD_LSTORE_NUM_FILES; ++i) {
-        jd_lstore_file_t *lf = &ctx->logs[i];
-        if (lf->needs_flushing || force)
-            flush_to_disk(lf);
-    }
+    if (jd_should_sample_ms(&ctx->flush_timer, JD_LSTORE_FLUSH_SECONDS * 1000))
+        for (int i = 0; i < JD_LSTORE_NUM_FILES; ++i)
+            request_partial_flush(&ctx->logs[i]);
+
+#if JD_LSTORE_WRITER_THREAD
+    for (int i = 0; i < JD_LSTORE_NUM_FILES; ++i)
+        if (ctx->logs[i].num_full)
+            jd_thr_signal_event(&ctx->writer_event);
+#else
+    // write in chunks, for at most JD_LSTORE_FLUSH_US (but at least one chunk)
+    uint32_t start = (uint32_t)tim_get_micros();
+    bool progress;
+    do {
+        progress = false;
+        for (int i = 0; i < JD_LSTORE_NUM_FILES; ++i)
+            if (flush_step(&ctx->logs[i], JD_LSTORE_FLUSH_SECTORS))
+                progress = true;
+    } while (progress && (uint32_t)tim_get_micros() - start < JD_LSTORE_FLUSH_US);
+#endif
 }
 
 void jd_lstore_force_flush(void) {
@@ -417,11 +647,18 @@ void jd_lstore_force_flush(void) {
     if (!ctx || !ctx->logs[0].block)
         return;
 
-    for (int k = 0; k < 2; ++k)
-        for (int i = 0; i < JD_LSTORE_NUM_FILES; ++i) {
-            jd_lstore_file_t *lf = &ctx->logs[i];
-            flush_to_disk(lf);
-        }
+    NOT_IRQ();
+
+    LOCK_DISK();
+    for (int i = 0; i < JD_LSTORE_NUM_FILES; ++i) {
+        jd_lstore_file_t *lf = &ctx->logs[i];
+        request_partial_flush(lf);
+        flush_all(lf);
+        // if all buffers were full before
+        request_partial_flush(lf);
+        flush_all(lf);
+    }
+    UNLOCK_DISK();
 }
 
 int jd_lstore_append_frag(unsigned logidx, unsigned type, const void *data, unsigned datasize) {
@@ -460,6 +697,8 @@ int jd_lstore_append(unsigned logidx, unsigned type, const void *data, unsigned
             // starting new block
             f->block->timestamp = now_ms_long;
             f->block->generation = f->block_generation;
+            f->block->num_dropped = f->num_dropped;
+            f->num_dropped = 0;
         }
 
         int64_t delta = now_ms_long - f->block->timestamp;
@@ -470,7 +709,7 @@ int jd_lstore_append(unsigned logidx, unsigned type, const void *data, unsigned
             // need flush
         } else {
             uint32_t new_data_ptr = f->data_ptr + JD_LSTORE_ENTRY_HEADER_SIZE + datasize;
-            if (delta > 0xffff || new_data_ptr > block_data_size(f)) {
+            if (delta > 0xffff || new_data_ptr > f->fill_limit) {
                 // need flush
             } else {
                 // normal path
@@ -485,7 +724,8 @@ int jd_lstore_append(unsigned logidx, unsigned type, const void *data, unsigned
 
         res = request_flush(f);
         if (res) {
-            // TODO store that there was overflow
+            // recorded in the header of the next block
+            f->num_dropped++;
             break;
         }
     }
@@ -580,6 +820,16 @@ void jd_lstore_init(void) {
     mount_log(&ctx->logs[0], "packets and serial", 3); // 4K
     mount_log(&ctx->logs[1], "data log", 0);           // 0.5K
 
+#if JD_LSTORE_COMPRESS
+    ctx->lz4_table = jd_alloc(sizeof(uint16_t) << JD_LZ4_HASH_LOG);
+#endif
+
+#if JD_LSTORE_WRITER_THREAD
+    jd_thr_init_mutex(&ctx->disk_mutex);
+    jd_thr_init_event(&ctx->writer_event);
+    jd_thr_start_thread(writer_worker, ctx);
+#endif
+
     jd_lstore_device_info_t info;
     fill_devinfo(&info);
 
@@ -587,6 +837,22 @@ void jd_lstore_init(void) {
         jd_lstore_append(i, JD_LSTORE_TYPE_DEVINFO, &info, sizeof(info));
 }
 
+static int log_read(void *userdata, uint32_t sector, void *dst, uint32_t num_sectors) {
+    LOCK_DISK();
+    read_sectors(userdata, sector, dst, num_sectors);
+    UNLOCK_DISK();
+    return 0;
+}
+
+int jd_lstore_open_reader(jd_lstore_reader_t *r, unsigned logidx) {
+    jd_lstore_ctx_t *ctx = ls_ctx;
+    JD_ASSERT(logidx < JD_LSTORE_NUM_FILES);
+    if (!ctx || !ctx->logs[logidx].block)
+        return -10;
+    NOT_IRQ();
+    return jd_lstore_reader_open(r, log_read, &ctx->logs[logidx]);
+}
+
 /*
  * Dump to SD card in panic handler.
  */
@@ -599,16 +865,17 @@ void jd_lstore_init(void) {
 #define PANIC_LOG(msg, ...) DMESG("sdpanic: " msg, ##__VA_ARGS__)
 
 static void flush_to_disk_in_panic(jd_lstore_file_t *f) {
-    if (f->needs_flushing)
-        flush_to_disk_core(f);
-    if (f->data_ptr != 0 && !f->needs_flushing)
+    // a chunked write in progress is just continued
+    flush_all(f);
+    if (f->data_ptr != 0)
         request_flush(f);
-    if (f->needs_flushing)
-        flush_to_disk_core(f);
+    flush_all(f);
     f->parent->panic_char_ptr = 0;
     f->parent->panic_max_char_ptr = 0;
     f->block->timestamp = now_ms_long;
     f->block->generation = f->block_generation;
+    f->block->num_dropped = f->num_dropped;
+    f->num_dropped = 0;
 }
 
 static int sd_get_resp(void) {
@@ -0,0 +1,330 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+#include "jd_storage.h"
+
+#if JD_LSTORE_READER
+
+#define SECTOR_SHIFT 9
+#define SECTOR_SIZE (1 << SECTOR_SHIFT)
+
+#define LOG(msg, ...) DMESG("lstore: " msg, ##__VA_ARGS__)
+
+// Blocks are ordered by (generation, timestamp); invalid blocks have both set to 0.
+static int key_cmp(uint32_t ga, uint64_t ta, uint32_t gb, uint64_t tb) {
+    if (ga != gb)
+        return ga < gb ? -1 : 1;
+    if (ta != tb)
+        return ta < tb ? -1 : 1;
+    return 0;
+}
+
+static int block_cmp(jd_lstore_block_header_t *b, uint32_t generation, uint64_t timestamp) {
+    return key_cmp(b->generation, b->timestamp, generation, timestamp);
+}
+
+static inline unsigned block_data_size(jd_lstore_reader_t *r) {
+    return r->block_size - JD_LSTORE_BLOCK_OVERHEAD;
+}
+
+// reads data block 'idx' (counting from the start of the file)
+static bool load_block(jd_lstore_reader_t *r, uint32_t idx) {
+    jd_lstore_block_header_t *b = r->block;
+    jd_lstore_block_footer_t *footer =
+        (void *)((uint8_t *)b + r->block_size - sizeof(jd_lstore_block_footer_t));
+    unsigned sectors = r->block_size >> SECTOR_SHIFT;
+    r->num_block_reads++;
+    if (r->read(r->userdata, (r->header_blocks + idx) * sectors, b, sectors) == 0 &&
+        b->block_magic0 == r->block_magic0 && footer->block_magic1 == r->block_magic1 &&
+        jd_crc32(b, r->block_size - 4) == footer->crc32)
+        return true;
+    b->generation = 0;
+    b->timestamp = 0;
+    return false;
+}
+
+static inline uint32_t pos_to_block(jd_lstore_reader_t *r, uint32_t pos) {
+    return (r->oldest + pos) % r->data_blocks;
+}
+
+static inline uint32_t block_to_pos(jd_lstore_reader_t *r, uint32_t idx) {
+    return (idx + r->data_blocks - r->oldest) % r->data_blocks;
+}
+
+static jd_lstore_index_entry_t *index_entry(jd_lstore_reader_t *r, uint32_t slot) {
+    uint32_t sector = 1 + slot / JD_LSTORE_INDEX_PER_SECTOR;
+    if (r->index_sector != sector) {
+        if (r->read(r->userdata, sector, r->index, 1) != 0) {
+            r->index_sector = 0;
+            return NULL;
+        }
+        r->index_sector = sector;
+    }
+    return &r->index[slot % JD_LSTORE_INDEX_PER_SECTOR];
+}
+
+// Returns the last block in [l, h] not older than block l, assuming blocks are not older
+// than their predecessors, except for one place, where the ring wraps around.
+static uint32_t find_last_not_older(jd_lstore_reader_t *r, uint32_t l, uint32_t h) {
+    load_block(r, l);
+    uint32_t gen = r->block->generation;
+    uint64_t ts = r->block->timestamp;
+    while (l < h) {
+        uint32_t m = (l + h) / 2 + 1;
+        load_block(r, m);
+        if (block_cmp(r->block, gen, ts) >= 0)
+            l = m;
+        else
+            h = m - 1;
+    }
+    return l;
+}
+
+// the same as find_boundry() in the writer
+static int find_newest_full(jd_lstore_reader_t *r) {
+    if (!load_block(r, 0))
+        return -1;
+    return find_last_not_older(r, 0, r->data_blocks - 1);
+}
+
+// Uses the index to start the search close to the newest block.
+// Returns -1 if the index doesn't agree with the blocks.
+static int find_newest_indexed(jd_lstore_reader_t *r) {
+    int best = -1;
+    uint32_t gen = 0;
+    uint64_t ts = 0;
+    for (uint32_t s = 0; s < r->index_entries; ++s) {
+        jd_lstore_index_entry_t *e = index_entry(r, s);
+        if (!e)
+            return -1;
+        if (e->generation && key_cmp(e->generation, e->timestamp, gen, ts) >= 0) {
+            best = s;
+            gen = e->generation;
+            ts = e->timestamp;
+        }
+    }
+    if (best < 0)
+        return -1;
+
+    uint32_t n = r->data_blocks;
+    uint32_t l = best * r->index_stride;
+    if (!load_block(r, l) || block_cmp(r->block, gen, ts) != 0)
+        return -1;
+    uint32_t h = n - 1;
+    uint32_t next_slot = l + r->index_stride;
+    if (next_slot < n && (!load_block(r, next_slot) || block_cmp(r->block, gen, ts) < 0))
+        h = next_slot - 1;
+    l = find_last_not_older(r, l, h);
+
+    // the block after the newest one has to be older (or invalid)
+    load_block(r, l);
+    gen = r->block->generation;
+    ts = r->block->timestamp;
+    uint32_t next = (l + 1) % n;
+    if (next != l && load_block(r, next) && block_cmp(r->block, gen, ts) >= 0)
+        return -1;
+    return l;
+}
+
+static bool unpack_block(jd_lstore_reader_t *r) {
+    jd_lstore_block_header_t *b = r->block;
+    if (!(b->flags & JD_LSTORE_BLOCK_COMPRESSED)) {
+        r->data = b->data;
+        r->data_size = block_data_size(r);
+        return true;
+    }
+    if (b->data_size > r->max_data_size ||
+        jd_lz4_decompress(b->data, block_data_size(r), r->unpacked, b->data_size) !=
+            b->data_size)
+        return false;
+    r->data = r->unpacked;
+    r->data_size = b->data_size;
+    return true;
+}
+
+static void load_current(jd_lstore_reader_t *r) {
+    r->data_ptr = 0;
+    r->block_valid =
+        r->pos < r->num_blocks && load_block(r, pos_to_block(r, r->pos)) && unpack_block(r);
+}
+
+int jd_lstore_reader_open(jd_lstore_reader_t *r, jd_lstore_read_t read, void *userdata) {
+    memset(r, 0, sizeof(*r));
+    r->read = read;
+    r->userdata = userdata;
+
+    jd_lstore_main_header_t *hd = jd_alloc(SECTOR_SIZE);
+    int res = read(userdata, 0, hd, 1);
+    if (res == 0 && (hd->magic0 != JD_LSTORE_MAGIC0 || hd->magic1 != JD_LSTORE_MAGIC1 ||
+                     hd->version != JD_LSTORE_VERSION || hd->sector_size != SECTOR_SIZE ||
+                     hd->sectors_per_block == 0 || hd->sectors_per_block > 8 ||
+                     (hd->sectors_per_block & (hd->sectors_per_block - 1)) != 0 ||
+                     hd->num_blocks <= hd->header_blocks)) {
+        LOG("invalid header");
+        res = -2;
+    }
+    if (res == 0) {
+        r->block_size = hd->sectors_per_block << SECTOR_SHIFT;
+        r->header_blocks = hd->header_blocks;
+        r->data_blocks = hd->num_blocks - hd->header_blocks;
+        r->block_magic0 = hd->block_magic0;
+        r->block_magic1 = hd->block_magic1;
+        uint32_t index_sectors =
+            (hd->index_entries + JD_LSTORE_INDEX_PER_SECTOR - 1) / JD_LSTORE_INDEX_PER_SECTOR;
+        if (hd->index_stride && 1 + index_sectors <= hd->header_blocks * hd->sectors_per_block &&
+            hd->index_stride * hd->index_entries >= r->data_blocks) {
+            r->index_stride = hd->index_stride;
+            r->index_entries = hd->index_entries;
+        }
+        r->max_data_size = hd->max_data_size;
+        if (r->max_data_size > 0xffff)
+            res = -2;
+    }
+    jd_free(hd);
+    if (res)
+        return res;
+
+    r->block = jd_alloc(r->block_size);
+    if (r->index_stride)
+        r->index = jd_alloc(SECTOR_SIZE);
+    if (r->max_data_size)
+        r->unpacked = jd_alloc(r->max_data_size);
+
+    int newest = -1;
+    if (r->index_stride)
+        newest = find_newest_indexed(r);
+    if (newest < 0)
+        newest = find_newest_full(r);
+
+    if (newest < 0) {
+        r->num_blocks = 0;
+    } else {
+        // if the log didn't wrap around yet, the blocks after the newest are empty;
+        // one may be damaged if the device was reset while writing it
+        uint32_t n = r->data_blocks;
+        if (!load_block(r, (newest + 1) % n) && !load_block(r, (newest + 2) % n))
+            r->oldest = 0;
+        else
+            r->oldest = (newest + 1) % n;
+        r->num_blocks = block_to_pos(r, newest) + 1;
+
+        r->pos = r->num_blocks - 1;
+        load_current(r);
+        r->newest_generation = r->block->generation;
+        r->newest_timestamp = r->block->timestamp;
+        uint64_t ts;
+        while (jd_lstore_reader_next(r, 0, &ts))
+            r->newest_timestamp = ts;
+    }
+
+    r->pos = 0;
+    load_current(r);
+    return 0;
+}
+
+void jd_lstore_reader_close(jd_lstore_reader_t *r) {
+    if (r->block)
+        jd_free(r->block);
+    if (r->index)
+        jd_free(r->index);
+    if (r->unpacked)
+        jd_free(r->unpacked);
+    r->block = NULL;
+    r->index = NULL;
+    r->unpacked = NULL;
+}
+
+// Returns the last position in [l, h] with block not newer than (generation, timestamp),
+// or l if there is none.
+static uint32_t find_last_not_newer(jd_lstore_reader_t *r, uint32_t l, uint32_t h,
+                                    uint32_t generation, uint64_t timestamp) {
+    while (l < h) {
+        uint32_t m = (l + h) / 2 + 1;
+        load_block(r, pos_to_block(r, m));
+        if (block_cmp(r->block, generation, timestamp) <= 0)
+            l = m;
+        else
+            h = m - 1;
+    }
+    return l;
+}
+
+void jd_lstore_reader_seek(jd_lstore_reader_t *r, uint32_t generation, uint64_t timestamp) {
+    if (r->num_blocks == 0)
+        return;
+
+    uint32_t l = 0, h = r->num_blocks - 1;
+
+    if (r->index_stride) {
+        // narrow down [l, h] to two neighboring index entries
+        uint32_t il = 0, ih = r->num_blocks;
+        for (uint32_t s = 0; s < r->index_entries; ++s) {
+            jd_lstore_index_entry_t *e = index_entry(r, s);
+            if (!e)
+                break;
+            uint32_t p = block_to_pos(r, s * r->index_stride);
+            if (p >= r->num_blocks || !e->generation)
+                continue;
+            if (key_cmp(e->generation, e->timestamp, generation, timestamp) <= 0) {
+                if (p > il)
+                    il = p;
+            } else if (p < ih) {
+                ih = p;
+            }
+        }
+        // entries may be out of date, so check the actual blocks
+        bool ok = il < ih;
+        if (ok && il > 0)
+            ok = load_block(r, pos_to_block(r, il)) &&
+                 block_cmp(r->block, generation, timestamp) <= 0;
+        if (ok && ih < r->num_blocks)
+            ok = load_block(r, pos_to_block(r, ih)) &&
+                 block_cmp(r->block, generation, timestamp) > 0;
+        if (ok) {
+            l = il;
+            h = ih - 1;
+        }
+    }
+
+    r->pos = find_last_not_newer(r, l, h, generation, timestamp);
+    load_current(r);
+
+    // skip entries before the timestamp
+    jd_lstore_block_header_t *b = r->block;
+    if (!r->block_valid || block_cmp(b, generation, timestamp) > 0)
+        return;
+    while (r->data_ptr + JD_LSTORE_ENTRY_HEADER_SIZE <= r->data_size) {
+        jd_lstore_entry_t *ent = (void *)&r->data[r->data_ptr];
+        // a corrupted size is left for jd_lstore_reader_next(), which skips the rest of the block
+        if (ent->type == 0 ||
+            r->data_ptr + JD_LSTORE_ENTRY_HEADER_SIZE + ent->size > r->data_size ||
+            (b->generation == generation && b->timestamp + ent->tdelta >= timestamp))
+            break;
+        r->data_ptr += JD_LSTORE_ENTRY_HEADER_SIZE + ent->size;
+    }
+}
+
+jd_lstore_entry_t *jd_lstore_reader_next(jd_lstore_reader_t *r, unsigned type,
+                                         uint64_t *timestamp) {
+    for (;;) {
+        if (r->pos >= r->num_blocks)
+            return NULL;
+        jd_lstore_block_header_t *b = r->block;
+        while (r->block_valid && r->data_ptr + JD_LSTORE_ENTRY_HEADER_SIZE <= r->data_size) {
+            jd_lstore_entry_t *ent = (void *)&r->data[r->data_ptr];
+            if (ent->type == 0 ||
+                r->data_ptr + JD_LSTORE_ENTRY_HEADER_SIZE + ent->size > r->data_size)
+                break;
+            r->data_ptr += JD_LSTORE_ENTRY_HEADER_SIZE + ent->size;
+            if (type && ent->type != type)
+                continue;
+            if (timestamp)
+                *timestamp = b->timestamp + ent->tdelta;
+            return ent;
+        }
+        r->pos++;
+        load_current(r);
+    }
+}
+
+#endif
@@ -0,0 +1,149 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+#include "jd_storage.h"
+
+#if JD_LSTORE || JD_LSTORE_READER
+
+// LZ4 block format: sequences of a token (literal length << 4 | match length - 4),
+// extra literal length bytes, literals, 16-bit match offset, and extra match length bytes.
+// The last sequence has only literals.
+
+#define MIN_MATCH 4
+// the last match has to start at least 12 bytes before the end, and leave 5 literals
+#define MF_LIMIT 12
+#define LAST_LITERALS 5
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v) {
+    return (v * 2654435761U) >> (32 - JD_LZ4_HASH_LOG);
+}
+
+static uint8_t *put_length(uint8_t *op, unsigned n) {
+    while (n >= 255) {
+        *op++ = 255;
+        n -= 255;
+    }
+    *op++ = n;
+    return op;
+}
+
+// match_len == 0 for the last sequence
+static uint8_t *put_sequence(uint8_t *op, uint8_t *oend, const uint8_t *lit, unsigned lit_len,
+                             unsigned offset, unsigned match_len) {
+    unsigned m = match_len ? match_len - MIN_MATCH : 0;
+    if ((unsigned)(oend - op) < 1 + lit_len + lit_len / 255 + 1 + 2 + m / 255 + 1)
+        return NULL;
+    uint8_t *token = op++;
+    *token = (lit_len >= 15 ? 15 : lit_len) << 4;
+    if (lit_len >= 15)
+        op = put_length(op, lit_len - 15);
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if (match_len) {
+        *op++ = offset & 0xff;
+        *op++ = offset >> 8;
+        *token |= m >= 15 ? 15 : m;
+        if (m >= 15)
+            op = put_length(op, m - 15);
+    }
+    return op;
+}
+
+int jd_lz4_compress(const void *src, unsigned src_size, void *dst, unsigned dst_size,
+                    uint16_t *table) {
+    const uint8_t *base = src;
+    const uint8_t *ip = base, *anchor = base, *end = base + src_size;
+    uint8_t *op = dst, *oend = op + dst_size;
+
+    JD_ASSERT(src_size <= 0xffff);
+    memset(table, 0, sizeof(uint16_t) << JD_LZ4_HASH_LOG);
+
+    if (src_size > MF_LIMIT) {
+        const uint8_t *mf_limit = end - MF_LIMIT;
+        const uint8_t *match_limit = end - LAST_LITERALS;
+        while (ip < mf_limit) {
+            uint32_t seq = read32(ip);
+            uint32_t h = hash32(seq);
+            const uint8_t *ref = base + table[h];
+            table[h] = ip - base;
+            if (ref >= ip || read32(ref) != seq) {
+                ip++;
+                continue;
+            }
+            unsigned len = MIN_MATCH;
+            while (ip + len < match_limit && ref[len] == ip[len])
+                len++;
+            op = put_sequence(op, oend, anchor, ip - anchor, ip - ref, len);
+            if (!op)
+                return -1;
+            ip += len;
+            anchor = ip;
+        }
+    }
+
+    op = put_sequence(op, oend, anchor, end - anchor, 0, 0);
+    if (!op)
+        return -1;
+    return op - (uint8_t *)dst;
+}
+
+int jd_lz4_decompress(const void *src, unsigned src_size, void *dst, unsigned dst_size) {
+    const uint8_t *ip = src, *iend = ip + src_size;
+    uint8_t *op = dst, *oend = op + dst_size;
+
+    while (ip < iend) {
+        unsigned token = *ip++;
+        unsigned n = token >> 4;
+        if (n == 15) {
+            unsigned b;
+            do {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                n += b;
+            } while (b == 255);
+        }
+        if (n > (unsigned)(iend - ip) || n > (unsigned)(oend - op))
+            return -1;
+        memcpy(op, ip, n);
+        op += n;
+        ip += n;
+        // the rest of the input is padding
+        if (op == oend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        unsigned offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (unsigned)(op - (uint8_t *)dst))
+            return -1;
+        n = token & 15;
+        if (n == 15) {
+            unsigned b;
+            do {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                n += b;
+            } while (b == 255);
+        }
+        n += MIN_MATCH;
+        if (n > (unsigned)(oend - op))
+            return -1;
+        // may overlap
+        const uint8_t *ref = op - offset;
+        while (n--)
+            *op++ = *ref++;
+    }
+
+    return op - (uint8_t *)dst;
+}
+
+#endif